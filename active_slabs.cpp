@@ -2,16 +2,32 @@
 
 #include "active_slabs.h"
 #include "memcached.h"
+#include <limits.h>
+#include <string.h>
 
 
-__thread char slabs_path[32];
+__thread char slabs_path[PATH_MAX];
 
 static __thread PMEMobjpool *pop;
 
 active_slab_table_t* allocate_ast(uint32_t id) {
 
-    //char path[32];
-    sprintf(slabs_path, "/tmp/slabs_thread_%u", id); //thread id as file name
+    //thread id as file name, in the first of the pool directories or, in
+    //NUMA mode, in the one whose slab pool is on the thread's own node
+    const char *dir = settings.pool_dirs;
+    int node = thread_numa_node();
+    if (node >= 0) {
+        int ndirs = 1;
+        for (const char *c = dir; *c; c++) {
+            if (*c == ':') ndirs++;
+        }
+        for (int skip = numa_node_index(node) % ndirs; skip > 0; skip--) {
+            dir = strchr(dir, ':') + 1;
+        }
+    }
+    size_t dirlen = strcspn(dir, ":");
+    snprintf(slabs_path, sizeof(slabs_path), "%.*s/slabs_thread_%u",
+             (int)dirlen, dir, id);
 
     //remove file if it exists
     //TODO might want to remove this instruction in the future
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 #include <pthread.h>
 
 typedef  unsigned long  int  ub4;   /* unsigned 4-byte quantities */
@@ -329,8 +330,13 @@ void assoc_init(const int hashtable_init, int num_threads) {
 
     EpochThread epoch = EpochThreadInit(num_threads);
 
+    // The hash table pool lives in the first of the pool directories
+    char path[PATH_MAX];
+    size_t dirlen = strcspn(settings.pool_dirs, ":");
+    snprintf(path, sizeof(path), "%.*s/ht_pool", (int)dirlen, settings.pool_dirs);
+
     // hashtable = clht_create(hashsize(hashpower));
-    hashtable = ht_new(epoch, hashsize(hashpower));
+    hashtable = ht_new(epoch, hashsize(hashpower), path, settings.ht_pool_size);
 
     if (!hashtable) {
         fprintf(stderr, "Failed to init hashtable.\n");
@@ -359,9 +365,12 @@ void assoc_thread_init(int thread_id) {
     // ssmem_alloc_init_fs_size(obj_alloc, SSMEM_DEFAULT_MEM_SIZE, SSMEM_GC_FREE_SET_SIZE, thread_id);
 }
 
-void assoc_recover(active_slab_table_t** slab_tables, int num_threads) {
+void assoc_recover(int num_threads) {
+    // Items of the DRAM tier are gone after a restart, and so must be
+    // their index entries before anything dereferences them
+    ht_drop_volatile(hashtable, slabs_is_persistent);
     ht_recover(hashtable, page_tables, num_threads);
-    slabs_recover(slab_tables, hashtable, num_threads);
+    slabs_recover(hashtable);
 }
 
 item* assoc_find(const char* key, const size_t nkey, const uint32_t hv) {
@@ -423,6 +432,12 @@ int assoc_delete(const char* key, const size_t nkey, const uint32_t hv) {
     return 0;
 }
 
+/* Removes the entry for the item's key only if it still points at it */
+int assoc_delete_item(item* it, const uint32_t hv) {
+    return ht_remove_value(hashtable, (skey_t)hv, ITEM_key(it), it->nkey,
+                           (svalue_t)it, epoch, lc) != 0;
+}
+
 int start_assoc_maintenance_thread() {
     return 0;
 }
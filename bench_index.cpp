@@ -0,0 +1,377 @@
+/* -*- Mode: C; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+ * bench_index: drive the index directly, without the network stack.
+ *
+ * Each thread runs a copy of the ASCYLIB TEST_LOOP (main_test_loop.h), with
+ * the key distribution picked at run time, against the index for a fixed
+ * duration: a share of the operations are updates, split
+ * evenly between adds and removes, the rest are lookups.  Keys are drawn
+ * uniformly or from the zipf arrays of random.h.  Built with RETRY_STATS,
+ * so the NVM hash table also reports its parse/update/cleanup retries and
+ * the cache lines it writes back per operation.
+ */
+#include "memcached.h"
+#include "bench_index.h"
+
+#include <getopt.h>
+#include <limits.h>
+
+__thread unsigned long *seeds;
+ZIPF_RAND_DECLARATIONS();
+RETRY_STATS_VARS;
+RETRY_STATS_VARS_GLOBAL;
+
+/* intset.cpp refers to the item hash for recovery, which never runs here */
+hash_func hash;
+
+#define DEFAULT_DURATION    1000
+#define DEFAULT_INITIAL     1024
+#define DEFAULT_NB_THREADS  1
+#define DEFAULT_RANGE       (2 * DEFAULT_INITIAL)
+#define DEFAULT_UPDATE      20
+#define DEFAULT_POOL_PATH   "/dev/shm/bench_index_ht"
+
+typedef struct thread_data {
+    int id;
+    size_t getting_count;
+    size_t getting_count_succ;
+    size_t putting_count;
+    size_t putting_count_succ;
+    size_t removing_count;
+    size_t removing_count_succ;
+} __attribute__((aligned(64))) thread_data_t;
+
+static size_t initial = DEFAULT_INITIAL;
+static int num_threads = DEFAULT_NB_THREADS;
+static size_t range = DEFAULT_RANGE;
+static int update = DEFAULT_UPDATE;
+static size_t num_buckets = 0;
+static int zipf_workload = 0;
+static double zipf_alpha = ZIPF_ALPHA;
+
+static uintptr_t rand_max;
+static uintptr_t rand_min = 1;
+static uint32_t scale_put, scale_rem;
+static volatile int stop = 0;
+static barrier_t barrier, barrier_global;
+
+/* Values stored under each key: items whose key is the integer itself, so
+ * the index's full key compare sees the same bytes the driver passes */
+static item **bench_items;
+
+static void bench_items_init(void) {
+    bench_items = (item **)calloc(rand_max + rand_min + 1, sizeof(item *));
+    assert(bench_items != NULL);
+    for (uintptr_t key = rand_min; key <= rand_max + rand_min; key++) {
+        item *it = (item *)calloc(1, sizeof(item) + sizeof(key) + 1);
+        assert(it != NULL);
+        it->nkey = sizeof(key);
+        memcpy(ITEM_key(it), &key, sizeof(key));
+        bench_items[key] = it;
+    }
+}
+
+#if !defined(BENCH_CLHT_LB) && !defined(BENCH_CLHT_LF)
+
+static ht_intset_t *set = NULL;
+static linkcache_t *lc = NULL;
+static __thread EpochThread epoch = NULL;
+
+const char *bench_ds_name(void) {
+    return "NVM-HT";
+}
+
+void bench_ds_init(size_t num_buckets, int num_threads, const char *path, size_t pool_size) {
+    lc = cache_create();
+    EpochGlobalInit(lc);
+    /* The loader runs as the thread after the last worker */
+    epoch = EpochThreadInit(num_threads);
+    set = ht_new(epoch, num_buckets, path, pool_size);
+    if (set == NULL) {
+        fprintf(stderr, "Failed to init hashtable.\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void bench_ds_thread_init(int id) {
+    epoch = EpochThreadInit(id);
+}
+
+int bench_ds_contains(uintptr_t key) {
+    return ht_contains(set, key, (const char *)&key, sizeof(key), epoch, lc) != 0;
+}
+
+int bench_ds_add(uintptr_t key, uintptr_t val) {
+    return ht_add(set, key, val, 0, epoch, lc) != 0;
+}
+
+int bench_ds_remove(uintptr_t key) {
+    return ht_remove(set, key, (const char *)&key, sizeof(key), epoch, lc) != 0;
+}
+
+size_t bench_ds_size(void) {
+    return ht_size(set);
+}
+
+void bench_ds_print_stats(void) {
+    printf("#buckets:      %zu\n", set->hash + 1);
+}
+
+#endif /* NVM hash table */
+
+static void *test(void *thread) {
+    thread_data_t *td = (thread_data_t *)thread;
+    int id = td->id;
+    uintptr_t key;
+    uint32_t c;
+
+    seeds = seed_rand();
+    bench_ds_thread_init(id);
+    if (zipf_workload) {
+        __zipf_arr = zipf_get_rand_array(zipf_alpha, 0, rand_max + 1, id);
+    }
+    RETRY_STATS_ZERO();
+
+    barrier_cross(&barrier);
+    barrier_cross(&barrier_global);
+
+    while (stop == 0) {
+        c = (uint32_t)my_random(&seeds[0], &seeds[1], &seeds[2]);
+        if (zipf_workload) {
+            key = rand_max - zipf_get_next(__zipf_arr) + rand_min;
+        } else {
+            key = (c & rand_max) + rand_min;
+        }
+
+        if (unlikely(c <= scale_put)) {
+            if (bench_ds_add(key, (uintptr_t)bench_items[key])) {
+                td->putting_count_succ++;
+            }
+            td->putting_count++;
+        } else if (unlikely(c <= scale_rem)) {
+            if (bench_ds_remove(key)) {
+                td->removing_count_succ++;
+            }
+            td->removing_count++;
+        } else {
+            if (bench_ds_contains(key)) {
+                td->getting_count_succ++;
+            }
+            td->getting_count++;
+        }
+    }
+
+    barrier_cross(&barrier);
+    EXEC_IN_DEC_ID_ORDER(id, num_threads) {
+        RETRY_STATS_SHARE();
+    }
+    EXEC_IN_DEC_ID_ORDER_END(&barrier);
+
+    if (zipf_workload) {
+        free(__zipf_arr);
+    }
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    printf("%s -- index microbenchmark (%s)\n", prog, bench_ds_name());
+    printf("Usage: %s [options...]\n", prog);
+    printf("Options:\n"
+           "  -h, --help\n"
+           "        Print this message\n"
+           "  -d, --duration <int>\n"
+           "        Test duration in milliseconds (default=%d)\n"
+           "  -i, --initial-size <int>\n"
+           "        Number of keys inserted before the run (default=%d)\n"
+           "  -n, --num-threads <int>\n"
+           "        Number of worker threads (default=%d)\n"
+           "  -r, --range <int>\n"
+           "        Range of keys, rounded up to a power of two (default=%d)\n"
+           "  -u, --update-rate <int>\n"
+           "        Percentage of updates, half adds and half removes (default=%d)\n"
+           "  -b, --num-buckets <int>\n"
+           "        Number of buckets, rounded up to a power of two (default=initial size)\n"
+           "  -z, --zipf\n"
+           "        Draw keys from a zipf distribution instead of uniformly\n"
+           "  -a, --zipf-alpha <double>\n"
+           "        Skew of the zipf distribution (default=%.2f)\n"
+           "  -p, --pool <path>\n"
+           "        Pool file of the NVM hash table (default=%s)\n",
+           DEFAULT_DURATION, DEFAULT_INITIAL, DEFAULT_NB_THREADS,
+           DEFAULT_RANGE, DEFAULT_UPDATE, ZIPF_ALPHA, DEFAULT_POOL_PATH);
+}
+
+int main(int argc, char **argv) {
+    struct option long_options[] = {
+        {"help",         no_argument,       NULL, 'h'},
+        {"duration",     required_argument, NULL, 'd'},
+        {"initial-size", required_argument, NULL, 'i'},
+        {"num-threads",  required_argument, NULL, 'n'},
+        {"range",        required_argument, NULL, 'r'},
+        {"update-rate",  required_argument, NULL, 'u'},
+        {"num-buckets",  required_argument, NULL, 'b'},
+        {"zipf",         no_argument,       NULL, 'z'},
+        {"zipf-alpha",   required_argument, NULL, 'a'},
+        {"pool",         required_argument, NULL, 'p'},
+        {NULL, 0, NULL, 0}
+    };
+    int duration = DEFAULT_DURATION;
+    const char *pool_path = DEFAULT_POOL_PATH;
+    int c;
+
+    while ((c = getopt_long(argc, argv, "hd:i:n:r:u:b:za:p:", long_options, NULL)) != -1) {
+        switch (c) {
+        case 'h':
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        case 'd':
+            duration = atoi(optarg);
+            break;
+        case 'i':
+            initial = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            num_threads = atoi(optarg);
+            break;
+        case 'r':
+            range = strtoul(optarg, NULL, 10);
+            break;
+        case 'u':
+            update = atoi(optarg);
+            break;
+        case 'b':
+            num_buckets = strtoul(optarg, NULL, 10);
+            break;
+        case 'z':
+            zipf_workload = 1;
+            break;
+        case 'a':
+            zipf_alpha = atof(optarg);
+            break;
+        case 'p':
+            pool_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (duration <= 0 || num_threads <= 0 || range == 0 ||
+        update < 0 || update > 100 || range > (1UL << 31)) {
+        fprintf(stderr, "Invalid arguments, see %s -h\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    /* The loop masks the random number with rand_max */
+    size_t range_pow2 = 1;
+    while (range_pow2 < range) {
+        range_pow2 <<= 1;
+    }
+    range = range_pow2;
+    rand_max = range - 1;
+    if (initial > range) {
+        initial = range;
+    }
+    if (num_buckets == 0) {
+        num_buckets = initial;
+    }
+    /* The NVM hash table masks keys with the bucket count */
+    size_t buckets_pow2 = 1;
+    while (buckets_pow2 < num_buckets) {
+        buckets_pow2 <<= 1;
+    }
+    num_buckets = buckets_pow2;
+
+    scale_put = (uint32_t)(update / 200.0 * UINT_MAX);
+    scale_rem = (uint32_t)(update / 100.0 * UINT_MAX);
+
+    printf("## index: %s / workload: %s / threads: %d / range: %zu / initial: %zu / update: %d%%\n",
+           bench_ds_name(), zipf_workload ? "zipf" : "uniform", num_threads,
+           range, initial, update);
+
+    bench_items_init();
+    bench_ds_init(num_buckets, num_threads, pool_path, HT_POOL_SIZE);
+
+    seeds = seed_rand();
+    size_t filled = 0;
+    while (filled < initial) {
+        uintptr_t key = (my_random(&seeds[0], &seeds[1], &seeds[2]) & rand_max) + rand_min;
+        if (bench_ds_add(key, (uintptr_t)bench_items[key])) {
+            filled++;
+        }
+    }
+    size_t size = bench_ds_size();
+    if (size != initial) {
+        fprintf(stderr, "Filled %zu keys, but the index holds %zu\n", initial, size);
+    }
+
+    pthread_t *threads = (pthread_t *)malloc(num_threads * sizeof(pthread_t));
+    thread_data_t *tds;
+    if (threads == NULL ||
+        posix_memalign((void **)&tds, 64, num_threads * sizeof(thread_data_t)) != 0) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    memset(tds, 0, num_threads * sizeof(thread_data_t));
+
+    barrier_init(&barrier, num_threads);
+    barrier_init(&barrier_global, num_threads + 1);
+
+    for (int t = 0; t < num_threads; t++) {
+        tds[t].id = t;
+        int ret = pthread_create(&threads[t], NULL, test, &tds[t]);
+        if (ret != 0) {
+            fprintf(stderr, "Can't create thread: %s\n", strerror(ret));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    struct timeval start, end;
+    struct timespec timeout;
+    timeout.tv_sec = duration / 1000;
+    timeout.tv_nsec = (duration % 1000) * 1000000;
+
+    barrier_cross(&barrier_global);
+    gettimeofday(&start, NULL);
+    nanosleep(&timeout, NULL);
+    stop = 1;
+    gettimeofday(&end, NULL);
+
+    for (int t = 0; t < num_threads; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    size_t getting = 0, getting_succ = 0;
+    size_t putting = 0, putting_succ = 0;
+    size_t removing = 0, removing_succ = 0;
+    for (int t = 0; t < num_threads; t++) {
+        getting += tds[t].getting_count;
+        getting_succ += tds[t].getting_count_succ;
+        putting += tds[t].putting_count;
+        putting_succ += tds[t].putting_count_succ;
+        removing += tds[t].removing_count;
+        removing_succ += tds[t].removing_count_succ;
+    }
+    size_t total = getting + putting + removing;
+
+    printf("#duration:     %.3f s\n", secs);
+    printf("#ops:          %-10zu get %zu / put %zu / rem %zu\n",
+           total, getting, putting, removing);
+    printf("#success:      get %.1f%% / put %.1f%% / rem %.1f%%\n",
+           getting ? 100.0 * getting_succ / getting : 0.0,
+           putting ? 100.0 * putting_succ / putting : 0.0,
+           removing ? 100.0 * removing_succ / removing : 0.0);
+    printf("#throughput:   %.3f Mops/s\n", total / secs / 1e6);
+
+    size = bench_ds_size();
+    size_t expected = initial + putting_succ - removing_succ;
+    printf("#size:         %zu / expected %zu\n", size, expected);
+    bench_ds_print_stats();
+    RETRY_STATS_PRINT(total, putting, removing, putting_succ + removing_succ);
+
+    free(threads);
+    free(tds);
+    return size == expected ? EXIT_SUCCESS : EXIT_FAILURE;
+}
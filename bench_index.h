@@ -0,0 +1,23 @@
+/* index microbenchmark: the index under test
+ *
+ * bench_index.cpp drives these against the NVM hash table; with
+ * BENCH_CLHT_LB or BENCH_CLHT_LF defined they come from bench_index_clht.cpp
+ * instead, which keeps the CLHT headers out of the driver.  Keys are in
+ * [1, range], values are item pointers whose key is the same integer.
+ */
+#ifndef BENCH_INDEX_H
+#define BENCH_INDEX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+const char *bench_ds_name(void);
+void bench_ds_init(size_t num_buckets, int num_threads, const char *path, size_t pool_size);
+void bench_ds_thread_init(int id);
+int bench_ds_contains(uintptr_t key);
+int bench_ds_add(uintptr_t key, uintptr_t val);
+int bench_ds_remove(uintptr_t key);
+size_t bench_ds_size(void);
+void bench_ds_print_stats(void);
+
+#endif
@@ -0,0 +1,63 @@
+/* CLHT variants for the index microbenchmark, see bench_index.h */
+#if defined(BENCH_CLHT_LB)
+#  include "clht_lb_res.h"
+#elif defined(BENCH_CLHT_LF)
+#  include "clht_lf_res.h"
+#else
+#  error "Define BENCH_CLHT_LB or BENCH_CLHT_LF"
+#endif
+#include "bench_index.h"
+
+static clht_t *hashtable = NULL;
+
+const char *bench_ds_name(void) {
+    return clht_type_desc();
+}
+
+void bench_ds_init(size_t num_buckets, int num_threads, const char *path, size_t pool_size) {
+    (void)path;
+    (void)pool_size;
+
+    hashtable = clht_create(num_buckets);
+    if (hashtable == NULL) {
+        fprintf(stderr, "Failed to init hashtable.\n");
+        exit(EXIT_FAILURE);
+    }
+    /* The loader runs as the thread after the last worker */
+    clht_gc_thread_init(hashtable, num_threads);
+}
+
+void bench_ds_thread_init(int id) {
+    clht_gc_thread_init(hashtable, id);
+}
+
+/* clht_lb_res compares the full key against the stored item; the key bytes
+ * are the integer itself, which is what the driver puts in each item */
+int bench_ds_contains(uintptr_t key) {
+#if defined(BENCH_CLHT_LB)
+    return clht_get(hashtable->ht, key, (const char *)&key, sizeof(key)) != 0;
+#else
+    return clht_get(hashtable->ht, key) != 0;
+#endif
+}
+
+int bench_ds_add(uintptr_t key, uintptr_t val) {
+    return clht_put(hashtable, key, val);
+}
+
+int bench_ds_remove(uintptr_t key) {
+#if defined(BENCH_CLHT_LB)
+    return clht_remove(hashtable, key, (const char *)&key, sizeof(key)) != 0;
+#else
+    return clht_remove(hashtable, key) != 0;
+#endif
+}
+
+size_t bench_ds_size(void) {
+    return clht_size(hashtable->ht);
+}
+
+void bench_ds_print_stats(void) {
+    printf("#buckets:      %zu (%.1f MB)\n", (size_t)hashtable->ht->num_buckets,
+           clht_size_mem(hashtable->ht) / (1024.0 * 1024));
+}
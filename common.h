@@ -9,6 +9,14 @@
 #include "barrier.h"
 #include "main_test_loop.h"
 
+#if RETRY_STATS == 1
+/* Count the cache lines the index writes back, for flushes per op */
+#  define write_data_wait(addr, lines)		\
+  (FLUSH_TRY(lines), (write_data_wait)((addr), (lines)))
+#  define write_data_nowait(addr, lines)	\
+  (FLUSH_TRY(lines), (write_data_nowait)((addr), (lines)))
+#endif
+
 #define XSTR(s)                         STR(s)
 #define STR(s)                          #s
 
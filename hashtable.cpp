@@ -98,20 +98,17 @@ int floor_log_2(unsigned int n) {
 
 
 ht_intset_t* 
-ht_new(EpochThread epoch, size_t maxhtlength) 
+ht_new(EpochThread epoch, size_t maxhtlength, const char *path, size_t pool_size) 
 {
   PMEMobjpool *pop = NULL;
 
-  char path[32];  
-  sprintf(path, "/tmp/ht_pool"); 
-
   //remove file if it exists
   //TODO might want to remove this instruction in the future
   remove(path);
 
   if (access(path, F_OK) != 0) {
         if ((pop = pmemobj_create(path, POBJ_LAYOUT_NAME(ht),
-            HT_POOL_SIZE, S_IWUSR | S_IRUSR)) == NULL) {
+            pool_size, S_IWUSR | S_IRUSR)) == NULL) {
             printf("failed to create pool1 wiht name %s\n", path);
             return NULL;
         }
@@ -35,6 +35,7 @@
 
 #define MAXHTLENGTH                     65536
 
+/* Default size of the hash table pool, see settings.ht_pool_size */
 #define HT_POOL_SIZE    (1024 * 1024 * 1024)
 
 /* Hashtable length (# of buckets) */
@@ -57,7 +58,7 @@ typedef struct ht_intset
 void ht_delete(ht_intset_t *set);
 int ht_size(ht_intset_t *set);
 int floor_log_2(unsigned int n);
-ht_intset_t *ht_new(EpochThread epoch, size_t maxhtlength);
+ht_intset_t *ht_new(EpochThread epoch, size_t maxhtlength, const char *path, size_t pool_size);
 
 POBJ_LAYOUT_BEGIN(ht);
 POBJ_LAYOUT_ROOT(ht, ht_intset_t);
@@ -41,7 +41,15 @@ svalue_t
 ht_remove(ht_intset_t* set, skey_t key, const char* full_key, const size_t nkey, EpochThread epoch, linkcache_t* buffer)
 {
   int addr = key & set->hash;
-  return linkedlist_remove(&set->buckets[addr], key, full_key, nkey, epoch, buffer);
+  return linkedlist_remove(&set->buckets[addr], key, full_key, nkey, 0, epoch, buffer);
+}
+
+/* Like ht_remove(), but only while the key maps to val */
+svalue_t
+ht_remove_value(ht_intset_t* set, skey_t key, const char* full_key, const size_t nkey, svalue_t val, EpochThread epoch, linkcache_t* buffer)
+{
+  int addr = key & set->hash;
+  return linkedlist_remove(&set->buckets[addr], key, full_key, nkey, val, epoch, buffer);
 }
 
 
@@ -65,6 +73,27 @@ int is_reachable(ht_intset_t* ht, void* address) {
     return 0;
 }
 
+void ht_drop_volatile(ht_intset_t* ht, bool (*is_persistent)(const void*)) {
+    // Single-threaded: unlinks every node whose value fails is_persistent
+    size_t i;
+    for (i = 0; i <= ht->hash; i++) {
+        volatile node_t* prev = ht->buckets[i];
+        volatile node_t* node = (node_t*)unmark_ptr_cache((uintptr_t)prev->next);
+
+        while (node->next != NULL) {
+            volatile node_t* next = UNMARKED_PTR(node->next);
+            next = (volatile node_t*)unmark_ptr_cache((UINT_PTR)next);
+            if (!is_persistent((void*)node->value)) {
+                prev->next = next;
+                write_data_wait((void*)prev, CACHE_LINES_PER_NV_NODE);
+            } else {
+                prev = node;
+            }
+            node = next;
+        }
+    }
+}
+
 int item_is_reachable(ht_intset_t* ht, void* it) {
     item* my_item = (item*)it;
     // get the hashvalue (ht key) of the item
@@ -28,7 +28,9 @@
 svalue_t ht_contains(ht_intset_t* set, skey_t key, const char* full_key, const size_t nkey, EpochThread epoch, linkcache_t* buffer);
 svalue_t ht_add(ht_intset_t* set, skey_t key, svalue_t val, int replace, EpochThread epoch, linkcache_t* buffer);
 svalue_t ht_remove(ht_intset_t* set, skey_t key, const char* full_key, const size_t nkey, EpochThread epoch, linkcache_t* buffer);
+svalue_t ht_remove_value(ht_intset_t* set, skey_t key, const char* full_key, const size_t nkey, svalue_t val, EpochThread epoch, linkcache_t* buffer);
 
 int item_is_reachable(ht_intset_t* ht, void* it);
+void ht_drop_volatile(ht_intset_t* ht, bool (*is_persistent)(const void*));
 int is_reachable(ht_intset_t* ll, void* address);
 void ht_recover(ht_intset_t* ll, active_page_table_t** page_buffers, int num_page_buffers);
\ No newline at end of file
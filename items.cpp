@@ -43,6 +43,7 @@ typedef struct {
     uint64_t moves_to_warm;
     uint64_t moves_within_lru;
     uint64_t direct_reclaims;
+    uint64_t admission_rejects;
     rel_time_t evicted_time;
 } itemstats_t;
 
@@ -74,7 +75,47 @@ static pthread_mutex_t lru_crawler_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t  lru_crawler_cond = PTHREAD_COND_INITIALIZER;
 static pthread_mutex_t lru_crawler_stats_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t lru_maintainer_lock = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t cas_id_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * curr_items, curr_bytes and total_items, kept as deltas in shards picked
+ * by my_id so that stores and deletes don't serialize on STATS_LOCK. Each
+ * worker has a shard of its own; the background threads share theirs,
+ * hence the atomic adds. item_counts() sums the shards.
+ */
+#define ITEM_COUNT_SHARDS 64
+
+typedef struct {
+    int64_t curr_items;
+    int64_t curr_bytes;
+    uint64_t total_items;
+} __attribute__((aligned(64))) item_count_t;
+
+static item_count_t item_count_shards[ITEM_COUNT_SHARDS];
+static uint64_t total_items_base;   /* total_items at the last stats reset */
+
+static inline void item_count_add(const int64_t items, const int64_t bytes) {
+    item_count_t *ic = &item_count_shards[my_id % ITEM_COUNT_SHARDS];
+    __atomic_fetch_add(&ic->curr_items, items, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ic->curr_bytes, bytes, __ATOMIC_RELAXED);
+    if (items > 0)
+        __atomic_fetch_add(&ic->total_items, items, __ATOMIC_RELAXED);
+}
+
+void item_counts(uint64_t *curr_items, uint64_t *total_items, uint64_t *curr_bytes) {
+    int64_t items = 0, bytes = 0;
+    uint64_t total = 0;
+    int i;
+
+    for (i = 0; i < ITEM_COUNT_SHARDS; i++) {
+        items += __atomic_load_n(&item_count_shards[i].curr_items, __ATOMIC_RELAXED);
+        bytes += __atomic_load_n(&item_count_shards[i].curr_bytes, __ATOMIC_RELAXED);
+        total += __atomic_load_n(&item_count_shards[i].total_items, __ATOMIC_RELAXED);
+    }
+    /* a sum taken while items move between shards can dip below zero */
+    *curr_items = items > 0 ? items : 0;
+    *curr_bytes = bytes > 0 ? bytes : 0;
+    *total_items = total - __atomic_load_n(&total_items_base, __ATOMIC_RELAXED);
+}
 
 #ifdef NVM
 
@@ -85,6 +126,8 @@ static pthread_mutex_t cas_id_lock = PTHREAD_MUTEX_INITIALIZER;
 // TODO: handle timestamp wraparound
 typedef struct {
     uint64_t* ts_snapshot;
+    uint64_t* zc_target;    /* zero-copy sends that must complete before release */
+    bool zc_armed;          /* zc_target taken once the timestamps allowed it */
     item* head;
     unsigned int item_count;
 } free_list_t;
@@ -102,6 +145,18 @@ static free_list_t* last_free_list = NULL;
 static unsigned int free_list_size_limit = 0;
 static int ts_size = 0;
 static pthread_mutex_t free_list_lock = PTHREAD_MUTEX_INITIALIZER;
+/* MSG_ZEROCOPY sends issued and completed by each thread; only the owning
+ * thread writes its slot */
+static uint64_t* volatile zc_issued;
+static uint64_t* volatile zc_completed;
+
+static void hot_cache_init(void);
+static void hot_cache_free(item *copy);
+static void admission_init(void);
+static void tier_promote_hint(item *it);
+static void tier_stats(ADD_STAT add_stats, void *c);
+static int log_evict_oldest(const uint32_t cur_hv);
+static void log_cleaner_stats(ADD_STAT add_stats, void *c);
 
 void item_gc_init(unsigned int size_limit, int num_threads) {
     free_list_size_limit = size_limit;
@@ -120,17 +175,26 @@ void item_gc_init(unsigned int size_limit, int num_threads) {
         last_free_list->ts_snapshot = (uint64_t*) malloc(num_threads*sizeof(uint64_t));
         if (last_free_list->ts_snapshot)
             memset(last_free_list->ts_snapshot, 0, num_threads*sizeof(uint64_t));
+        last_free_list->zc_target = (uint64_t*) calloc(num_threads, sizeof(uint64_t));
     }
+    if (current_free_list)
+        current_free_list->zc_target = (uint64_t*) calloc(num_threads, sizeof(uint64_t));
+    zc_issued = (uint64_t*) calloc(num_threads, sizeof(uint64_t));
+    zc_completed = (uint64_t*) calloc(num_threads, sizeof(uint64_t));
     timestamps = (uint64_t*) malloc(num_threads*sizeof(uint64_t));
     lastCollectEpochs = (uint64_t*) malloc(num_threads*sizeof(uint64_t));
     slab_tables = (active_slab_table_t**)malloc(sizeof(active_slab_table_t*) * (num_threads));
 
     if (!current_free_list || !current_free_list->ts_snapshot ||
-        !last_free_list    || !last_free_list->ts_snapshot    || !timestamps)
+        !last_free_list    || !last_free_list->ts_snapshot    || !timestamps ||
+        !current_free_list->zc_target || !last_free_list->zc_target ||
+        !zc_issued || !zc_completed)
     {
         fprintf(stderr, "Failed to init item free lists.\n");
         exit(EXIT_FAILURE);
     }
+    hot_cache_init();
+    admission_init();
 }
 
 void item_gc_thread_init(int thread_id) {
@@ -159,8 +223,21 @@ static int do_free_list_safe_to_swap() {
     uint64_t* last_ts = last_free_list->ts_snapshot;
     uint64_t* curr_ts = current_free_list->ts_snapshot;
     int i;
+    if (!last_free_list->zc_armed) {
+        for (i = 0; i < ts_size; i++) {
+            if ((last_ts[i] & 1) && (last_ts[i] >= curr_ts[i]))
+                return 0;
+        }
+        /* Every thread that could still see the items has let go of them,
+         * but the NIC may be reading some through MSG_ZEROCOPY. Any such
+         * send was issued before the release, so it is counted now; keep
+         * this target until it completes instead of chasing new sends. */
+        for (i = 0; i < ts_size; i++)
+            last_free_list->zc_target[i] = zc_issued[i];
+        last_free_list->zc_armed = true;
+    }
     for (i = 0; i < ts_size; i++) {
-        if ((last_ts[i] & 1) && (last_ts[i] >= curr_ts[i]))
+        if (zc_completed[i] < last_free_list->zc_target[i])
             return 0;
     }
     return 1;
@@ -179,13 +256,20 @@ static void do_free_list_try_to_swap() {
             size_t ntotal = ITEM_ntotal(cur_it);
             unsigned int clsid = ITEM_clsid(cur_it);
             item* next_it = cur_it->next;
-            slabs_free(cur_it, ntotal, clsid);
+            if (cur_it->it_flags & ITEM_HOT) {
+                hot_cache_free(cur_it);
+            } else if (cur_it->it_flags & ITEM_DRAM) {
+                slabs_dram_free(cur_it, ntotal, clsid);
+            } else {
+                slabs_free(cur_it, ntotal, clsid);
+            }
             
             cur_it = next_it;
         }
 
         last_free_list->head = NULL;
         last_free_list->item_count = 0;
+        last_free_list->zc_armed = false;
 
         // swap list pointers
         free_list_t* tmp = current_free_list;
@@ -204,7 +288,9 @@ static void free_list_insert(item* it) {
     current_free_list->head = it;
 
     if (++current_free_list->item_count >= free_list_size_limit) {
+        uint64_t t0 = latency_now();
         do_free_list_try_to_swap();
+        stats_latency_record(LAT_GC, t0);
     }
 
     pthread_mutex_unlock(&free_list_lock);
@@ -212,15 +298,305 @@ static void free_list_insert(item* it) {
 
 static void free_list_try_to_release() {
     pthread_mutex_lock(&free_list_lock);
+    uint64_t t0 = latency_now();
     do_free_list_try_to_swap();
+    stats_latency_record(LAT_GC, t0);
     pthread_mutex_unlock(&free_list_lock);
 }
 
+void item_zerocopy_issued(void) {
+    zc_issued[my_id]++;
+}
+
+void item_zerocopy_completed(const uint64_t count) {
+    zc_completed[my_id] += count;
+}
+
+/*
+ * DRAM hot cache. A get of an NVM item whose clock reference bit is already
+ * set copies the item into DRAM, and later gets of the key are served from
+ * the copy. The cache is direct mapped on the key hash: a copy is dropped
+ * when the item it was made from leaves the index, or when another hot key
+ * lands in its bucket. Dropped copies go through the item free lists, so a
+ * reader holding one is safe until it releases it, like with any other item.
+ *
+ * Copies are carved from a single arena of hot_cache_size bytes, in power of
+ * two chunk classes that keep their own free lists. Once the arena is used
+ * up, a key is only admitted if a chunk of its class was given back.
+ */
+#define HOT_CACHE_AVG_ITEM  256             /* bytes per bucket when sizing */
+#define HOT_CACHE_MIN_CHUNK 64
+#define HOT_CACHE_MAX_ITEM  (16 * 1024)     /* larger items are never copied */
+#define HOT_CACHE_CLASSES   9               /* HOT_CACHE_MIN_CHUNK << 8 == HOT_CACHE_MAX_ITEM */
+#define HOT_CACHE_LOCKS     1024
+
+typedef struct {
+    item *copy;         /* DRAM copy, NULL if the bucket is empty */
+    uint32_t hv;
+} hot_bucket_t;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t admits;
+    uint64_t drops;
+} __attribute__((aligned(64))) hot_stats_t;
+
+static hot_bucket_t *hot_buckets = NULL;
+static uint32_t hot_mask = 0;
+static pthread_mutex_t hot_locks[HOT_CACHE_LOCKS];
+static hot_stats_t hot_stats[HOT_CACHE_LOCKS];  /* under the matching lock */
+
+static char *hot_arena = NULL;
+static size_t hot_arena_top = 0;                /* bytes carved so far */
+static item *hot_chunks[HOT_CACHE_CLASSES];     /* freed chunks, linked by next */
+static size_t hot_bytes = 0;                    /* bytes in chunks handed out */
+static pthread_mutex_t hot_arena_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Lock and stats stripe of the bucket of hv */
+#define HOT_STRIPE(hv) (((hv) & hot_mask) % HOT_CACHE_LOCKS)
+#define HOT_LOCK(hv) (&hot_locks[HOT_STRIPE(hv)])
+
+/* The NVM item a copy was made from is kept right behind the copy */
+static item *hot_cache_origin(item *copy) {
+    item *origin;
+    memcpy(&origin, (char *)copy + ITEM_ntotal(copy), sizeof(origin));
+    return origin;
+}
+
+/* Chunk class for a copy of size bytes, which is at most HOT_CACHE_MAX_ITEM */
+static int hot_cache_class(size_t size) {
+    int cls = 0;
+    while ((size_t)(HOT_CACHE_MIN_CHUNK << cls) < size)
+        cls++;
+    return cls;
+}
+
+static item *hot_cache_alloc(size_t size) {
+    int cls = hot_cache_class(size);
+    size_t chunk = (size_t)HOT_CACHE_MIN_CHUNK << cls;
+    item *copy = NULL;
+
+    pthread_mutex_lock(&hot_arena_lock);
+    if (hot_chunks[cls] != NULL) {
+        copy = hot_chunks[cls];
+        hot_chunks[cls] = copy->next;
+    } else if (hot_arena_top + chunk <= settings.hot_cache_size) {
+        copy = (item *)(hot_arena + hot_arena_top);
+        hot_arena_top += chunk;
+    }
+    if (copy != NULL)
+        hot_bytes += chunk;
+    pthread_mutex_unlock(&hot_arena_lock);
+    return copy;
+}
+
+/* Gives a chunk back to its class. The copy's header must still be intact. */
+static void hot_cache_free(item *copy) {
+    int cls = hot_cache_class(ITEM_ntotal(copy) + sizeof(item *));
+
+    pthread_mutex_lock(&hot_arena_lock);
+    copy->next = hot_chunks[cls];
+    hot_chunks[cls] = copy;
+    hot_bytes -= (size_t)HOT_CACHE_MIN_CHUNK << cls;
+    pthread_mutex_unlock(&hot_arena_lock);
+}
+
+static void hot_cache_init(void) {
+    uint32_t buckets = 1;
+    int i;
+
+    if (settings.hot_cache_size == 0)
+        return;
+    while ((size_t)buckets * 2 * HOT_CACHE_AVG_ITEM <= settings.hot_cache_size &&
+           buckets < (1u << 31)) {
+        buckets *= 2;
+    }
+    hot_buckets = (hot_bucket_t *)calloc(buckets, sizeof(hot_bucket_t));
+    hot_arena = (char *)malloc(settings.hot_cache_size);
+    if (hot_buckets == NULL || hot_arena == NULL) {
+        fprintf(stderr, "Failed to init the hot item cache.\n");
+        exit(EXIT_FAILURE);
+    }
+    hot_mask = buckets - 1;
+    for (i = 0; i < HOT_CACHE_LOCKS; i++) {
+        pthread_mutex_init(&hot_locks[i], NULL);
+    }
+}
+
+/* Empties a bucket. Called with its lock held. */
+static void do_hot_cache_drop(hot_bucket_t *b, hot_stats_t *st) {
+    item *copy = b->copy;
+
+    b->copy = NULL;
+    st->drops++;
+    copy->it_flags &= ~ITEM_LINKED;
+    free_list_insert(copy);
+}
+
+/* Drops the copy of origin, if its bucket still holds one. Called once the
+ * index no longer points at origin; a copy of whatever replaced it stays. */
+static void hot_cache_invalidate(const uint32_t hv, item *origin) {
+    if (hot_buckets == NULL)
+        return;
+
+    hot_bucket_t *b = &hot_buckets[hv & hot_mask];
+    pthread_mutex_lock(HOT_LOCK(hv));
+    if (b->copy != NULL && hot_cache_origin(b->copy) == origin) {
+        do_hot_cache_drop(b, &hot_stats[HOT_STRIPE(hv)]);
+    }
+    pthread_mutex_unlock(HOT_LOCK(hv));
+}
+
+static item *hot_cache_get(const char *key, const size_t nkey, const uint32_t hv) {
+    hot_bucket_t *b = &hot_buckets[hv & hot_mask];
+    item *it = NULL;
+
+    pthread_mutex_lock(HOT_LOCK(hv));
+    if (b->copy != NULL && b->hv == hv && b->copy->nkey == nkey &&
+        memcmp(ITEM_key(b->copy), key, nkey) == 0) {
+        it = b->copy;
+        hot_stats[HOT_STRIPE(hv)].hits++;
+    }
+    pthread_mutex_unlock(HOT_LOCK(hv));
+    return it;
+}
+
+/* Copies a referenced NVM item into its bucket. The index is checked again
+ * under the bucket lock: a set or delete that swapped the item out before
+ * that drops the copy right after, one that comes later finds it. */
+static void hot_cache_admit(item *it, const uint32_t hv) {
+    size_t ntotal = ITEM_ntotal(it);
+    hot_bucket_t *b = &hot_buckets[hv & hot_mask];
+    hot_stats_t *st = &hot_stats[HOT_STRIPE(hv)];
+    item *copy;
+
+    if (ntotal + sizeof(item *) > HOT_CACHE_MAX_ITEM ||
+        (it->it_flags & ITEM_DRAM) || !clock_is_referenced(it))
+        return;
+    /* unlocked peek, so a key that is already cached doesn't pay for the copy */
+    if (b->copy != NULL && hot_cache_origin(b->copy) == it)
+        return;
+
+    if ((copy = hot_cache_alloc(ntotal + sizeof(item *))) == NULL)
+        return;
+    memcpy(copy, it, ntotal);
+    memcpy((char *)copy + ntotal, &it, sizeof(item *));
+    copy->it_flags |= ITEM_HOT;
+
+    pthread_mutex_lock(HOT_LOCK(hv));
+    if ((b->copy != NULL && hot_cache_origin(b->copy) == it) ||
+        assoc_find(ITEM_key(it), it->nkey, hv) != it) {
+        pthread_mutex_unlock(HOT_LOCK(hv));
+        hot_cache_free(copy);
+        return;
+    }
+    if (b->copy != NULL) {
+        do_hot_cache_drop(b, st);
+    }
+    b->copy = copy;
+    b->hv = hv;
+    st->admits++;
+    pthread_mutex_unlock(HOT_LOCK(hv));
+}
+
+/*
+ * ADMISSION FILTER
+ *
+ * TinyLFU: a count-min sketch of small counters in DRAM estimates how often
+ * each key was asked for recently. Once a class is full, a new item only
+ * evicts the clock victim if it was used more often than the victim, so one
+ * hit wonders don't cost an NVM write each and push out warm items. Every
+ * ADMIT_SAMPLE_MULT * width increments all counters are halved, so old
+ * popularity fades.
+ */
+#define ADMIT_ROWS          4
+#define ADMIT_COUNTER_MAX   15
+#define ADMIT_SAMPLE_MULT   10
+#define ADMIT_MIN_BITS      12
+#define ADMIT_MAX_BITS      26
+
+static uint8_t *admit_rows[ADMIT_ROWS];
+static unsigned int admit_bits = 0;
+static uint64_t admit_additions = 0;    /* atomic */
+static volatile int admit_resetting = 0;
+static const uint32_t admit_seeds[ADMIT_ROWS] = {
+    0x8f1bbcdc, 0x6ed9eba1, 0xca62c1d6, 0x5a827999
+};
+static __thread bool alloc_rejected = false;
+
+#define ADMIT_INDEX(hv, r) \
+    ((((hv) ^ admit_seeds[r]) * 0x9E3779B1u) >> (32 - admit_bits))
+
+static void admission_init(void) {
+    size_t counters;
+    int r;
+
+    if (settings.admission != ADMIT_TINYLFU)
+        return;
+    /* about one counter per small item that fits in memory */
+    counters = settings.maxbytes / 256;
+    admit_bits = ADMIT_MIN_BITS;
+    while (admit_bits < ADMIT_MAX_BITS && ((size_t)1 << admit_bits) < counters)
+        admit_bits++;
+    for (r = 0; r < ADMIT_ROWS; r++) {
+        admit_rows[r] = (uint8_t *)calloc((size_t)1 << admit_bits, 1);
+        if (admit_rows[r] == NULL) {
+            fprintf(stderr, "Failed to init the admission filter.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+}
+
+/* Halves every counter. Only one thread ages at a time, the others keep
+ * counting meanwhile and may lose a few increments. */
+static void admission_age(void) {
+    size_t width = (size_t)1 << admit_bits;
+    size_t i;
+    int r;
+
+    if (!__sync_bool_compare_and_swap(&admit_resetting, 0, 1))
+        return;
+    for (r = 0; r < ADMIT_ROWS; r++) {
+        for (i = 0; i < width; i++) {
+            admit_rows[r][i] >>= 1;
+        }
+    }
+    admit_additions = 0;
+    admit_resetting = 0;
+}
+
+/* Counts an access to the key with hash hv. Counters are bumped without
+ * atomics; a lost increment only makes the estimate a little low. */
+static void admission_record(const uint32_t hv) {
+    int r;
+
+    for (r = 0; r < ADMIT_ROWS; r++) {
+        uint8_t *cnt = &admit_rows[r][ADMIT_INDEX(hv, r)];
+        if (*cnt < ADMIT_COUNTER_MAX)
+            (*cnt)++;
+    }
+    if (__sync_add_and_fetch(&admit_additions, 1) >=
+        (uint64_t)ADMIT_SAMPLE_MULT << admit_bits)
+        admission_age();
+}
+
+static unsigned int admission_estimate(const uint32_t hv) {
+    unsigned int est = ADMIT_COUNTER_MAX;
+    int r;
+
+    for (r = 0; r < ADMIT_ROWS; r++) {
+        unsigned int cnt = admit_rows[r][ADMIT_INDEX(hv, r)];
+        if (cnt < est)
+            est = cnt;
+    }
+    return est;
+}
+
 void recover() {
     volatile ticks corr = getticks_correction_calc();
     ticks startCycles = getticks();    
   
-    assoc_recover(slab_tables, ts_size);
+    assoc_recover(ts_size);
   
     ticks endCycles = getticks();
     ticks recovery_cycles = endCycles - startCycles + corr;
@@ -230,7 +606,11 @@ void recover() {
 #endif
 
 void item_stats_reset(void) {
+    uint64_t curr_items, total_items, curr_bytes;
     int i;
+
+    item_counts(&curr_items, &total_items, &curr_bytes);
+    __atomic_fetch_add(&total_items_base, total_items, __ATOMIC_RELAXED);
     for (i = 0; i < LARGEST_ID; i++) {
         pthread_mutex_lock(&lru_locks[i]);
         memset(&itemstats[i], 0, sizeof(itemstats_t));
@@ -242,14 +622,32 @@ static int lru_pull_tail(const int orig_id, const int cur_lru,
         const unsigned int total_chunks, const bool do_evict, const uint32_t cur_hv);
 static int lru_crawler_start(uint32_t id, uint32_t remaining);
 
+/*
+ * CAS ids come from per-thread blocks leased with slabs_cas_lease(), one
+ * persist per block. A flush_all bumps cas_id_gen so every thread starts a
+ * new block before its next id, keeping ids issued after the flush above
+ * settings.oldest_cas.
+ */
+#define CAS_ID_BLOCK 4096
+
+static volatile uint64_t cas_id_gen = 0;
+static __thread uint64_t cas_id_next, cas_id_end, cas_id_block_gen;
+
 /* Get the next CAS id for a new item. */
-/* TODO: refactor some atomics for this. */
 uint64_t get_cas_id(void) {
-    static uint64_t cas_id = 0;
-    pthread_mutex_lock(&cas_id_lock);
-    uint64_t next_id = ++cas_id;
-    pthread_mutex_unlock(&cas_id_lock);
-    return next_id;
+    uint64_t gen = __atomic_load_n(&cas_id_gen, __ATOMIC_ACQUIRE);
+    if (cas_id_next == cas_id_end || cas_id_block_gen != gen) {
+        cas_id_next = slabs_cas_lease(CAS_ID_BLOCK);
+        cas_id_end = cas_id_next + CAS_ID_BLOCK;
+        cas_id_block_gen = gen;
+    }
+    return cas_id_next++;
+}
+
+/* Returns a CAS id above every id handed out so far, for flush_all. */
+uint64_t get_cas_id_fence(void) {
+    __atomic_add_fetch(&cas_id_gen, 1, __ATOMIC_ACQ_REL);
+    return slabs_cas_lease(1);
 }
 
 static int is_flushed(item *it) {
@@ -286,22 +684,18 @@ static unsigned int noexp_lru_size(int slabs_clsid) {
 #endif
 
 /**
- * Generates the variable-sized part of the header for an object.
+ * Computes the total size of an object.
  *
- * key     - The key
  * nkey    - The length of the key
- * flags   - key flags
  * nbytes  - Number of bytes to hold value and addition CRLF terminator
- * suffix  - Buffer for the "VALUE" line suffix (flags, size).
- * nsuffix - The length of the suffix is stored here.
  *
- * Returns the total size of the header.
+ * Client flags live in the fixed header as a binary field, the "VALUE" line
+ * suffix is built when the item is sent.
+ *
+ * Returns the total size of the item.
  */
-static size_t item_make_header(const uint8_t nkey, const int flags, const int nbytes,
-                     char *suffix, uint8_t *nsuffix) {
-    /* suffix is defined at 40 chars elsewhere.. */
-    *nsuffix = (uint8_t) snprintf(suffix, 40, " %d %d\r\n", flags, nbytes - 2);
-    return sizeof(item) + nkey + *nsuffix + nbytes;
+static size_t item_make_header(const uint8_t nkey, const int nbytes) {
+    return sizeof(item) + nkey + nbytes;
 }
 
 #ifdef NVM
@@ -312,10 +706,33 @@ static int item_evict(const unsigned int id, const uint32_t cur_hv) {
         assert(victim_it);
 
         if ((victim_it->it_flags & ITEM_LINKED) != 0) {
-            uint32_t hv = hash(ITEM_key(victim_it), victim_it->nkey);
+            /* no need to rehash the key, linked items carry their hash */
+            uint32_t hv = victim_it->hv;
+            void *hold_lock;
             if (hv == cur_hv)
                 continue;
 
+            if (settings.admission == ADMIT_TINYLFU &&
+                admission_estimate(cur_hv) <= admission_estimate(hv)) {
+#ifdef HAVE_GCC_ATOMICS
+                __sync_fetch_and_add(&itemstats[id].admission_rejects, 1);
+#else
+                itemstats[id].admission_rejects++;
+#endif
+                alloc_rejected = true;
+                return 0;
+            }
+
+            /* The victim must not be replaced between the unlink's check
+             * and its removal, e.g. by tier_migrate(). The caller may hold
+             * cur_hv's lock, so only try. */
+            if ((hold_lock = item_trylock(hv)) == NULL)
+                continue;
+            if ((victim_it->it_flags & ITEM_LINKED) == 0) {
+                item_trylock_unlock(hold_lock);
+                continue;
+            }
+
             // Evicted count is approximate since multiple threads can pick
             // the same item to evict and get here (it is unlikely)
 #ifdef HAVE_GCC_ATOMICS
@@ -325,6 +742,7 @@ static int item_evict(const unsigned int id, const uint32_t cur_hv) {
 #endif
 
             do_item_unlink(victim_it, hv);
+            item_trylock_unlock(hold_lock);
             break;
         } else {
             if (++tries > 4) {
@@ -340,11 +758,9 @@ static int item_evict(const unsigned int id, const uint32_t cur_hv) {
 item *do_item_alloc(char *key, const size_t nkey, const int flags,
                     const rel_time_t exptime, const int nbytes,
                     const uint32_t cur_hv) {
-    uint8_t nsuffix;
     item *it = NULL;
-    char suffix[40];
     unsigned int total_chunks;
-    size_t ntotal = item_make_header(nkey + 1, flags, nbytes, suffix, &nsuffix);
+    size_t ntotal = item_make_header(nkey + 1, nbytes);
     if (settings.use_cas) {
         ntotal += sizeof(uint64_t);
     }
@@ -370,6 +786,7 @@ item *do_item_alloc(char *key, const size_t nkey, const int flags,
         if (settings.expirezero_does_not_evict)
             total_chunks -= noexp_lru_size(id);
         if (it == NULL) {
+            uint64_t t0 = latency_now();
             if (settings.lru_maintainer_thread) {
                 lru_pull_tail(id, HOT_LRU, total_chunks, false, cur_hv);
                 lru_pull_tail(id, WARM_LRU, total_chunks, false, cur_hv);
@@ -377,6 +794,7 @@ item *do_item_alloc(char *key, const size_t nkey, const int flags,
             } else {
                 lru_pull_tail(id, COLD_LRU, 0, true, cur_hv);
             }
+            stats_latency_record(LAT_EVICT, t0);
         } else {
             break;
         }
@@ -388,18 +806,47 @@ item *do_item_alloc(char *key, const size_t nkey, const int flags,
         pthread_mutex_unlock(&lru_locks[id]);
     }
 #else
-    it = (item*)slabs_alloc(ntotal, id, &total_chunks);
+    uint32_t hv = cur_hv;
+    alloc_rejected = false;
+    if (settings.admission == ADMIT_TINYLFU)
+        admission_record(hv);
+
+    // New items go to the DRAM tier while it has room
+    bool dram = false;
+    if (settings.engine == ENGINE_LOG) {
+        // The log has no per-class victims: if the cleaner fell behind,
+        // empty the oldest segment ourselves
+        int tries;
+        it = (item*)slabs_log_alloc(ntotal, id);
+        for (tries = 0; it == NULL && tries < 5; tries++) {
+            log_evict_oldest(hv);
+            free_list_try_to_release();
+            it = (item*)slabs_log_alloc(ntotal, id);
+        }
+    } else if (settings.dram_tier_size != 0 &&
+        (it = (item*)slabs_dram_alloc(ntotal, id)) != NULL) {
+        dram = true;
+    } else {
+        it = (item*)slabs_alloc(ntotal, id, &total_chunks);
+    }
 
     // Evict from cache until we manage to allocate
-    while (it == NULL) {
+    while (it == NULL && settings.engine != ENGINE_LOG) {
         // If eviction fails, out of memory error will be returned
-        if (!item_evict(id, cur_hv))
+        uint64_t t0 = latency_now();
+        int evicted = item_evict(id, hv);
+        stats_latency_record(LAT_EVICT, t0);
+        if (!evicted)
             break;
         it = (item*)slabs_alloc(ntotal, id, &total_chunks);
     }
 #endif
 
     if (it == NULL) {
+#ifdef NVM
+        if (alloc_rejected)
+            return NULL;
+#endif
         pthread_mutex_lock(&lru_locks[id]);
         itemstats[id].outofmemory++;
         pthread_mutex_unlock(&lru_locks[id]);
@@ -432,12 +879,16 @@ item *do_item_alloc(char *key, const size_t nkey, const int flags,
 
     DEBUG_REFCNT(it, '*');
     it->it_flags = settings.use_cas ? ITEM_CAS : 0;
+#ifdef NVM
+    if (dram)
+        it->it_flags |= ITEM_DRAM;
+    it->hv = cur_hv;
+#endif
     it->nkey = nkey;
     it->nbytes = nbytes;
     memcpy(ITEM_key(it), key, nkey);
     it->exptime = exptime;
-    memcpy(ITEM_suffix(it), suffix, (size_t)nsuffix);
-    it->nsuffix = nsuffix;
+    it->client_flags = (uint32_t) flags;
     return it;
 }
 
@@ -457,7 +908,8 @@ void item_free(item *it) {
     DEBUG_REFCNT(it, 'F');
     slabs_free(it, ntotal, clsid);
 #else
-    mark_slab(getMySlabTable(), it, it->slab, it->slabs_clsid, getMyTimestamp(), getMyLastCollect(), 1);
+    if ((it->it_flags & ITEM_DRAM) == 0)
+        mark_slab(getMySlabTable(), it, it->slab, it->slabs_clsid, getMyTimestamp(), getMyLastCollect(), 1);
     free_list_insert(it);
 #endif
 }
@@ -467,11 +919,7 @@ void item_free(item *it) {
  * the maximum for a cache entry.)
  */
 bool item_size_ok(const size_t nkey, const int flags, const int nbytes) {
-    char prefix[40];
-    uint8_t nsuffix;
-
-    size_t ntotal = item_make_header(nkey + 1, flags, nbytes,
-                                     prefix, &nsuffix);
+    size_t ntotal = item_make_header(nkey + 1, nbytes);
     if (settings.use_cas) {
         ntotal += sizeof(uint64_t);
     }
@@ -544,11 +992,7 @@ int do_item_link(item *it, const uint32_t hv) {
     it->it_flags |= ITEM_LINKED;
     it->time = current_time;
 
-    STATS_LOCK();
-    stats.curr_bytes += ITEM_ntotal(it);
-    stats.curr_items += 1;
-    stats.total_items += 1;
-    STATS_UNLOCK();
+    item_count_add(1, ITEM_ntotal(it));
 
     /* Allocate a new CAS ID on link. */
     ITEM_set_cas(it, (settings.use_cas) ? get_cas_id() : 0);
@@ -565,15 +1009,12 @@ int do_item_link(item *it, const uint32_t hv) {
 void do_item_set(item *it, const uint32_t hv) {
     assert((it->it_flags & (ITEM_LINKED|ITEM_SLABBED)) == 0);
 
+    it->hv = hv;
     it->it_flags |= ITEM_LINKED;
     it->time = current_time;
     ITEM_set_cas(it, (settings.use_cas) ? get_cas_id() : 0);
 
-    STATS_LOCK();
-    stats.curr_bytes += ITEM_ntotal(it);
-    stats.curr_items += 1;
-    stats.total_items += 1;
-    STATS_UNLOCK();
+    item_count_add(1, ITEM_ntotal(it));
 
     do_item_update(it);
 
@@ -585,12 +1026,10 @@ void do_item_set(item *it, const uint32_t hv) {
     item* old_it = assoc_replace(it, hv);
 
     if (old_it) {
+        hot_cache_invalidate(hv, old_it);
         old_it->it_flags &= ~ITEM_LINKED;
 
-        STATS_LOCK();
-        stats.curr_bytes -= ITEM_ntotal(old_it);
-        stats.curr_items -= 1;
-        STATS_UNLOCK();
+        item_count_add(-1, -(int64_t)ITEM_ntotal(old_it));
 
         item_free(old_it);
     }
@@ -599,6 +1038,7 @@ void do_item_set(item *it, const uint32_t hv) {
 int do_item_add(item *it, const uint32_t hv) {
     assert((it->it_flags & (ITEM_LINKED|ITEM_SLABBED)) == 0);
 
+    it->hv = hv;
     it->it_flags |= ITEM_LINKED;
     it->time = current_time;
     ITEM_set_cas(it, (settings.use_cas) ? get_cas_id() : 0);
@@ -616,11 +1056,7 @@ int do_item_add(item *it, const uint32_t hv) {
         // but for now I don't care
         do_item_update(it);
 
-        STATS_LOCK();
-        stats.curr_bytes += ITEM_ntotal(it);
-        stats.curr_items += 1;
-        stats.total_items += 1;
-        STATS_UNLOCK();
+        item_count_add(1, ITEM_ntotal(it));
     } else {
         it->it_flags &= ~ITEM_LINKED;
 
@@ -638,10 +1074,7 @@ void do_item_unlink(item *it, const uint32_t hv) {
 #ifndef NVM
     if ((it->it_flags & ITEM_LINKED) != 0) {
         it->it_flags &= ~ITEM_LINKED;
-        STATS_LOCK();
-        stats.curr_bytes -= ITEM_ntotal(it);
-        stats.curr_items -= 1;
-        STATS_UNLOCK();
+        item_count_add(-1, -(int64_t)ITEM_ntotal(it));
         assoc_delete(ITEM_key(it), it->nkey, hv);
         item_unlink_q(it);
         do_item_remove(it);
@@ -653,15 +1086,19 @@ void do_item_unlink(item *it, const uint32_t hv) {
     // fields changed here (e.g. flags).
     assert((it->it_flags & ITEM_LINKED) != 0);
 
-    int success = assoc_delete(ITEM_key(it), it->nkey, hv);
+    // A DRAM copy from the hot cache stands for the NVM item it was made from
+    if (it->it_flags & ITEM_HOT)
+        it = hot_cache_origin(it);
+
+    // Only if the index still points at it: the key may have been
+    // replaced since the caller looked it up
+    int success = assoc_delete_item(it, hv);
 
     if (success) {
+        hot_cache_invalidate(hv, it);
         it->it_flags &= ~ITEM_LINKED;
 
-        STATS_LOCK();
-        stats.curr_bytes -= ITEM_ntotal(it);
-        stats.curr_items -= 1;
-        STATS_UNLOCK();
+        item_count_add(-1, -(int64_t)ITEM_ntotal(it));
 
         item_free(it);
     }
@@ -674,10 +1111,7 @@ void do_item_unlink_nolock(item *it, const uint32_t hv) {
     MEMCACHED_ITEM_UNLINK(ITEM_key(it), it->nkey, it->nbytes);
     if ((it->it_flags & ITEM_LINKED) != 0) {
         it->it_flags &= ~ITEM_LINKED;
-        STATS_LOCK();
-        stats.curr_bytes -= ITEM_ntotal(it);
-        stats.curr_items -= 1;
-        STATS_UNLOCK();
+        item_count_add(-1, -(int64_t)ITEM_ntotal(it));
         assoc_delete(ITEM_key(it), it->nkey, hv);
         do_item_unlink_q(it);
         do_item_remove(it);
@@ -737,7 +1171,13 @@ void do_item_update(item *it) {
         }
     }
 #else
-    clock_update(it);
+    /* The DRAM tier has no clock; the migrator looks at the access time */
+    if (it->it_flags & ITEM_DRAM) {
+        if (it->time != current_time)
+            it->time = current_time;
+    } else {
+        clock_update(it);
+    }
 #endif
 }
 
@@ -847,6 +1287,7 @@ void item_stats_totals(ADD_STAT add_stats, void *c) {
             totals.moves_to_warm += itemstats[i].moves_to_warm;
             totals.moves_within_lru += itemstats[i].moves_within_lru;
             totals.direct_reclaims += itemstats[i].direct_reclaims;
+            totals.admission_rejects += itemstats[i].admission_rejects;
             pthread_mutex_unlock(&lru_locks[i]);
         }
     }
@@ -864,6 +1305,29 @@ void item_stats_totals(ADD_STAT add_stats, void *c) {
                 (unsigned long long)totals.crawler_items_checked);
     APPEND_STAT("lrutail_reflocked", "%llu",
                 (unsigned long long)totals.lrutail_reflocked);
+#ifdef NVM
+    if (hot_buckets != NULL) {
+        hot_stats_t hot;
+        memset(&hot, 0, sizeof(hot));
+        for (n = 0; n < HOT_CACHE_LOCKS; n++) {
+            pthread_mutex_lock(&hot_locks[n]);
+            hot.hits += hot_stats[n].hits;
+            hot.admits += hot_stats[n].admits;
+            hot.drops += hot_stats[n].drops;
+            pthread_mutex_unlock(&hot_locks[n]);
+        }
+        APPEND_STAT("hot_cache_hits", "%llu", (unsigned long long)hot.hits);
+        APPEND_STAT("hot_cache_admits", "%llu", (unsigned long long)hot.admits);
+        APPEND_STAT("hot_cache_drops", "%llu", (unsigned long long)hot.drops);
+        APPEND_STAT("hot_cache_bytes", "%llu", (unsigned long long)hot_bytes);
+    }
+    tier_stats(add_stats, c);
+    log_cleaner_stats(add_stats, c);
+    if (settings.admission == ADMIT_TINYLFU) {
+        APPEND_STAT("admission_rejects", "%llu",
+                    (unsigned long long)totals.admission_rejects);
+    }
+#endif
     if (settings.lru_maintainer_thread) {
         APPEND_STAT("moves_to_cold", "%llu",
                     (unsigned long long)totals.moves_to_cold);
@@ -1020,8 +1484,22 @@ item *do_item_get(const char *key, const size_t nkey, const uint32_t hv) {
      * and allocated again before being transmited to the client.
      */
     ITEM_TIMESTAMP;
-#endif
+    item *it = NULL;
+    if (hot_buckets != NULL)
+        it = hot_cache_get(key, nkey, hv);
+    if (it == NULL) {
+        it = assoc_find(key, nkey, hv);
+        if (it != NULL && hot_buckets != NULL)
+            hot_cache_admit(it, hv);
+        if (it != NULL && settings.dram_tier_size != 0)
+            tier_promote_hint(it);
+    }
+    /* a miss is counted by the store that usually follows it */
+    if (it != NULL && settings.admission == ADMIT_TINYLFU)
+        admission_record(hv);
+#else
     item *it = assoc_find(key, nkey, hv);
+#endif
     if (it == NULL) {
 #ifdef NVM
         ITEM_TIMESTAMP;
@@ -1104,6 +1582,14 @@ item *do_item_touch(const char *key, size_t nkey, uint32_t exptime,
     item *it = do_item_get(key, nkey, hv);
     if (it != NULL) {
         it->exptime = exptime;
+#ifdef NVM
+        /* the copy stays valid for us, later gets go to the item again */
+        if (it->it_flags & ITEM_HOT) {
+            item *origin = hot_cache_origin(it);
+            origin->exptime = exptime;
+            hot_cache_invalidate(hv, origin);
+        }
+#endif
     }
     return it;
 }
@@ -1115,6 +1601,469 @@ void do_item_release(item* it) {
 }
 #endif
 
+#ifdef NVM
+/*** TIER MIGRATOR THREAD ***/
+
+/*
+ * With a DRAM tier, new items start out in DRAM. The migrator demotes items
+ * that have not been accessed for a while once the tier fills past its high
+ * watermark, and promotes NVM items that gets found referenced by the clock
+ * while the tier has room. Either way the item is copied into the other
+ * tier and the index value is swapped under the item lock, so concurrent
+ * sets and deletes of the key land either before or after the move.
+ */
+#define TIER_HIGH_PCT        90     /* demote above this fill of the tier */
+#define TIER_LOW_PCT         75     /* promote below it */
+#define TIER_COLD_AGE        60     /* seconds idle before an item is demoted */
+#define TIER_PROMOTE_QUEUE   1024
+#define MIN_TIER_MIGRATOR_SLEEP 1000
+#define MAX_TIER_MIGRATOR_SLEEP 1000000
+
+static pthread_t tier_migrator_tid;
+static pthread_mutex_t tier_migrator_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int do_run_tier_migrator_thread = 0;
+
+/* NVM items to promote, filled by gets without waiting for the lock */
+static item *tier_promote_queue[TIER_PROMOTE_QUEUE];
+static unsigned int tier_promote_count = 0;
+static pthread_mutex_t tier_promote_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Migration counters, only written by the migrator */
+static uint64_t tier_demotions = 0;
+static uint64_t tier_promotions = 0;
+
+static void tier_promote_hint(item *it) {
+    if (it->it_flags & (ITEM_DRAM | ITEM_HOT))
+        return;
+    if (slabs_dram_used() * 100 >= settings.dram_tier_size * TIER_LOW_PCT)
+        return;
+    if (tier_promote_count == TIER_PROMOTE_QUEUE || !clock_is_referenced(it))
+        return;
+    if (pthread_mutex_trylock(&tier_promote_lock) != 0)
+        return;
+    if (tier_promote_count < TIER_PROMOTE_QUEUE)
+        tier_promote_queue[tier_promote_count++] = it;
+    pthread_mutex_unlock(&tier_promote_lock);
+}
+
+/* Moves a linked item to the other tier. Returns 1 if it moved. */
+static int tier_migrate(item *it, const bool to_dram) {
+    unsigned int id, total_chunks;
+    item *new_it = NULL;
+    uint32_t hv;
+    int moved = 0;
+
+    /* An odd timestamp keeps it from being reused while we look at it */
+    ITEM_TIMESTAMP;
+    if ((it->it_flags & (ITEM_LINKED | ITEM_SLABBED)) != ITEM_LINKED ||
+        ((it->it_flags & ITEM_DRAM) != 0) == to_dram) {
+        ITEM_TIMESTAMP;
+        return 0;
+    }
+
+    hv = it->hv;
+    item_lock(hv);
+    if ((it->it_flags & ITEM_LINKED) && assoc_find(ITEM_key(it), it->nkey, hv) == it) {
+        size_t ntotal = ITEM_ntotal(it);
+        id = slabs_clsid(ntotal);
+        if (to_dram) {
+            new_it = (item*)slabs_dram_alloc(ntotal, id);
+        } else if ((new_it = (item*)slabs_alloc(ntotal, id, &total_chunks)) == NULL &&
+                   item_evict(id, hv)) {
+            new_it = (item*)slabs_alloc(ntotal, id, &total_chunks);
+        }
+    }
+    if (new_it != NULL) {
+        /* The allocator owns the placement fields of the header */
+        void *slab = new_it->slab;
+        unsigned int slabs_index = new_it->slabs_index;
+        size_t ntotal = ITEM_ntotal(it);
+
+        memcpy(new_it, it, ntotal);
+        new_it->slab = slab;
+        new_it->slabs_index = slabs_index;
+        new_it->next = new_it->prev = 0;
+        if (to_dram) {
+            new_it->it_flags |= ITEM_DRAM;
+            new_it->time = current_time;
+        } else {
+            new_it->it_flags &= ~ITEM_DRAM;
+            write_data_wait(new_it, (ntotal + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE);
+        }
+
+        assoc_replace(new_it, hv);
+        hot_cache_invalidate(hv, it);
+        it->it_flags &= ~ITEM_LINKED;
+        item_free(it);
+        moved = 1;
+    }
+    item_unlock(hv);
+    ITEM_TIMESTAMP;
+
+    if (moved) {
+        if (to_dram) {
+            tier_promotions++;
+        } else {
+            tier_demotions++;
+        }
+    }
+    return moved;
+}
+
+/* Demotes idle items while the tier is above its high watermark. The idle
+ * age halves for every full pass that finds nothing to demote. */
+static int tier_demote(void) {
+    static unsigned int cur_id = POWER_SMALLEST;
+    static unsigned int cur_index = 0;
+    static rel_time_t age = TIER_COLD_AGE;
+    static bool pass_moved = false;
+    int moved = 0;
+    int budget = 1000;
+
+    if (slabs_dram_used() * 100 < settings.dram_tier_size * TIER_HIGH_PCT) {
+        age = TIER_COLD_AGE;
+        return 0;
+    }
+
+    while (budget-- > 0 &&
+           slabs_dram_used() * 100 >= settings.dram_tier_size * TIER_LOW_PCT) {
+        if (cur_index >= slabs_dram_chunks(cur_id)) {
+            cur_index = 0;
+            if (++cur_id >= MAX_NUMBER_OF_SLAB_CLASSES) {
+                cur_id = POWER_SMALLEST;
+                if (!pass_moved)
+                    age /= 2;
+                pass_moved = false;
+            }
+            continue;
+        }
+        item *it = slabs_dram_chunk(cur_id, cur_index++);
+        if ((it->it_flags & ITEM_LINKED) && it->time + age <= current_time &&
+            tier_migrate(it, false)) {
+            moved++;
+            pass_moved = true;
+        }
+    }
+    return moved;
+}
+
+static int tier_promote(void) {
+    item *batch[TIER_PROMOTE_QUEUE];
+    unsigned int n, i;
+    int moved = 0;
+
+    pthread_mutex_lock(&tier_promote_lock);
+    n = tier_promote_count;
+    memcpy(batch, tier_promote_queue, n * sizeof(item *));
+    tier_promote_count = 0;
+    pthread_mutex_unlock(&tier_promote_lock);
+
+    for (i = 0; i < n; i++) {
+        if (slabs_dram_used() * 100 >= settings.dram_tier_size * TIER_LOW_PCT)
+            break;
+        moved += tier_migrate(batch[i], true);
+    }
+    return moved;
+}
+
+static void *tier_migrator_thread(void *arg) {
+    useconds_t to_sleep = MIN_TIER_MIGRATOR_SLEEP;
+
+    /* The migrator takes the slot after the workers in the epoch and
+     * timestamp tables, see item_gc_init() */
+    assoc_thread_init(settings.num_threads);
+    item_gc_thread_init(settings.num_threads);
+
+    pthread_mutex_lock(&tier_migrator_lock);
+    if (settings.verbose > 2)
+        fprintf(stderr, "Starting tier migrator background thread\n");
+    while (do_run_tier_migrator_thread) {
+        int moved;
+        pthread_mutex_unlock(&tier_migrator_lock);
+        usleep(to_sleep);
+        pthread_mutex_lock(&tier_migrator_lock);
+
+        moved = tier_demote() + tier_promote();
+        if (moved == 0) {
+            if (to_sleep < MAX_TIER_MIGRATOR_SLEEP)
+                to_sleep += 1000;
+        } else {
+            to_sleep /= 2;
+            if (to_sleep < MIN_TIER_MIGRATOR_SLEEP)
+                to_sleep = MIN_TIER_MIGRATOR_SLEEP;
+        }
+    }
+    pthread_mutex_unlock(&tier_migrator_lock);
+    if (settings.verbose > 2)
+        fprintf(stderr, "Tier migrator thread stopping\n");
+
+    return NULL;
+}
+
+int start_tier_migrator_thread(void) {
+    int ret;
+
+    pthread_mutex_lock(&tier_migrator_lock);
+    do_run_tier_migrator_thread = 1;
+    if ((ret = pthread_create(&tier_migrator_tid, NULL,
+        tier_migrator_thread, NULL)) != 0) {
+        fprintf(stderr, "Can't create tier migrator thread: %s\n",
+            strerror(ret));
+        pthread_mutex_unlock(&tier_migrator_lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&tier_migrator_lock);
+
+    return 0;
+}
+
+int stop_tier_migrator_thread(void) {
+    int ret;
+    pthread_mutex_lock(&tier_migrator_lock);
+    do_run_tier_migrator_thread = 0;
+    pthread_mutex_unlock(&tier_migrator_lock);
+    if ((ret = pthread_join(tier_migrator_tid, NULL)) != 0) {
+        fprintf(stderr, "Failed to stop tier migrator thread: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+/* If we hold this lock, the migrator can't move items */
+void tier_migrator_pause(void) {
+    if (settings.dram_tier_size != 0)
+        pthread_mutex_lock(&tier_migrator_lock);
+}
+
+void tier_migrator_resume(void) {
+    if (settings.dram_tier_size != 0)
+        pthread_mutex_unlock(&tier_migrator_lock);
+}
+
+static void tier_stats(ADD_STAT add_stats, void *c) {
+    if (settings.dram_tier_size == 0)
+        return;
+    APPEND_STAT("tier_promotions", "%llu", (unsigned long long)tier_promotions);
+    APPEND_STAT("tier_demotions", "%llu", (unsigned long long)tier_demotions);
+}
+#endif
+
+#ifdef NVM
+/*** LOG CLEANER THREAD ***/
+
+/*
+ * With the log engine (settings.engine) the cleaner keeps a few segments
+ * spare for the workers. It compacts the sealed segment with the least live
+ * data, as long as that is below LOG_CLEAN_PCT percent, by copying its live
+ * items to the cleaner's own segment and swapping the index value under the
+ * item lock, like the tier migrator does. If no segment is sparse enough it
+ * evicts everything in the oldest one. Either way the old entries go through
+ * the item free lists, and the segment is reused once the last one is
+ * released.
+ */
+#define LOG_CLEAN_PCT        50     /* compact segments less live than this */
+#define LOG_SPARE_SEGMENTS   4      /* start cleaning below this many spares */
+#define MIN_LOG_CLEANER_SLEEP 1000
+#define MAX_LOG_CLEANER_SLEEP 1000000
+
+static pthread_t log_cleaner_tid;
+static pthread_mutex_t log_cleaner_lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int do_run_log_cleaner_thread = 0;
+
+/* Updated atomically, workers evict too */
+static uint64_t log_relocated = 0;
+static uint64_t log_evicted = 0;
+static uint64_t log_segments_cleaned = 0;
+
+/* Whether the index still points at this entry */
+static bool log_entry_live(item *it) {
+    return (it->it_flags & (ITEM_LINKED | ITEM_SLABBED)) == ITEM_LINKED &&
+           assoc_find(ITEM_key(it), it->nkey, it->hv) == it;
+}
+
+/* Copies a live entry to the end of the calling thread's segment. Returns 1
+ * if it moved, 0 if it was gone already, -1 if there was no room. */
+static int log_relocate(item *it) {
+    uint32_t hv = it->hv;
+    unsigned int id;
+    item *new_it = NULL;
+    int ret = 0;
+
+    item_lock(hv);
+    if (log_entry_live(it)) {
+        size_t ntotal = ITEM_ntotal(it);
+        id = ITEM_clsid(it);
+        if ((new_it = (item*)slabs_log_alloc(ntotal, id)) == NULL) {
+            ret = -1;
+        } else {
+            /* The allocator owns the placement fields of the header */
+            void *slab = new_it->slab;
+            unsigned int slabs_index = new_it->slabs_index;
+
+            memcpy(new_it, it, ntotal);
+            new_it->slab = slab;
+            new_it->slabs_index = slabs_index;
+            new_it->next = new_it->prev = 0;
+            write_data_wait(new_it, (ntotal + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE);
+
+            assoc_replace(new_it, hv);
+            it->it_flags &= ~ITEM_LINKED;
+            item_free(it);
+            ret = 1;
+        }
+    }
+    item_unlock(hv);
+    return ret;
+}
+
+/* Unlinks a live entry. The unlink goes by key, so the entry's item lock is
+ * needed to keep a set or log_relocate() from replacing it under us; it is
+ * only tried, as in item_evict(), since workers may get here from
+ * do_item_alloc() with one held. A busy entry is skipped and keeps its
+ * segment from being freed until the next pass. */
+static int log_evict_entry(item *it, const uint32_t cur_hv) {
+    uint32_t hv = it->hv;
+    void *hold_lock;
+
+    if (hv == cur_hv || (hold_lock = item_trylock(hv)) == NULL)
+        return 0;
+    if (!log_entry_live(it)) {
+        item_trylock_unlock(hold_lock);
+        return 0;
+    }
+    do_item_unlink(it, hv);
+    item_trylock_unlock(hold_lock);
+    __sync_fetch_and_add(&log_evicted, 1);
+    return 1;
+}
+
+/* Evicts the live entries of the oldest sealed segment */
+static int log_evict_oldest(const uint32_t cur_hv) {
+    void *seg = slabs_log_claim(100);
+    item *it;
+    int evicted = 0;
+
+    if (seg == NULL)
+        return 0;
+    for (it = slabs_log_next(seg, NULL); it != NULL; it = slabs_log_next(seg, it)) {
+        evicted += log_evict_entry(it, cur_hv);
+    }
+    slabs_log_release(seg);
+    __sync_fetch_and_add(&log_segments_cleaned, 1);
+    return evicted;
+}
+
+/* Moves the live entries out of the sparsest segment. Returns the number of
+ * entries moved or evicted, -1 if no segment is sparse enough. */
+static int log_compact(void) {
+    void *seg = slabs_log_claim(LOG_CLEAN_PCT);
+    item *it;
+    int done = 0;
+
+    if (seg == NULL)
+        return -1;
+    for (it = slabs_log_next(seg, NULL); it != NULL; it = slabs_log_next(seg, it)) {
+        int moved = log_relocate(it);
+        if (moved > 0) {
+            __sync_fetch_and_add(&log_relocated, 1);
+            done++;
+        } else if (moved < 0) {
+            /* out of segments: make room instead of copying */
+            done += log_evict_entry(it, 0);
+        }
+    }
+    slabs_log_release(seg);
+    __sync_fetch_and_add(&log_segments_cleaned, 1);
+    return done;
+}
+
+static void *log_cleaner_thread(void *arg) {
+    useconds_t to_sleep = MIN_LOG_CLEANER_SLEEP;
+
+    /* The cleaner takes the slot after the workers in the epoch and
+     * timestamp tables, see item_gc_init() */
+    assoc_thread_init(settings.num_threads);
+    item_gc_thread_init(settings.num_threads);
+
+    pthread_mutex_lock(&log_cleaner_lock);
+    if (settings.verbose > 2)
+        fprintf(stderr, "Starting log cleaner background thread\n");
+    while (do_run_log_cleaner_thread) {
+        int done = 0;
+        pthread_mutex_unlock(&log_cleaner_lock);
+        usleep(to_sleep);
+        pthread_mutex_lock(&log_cleaner_lock);
+
+        if (slabs_log_spare_segments() < LOG_SPARE_SEGMENTS) {
+            if ((done = log_compact()) < 0)
+                done = log_evict_oldest(0);
+            free_list_try_to_release();
+        }
+        if (done <= 0) {
+            if (to_sleep < MAX_LOG_CLEANER_SLEEP)
+                to_sleep += 1000;
+        } else {
+            to_sleep /= 2;
+            if (to_sleep < MIN_LOG_CLEANER_SLEEP)
+                to_sleep = MIN_LOG_CLEANER_SLEEP;
+        }
+    }
+    pthread_mutex_unlock(&log_cleaner_lock);
+    if (settings.verbose > 2)
+        fprintf(stderr, "Log cleaner thread stopping\n");
+
+    return NULL;
+}
+
+int start_log_cleaner_thread(void) {
+    int ret;
+
+    pthread_mutex_lock(&log_cleaner_lock);
+    do_run_log_cleaner_thread = 1;
+    if ((ret = pthread_create(&log_cleaner_tid, NULL,
+        log_cleaner_thread, NULL)) != 0) {
+        fprintf(stderr, "Can't create log cleaner thread: %s\n",
+            strerror(ret));
+        pthread_mutex_unlock(&log_cleaner_lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&log_cleaner_lock);
+
+    return 0;
+}
+
+int stop_log_cleaner_thread(void) {
+    int ret;
+    pthread_mutex_lock(&log_cleaner_lock);
+    do_run_log_cleaner_thread = 0;
+    pthread_mutex_unlock(&log_cleaner_lock);
+    if ((ret = pthread_join(log_cleaner_tid, NULL)) != 0) {
+        fprintf(stderr, "Failed to stop log cleaner thread: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+/* If we hold this lock, the cleaner can't move items */
+void log_cleaner_pause(void) {
+    if (settings.engine == ENGINE_LOG)
+        pthread_mutex_lock(&log_cleaner_lock);
+}
+
+void log_cleaner_resume(void) {
+    if (settings.engine == ENGINE_LOG)
+        pthread_mutex_unlock(&log_cleaner_lock);
+}
+
+static void log_cleaner_stats(ADD_STAT add_stats, void *c) {
+    if (settings.engine != ENGINE_LOG)
+        return;
+    APPEND_STAT("log_relocated", "%llu", (unsigned long long)log_relocated);
+    APPEND_STAT("log_evicted", "%llu", (unsigned long long)log_evicted);
+    APPEND_STAT("log_segments_cleaned", "%llu", (unsigned long long)log_segments_cleaned);
+}
+#endif
+
 /*** LRU MAINTENANCE THREAD ***/
 
 /* Returns number of items remove, expired, or evicted.
@@ -1,5 +1,6 @@
 /* See items.c */
 uint64_t get_cas_id(void);
+uint64_t get_cas_id_fence(void);
 
 #ifdef NVM
 
@@ -19,6 +20,12 @@ static active_slab_table_t** slab_tables;
 void item_gc_init(unsigned int size_limit, int num_threads);
 void item_gc_thread_init(int thread_id);
 void recover();
+/* true if the last allocation of this thread was turned down by the
+ * admission filter rather than failing for lack of memory */
+/* MSG_ZEROCOPY sends of item memory by this thread; items freed before a
+ * send was issued are not reused until it has completed */
+void item_zerocopy_issued(void);
+void item_zerocopy_completed(const uint64_t count);
 #endif
 
 /*@null@*/
@@ -51,6 +58,7 @@ item *do_item_touch(const char *key, const size_t nkey, uint32_t exptime, const
 void do_item_release(item* it);
 #endif
 void item_stats_reset(void);
+void item_counts(uint64_t *curr_items, uint64_t *total_items, uint64_t *curr_bytes);
 extern pthread_mutex_t lru_locks[POWER_LARGEST];
 void item_stats_evictions(uint64_t *evicted);
 
@@ -58,6 +66,17 @@ enum crawler_result_type {
     CRAWLER_OK=0, CRAWLER_RUNNING, CRAWLER_BADCLASS, CRAWLER_NOTSTARTED
 };
 
+#ifdef NVM
+int start_tier_migrator_thread(void);
+int stop_tier_migrator_thread(void);
+void tier_migrator_pause(void);
+void tier_migrator_resume(void);
+int start_log_cleaner_thread(void);
+int stop_log_cleaner_thread(void);
+void log_cleaner_pause(void);
+void log_cleaner_resume(void);
+#endif
+
 int start_lru_maintainer_thread(void);
 int stop_lru_maintainer_thread(void);
 int init_lru_maintainer(void);
@@ -37,10 +37,10 @@
 #if RETRY_STATS == 1
 #  define RETRY_STATS_VARS						\
   __thread size_t __parse_try, __update_try, __cleanup_try, __lock_try, __lock_queue, __lock_try_once, \
-    __node_cache_hit
+    __node_cache_hit, __flush_lines
 #  define RETRY_STATS_VARS_GLOBAL					\
   size_t __parse_try_global, __update_try_global, __cleanup_try_global, __lock_try_global, __lock_queue_global, \
-    __node_cache_hit_global
+    __node_cache_hit_global, __flush_lines_global
 
 extern RETRY_STATS_VARS;
 extern RETRY_STATS_VARS_GLOBAL;
@@ -52,7 +52,8 @@ extern RETRY_STATS_VARS_GLOBAL;
   __lock_try = 0;				\
   __lock_queue = 0;				\
   __lock_try_once = 1;				\
-  __node_cache_hit = 0;
+  __node_cache_hit = 0;				\
+  __flush_lines = 0;
 
 #  define PARSE_TRY()        __parse_try++
 #  define UPDATE_TRY()       __update_try++
@@ -71,6 +72,7 @@ extern RETRY_STATS_VARS_GLOBAL;
       __lock_queue += (q);			\
     }
 # define NODE_CACHE_HIT()  __node_cache_hit++;
+#  define FLUSH_TRY(lines)   (__flush_lines += (lines))
 #  define LOCK_TRY_ONCE_CLEAR()    __lock_try_once = 1
 #  define RETRY_STATS_PRINT(thr, put, rem, upd_suc)   retry_stats_print(thr, put, rem, (upd_suc))
 #  define RETRY_STATS_SHARE()			\
@@ -79,7 +81,8 @@ extern RETRY_STATS_VARS_GLOBAL;
   __cleanup_try_global += __cleanup_try;	\
   __lock_try_global += __lock_try;		\
   __lock_queue_global += __lock_queue;		\
-  __node_cache_hit_global += __node_cache_hit;
+  __node_cache_hit_global += __node_cache_hit;	\
+  __flush_lines_global += __flush_lines;
 
 static inline void 
 retry_stats_print(size_t thr, size_t put, size_t rem, size_t upd_suc)
@@ -102,6 +105,8 @@ retry_stats_print(size_t thr, size_t put, size_t rem, size_t upd_suc)
   
   printf("#cache_hit:    %-10zu %-10zu %f\n", __parse_try_global, __node_cache_hit_global,
 	 (double) __node_cache_hit_global / __parse_try_global);
+  printf("#flush_all:    %-10zu %f per op\n", __flush_lines_global,
+	 (double) __flush_lines_global / thr);
 }
 
 #else  /* RETRY_STATS == 0 */
@@ -117,6 +122,7 @@ retry_stats_print(size_t thr, size_t put, size_t rem, size_t upd_suc)
 #  define LOCK_TRY()
 #  define LOCK_TRY_ONCE()
 #  define NODE_CACHE_HIT() 
+#  define FLUSH_TRY(lines)   ((void) 0)
 #  define LOCK_QUEUE(q)
 #  define LOCK_QUEUE_ONCE(q)
 #  define LOCK_TRY_ONCE_CLEAR()
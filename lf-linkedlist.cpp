@@ -95,10 +95,12 @@ static inline int delete_right(volatile node_t* left, volatile node_t* right, Ep
 	if (success) {
 		EpochReclaimObject(epoch, (node_t*)right, NULL, NULL, finalize_node);
 	}
+	CLEANUP_TRY();
 	return success;
 }
 
 static inline volatile node_t* search(linkedlist_t* ll, skey_t key, const char* full_key, const size_t nkey, volatile node_t** left_ptr, EpochThread epoch, linkcache_t* buffer) {
+	PARSE_TRY();
 	volatile node_t* left = *ll;
 	volatile node_t* right = (node_t*)unmark_ptr_cache((uintptr_t)(*ll)->next);
 	while (1) {
@@ -138,16 +140,19 @@ int linkedlist_size(linkedlist_t* ll) {
 }
 
 
-svalue_t linkedlist_remove(linkedlist_t* ll, skey_t key, const char* full_key, const size_t nkey, EpochThread epoch, linkcache_t* buffer) {
+/* Removes the entry for key; if expected is not 0, only while it maps to expected */
+svalue_t linkedlist_remove(linkedlist_t* ll, skey_t key, const char* full_key, const size_t nkey, svalue_t expected, EpochThread epoch, linkcache_t* buffer) {
 	node_t* res = NULL;
 	node_t* unmarked;
 	volatile node_t* left;
 	volatile node_t* right;
 	EpochStart(epoch);
 	do {
+		UPDATE_TRY();
 		right = search(ll, key, full_key, nkey, &left, epoch, buffer);
 
-		if (right->key != key || (keycmp_key_item(full_key, nkey, right->value) != 0)) {
+		if (right->key != key || (keycmp_key_item(full_key, nkey, right->value) != 0) ||
+			(expected != 0 && right->value != expected)) {
 #ifdef BUFFERING_ON
             cache_scan(buffer, key);
 #else
@@ -201,6 +206,7 @@ svalue_t linkedlist_remove(linkedlist_t* ll, skey_t key, const char* full_key, c
 svalue_t linkedlist_insert(linkedlist_t* ll, skey_t key, svalue_t val, int replace, EpochThread epoch, linkcache_t* buffer) {
 	EpochStart(epoch);
 	do {
+		UPDATE_TRY();
 		volatile node_t* left;
 		item* it = (item*) val;
 		volatile node_t* right = search(ll,key,ITEM_key(it),it->nkey,&left, epoch, buffer);
@@ -280,6 +286,7 @@ svalue_t linkedlist_find_simple(linkedlist_t* ll, skey_t key, const char* full_k
 svalue_t linkedlist_find(linkedlist_t* ll, skey_t key, const char* full_key, const size_t nkey, EpochThread epoch, linkcache_t* buffer) {
 
 	EpochStart(epoch);
+	PARSE_TRY();
 	volatile node_t* prev = (*ll);
 	volatile node_t* node = (node_t*)unmark_ptr_cache((uintptr_t)(*ll)->next);
 	
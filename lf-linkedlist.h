@@ -55,7 +55,7 @@ typedef linkedlist_t* plinkedlist_t;
 
 svalue_t linkedlist_find(linkedlist_t* ll, skey_t key, const char* full_key, const size_t nkey, EpochThread epoch, linkcache_t* buffer);
 svalue_t linkedlist_insert(linkedlist_t* ll, skey_t key, svalue_t val, int replace, EpochThread epoch, linkcache_t* buffer);
-svalue_t linkedlist_remove(linkedlist_t* ll, skey_t key, const char* full_key, const size_t nkey, EpochThread epoch, linkcache_t* buffer);
+svalue_t linkedlist_remove(linkedlist_t* ll, skey_t key, const char* full_key, const size_t nkey, svalue_t expected, EpochThread epoch, linkcache_t* buffer);
 svalue_t linkedlist_find_simple(linkedlist_t* ll, skey_t key, const char* full_key, const size_t nkey);
 
 linkedlist_t* new_linkedlist(EpochThread epoch);
@@ -47,6 +47,22 @@
 #include <limits.h>
 #include <sysexits.h>
 #include <stddef.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(NVM) && defined(__linux__)
+#include <linux/errqueue.h>
+#endif
+#ifdef USE_IO_URING
+#include <sys/eventfd.h>
+#endif
+#if defined(NVM) && defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && \
+    defined(SO_EE_ORIGIN_ZEROCOPY)
+#define USE_ZEROCOPY 1
+#endif
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define USE_UDP_MMSG 1
+#endif
 
 /* FreeBSD 4.x doesn't have IOV_MAX exposed. */
 #ifndef IOV_MAX
@@ -99,6 +115,13 @@ static void write_bin_error(conn *c, protocol_binary_response_status err,
                             const char *errstr, int swallow);
 
 static void conn_free(conn *c);
+#ifdef USE_IO_URING
+static void conn_uring_detach(conn *c);
+static void conn_uring_cancel_send(conn *c);
+#endif
+#ifdef USE_UDP_MMSG
+static struct udp_batch *udp_batch_new(void);
+#endif
 
 /** exported globals **/
 struct stats stats;
@@ -144,6 +167,26 @@ static void maxconns_handler(const int fd, const short which, void *arg) {
     }
 }
 
+/* A worker's own listener is left alone by accept_new_conns(), which runs
+ * on other threads. Out of fds, it stops watching it for 10ms instead. */
+static void worker_listen_resume(const int fd, const short which, void *arg) {
+    conn *c = (conn *)arg;
+
+    if (!update_event(c, EV_READ | EV_PERSIST) && settings.verbose > 0)
+        fprintf(stderr, "Couldn't resume listening on fd %d\n", fd);
+}
+
+static void worker_listen_backoff(conn *c) {
+    struct timeval t = {.tv_sec = 0, .tv_usec = 10000};
+
+    if (!update_event(c, 0) ||
+        event_base_once(c->thread->base, -1, EV_TIMEOUT, worker_listen_resume,
+                        c, &t) != 0) {
+        if (settings.verbose > 0)
+            fprintf(stderr, "Couldn't pause listening on fd %d\n", c->sfd);
+    }
+}
+
 #define REALTIME_MAXDELTA 60*60*24*30
 
 /*
@@ -172,11 +215,11 @@ static rel_time_t realtime(const time_t exptime) {
 }
 
 static void stats_init(void) {
-    stats.curr_items = stats.total_items = stats.curr_conns = stats.total_conns = stats.conn_structs = 0;
+    stats.curr_conns = stats.total_conns = stats.conn_structs = 0;
     stats.get_cmds = stats.set_cmds = stats.get_hits = stats.get_misses = stats.evictions = stats.reclaimed = 0;
     stats.touch_cmds = stats.touch_misses = stats.touch_hits = stats.rejected_conns = 0;
     stats.malloc_fails = 0;
-    stats.curr_bytes = stats.listen_disabled_num = 0;
+    stats.listen_disabled_num = 0;
     stats.hash_power_level = stats.hash_bytes = stats.hash_is_expanding = 0;
     stats.expired_unfetched = stats.evicted_unfetched = 0;
     stats.slabs_moved = 0;
@@ -192,11 +235,12 @@ static void stats_init(void) {
        values are now false in boolean context... */
     process_started = time(0) - ITEM_UPDATE_INTERVAL - 2;
     stats_prefix_init();
+    stats_latency_init();
 }
 
 static void stats_reset(void) {
     STATS_LOCK();
-    stats.total_items = stats.total_conns = 0;
+    stats.total_conns = 0;
     stats.rejected_conns = 0;
     stats.malloc_fails = 0;
     stats.evictions = 0;
@@ -206,6 +250,7 @@ static void stats_reset(void) {
     STATS_UNLOCK();
     threadlocal_stats_reset();
     item_stats_reset();
+    stats_latency_reset();
 }
 
 static void settings_init(void) {
@@ -248,6 +293,22 @@ static void settings_init(void) {
     settings.flush_enabled = true;
     settings.crawls_persleep = 1000;
     settings.free_list_size_limit = 0;
+    settings.pool_dirs = (char *)"/tmp";
+    settings.slabs_pool_size = SLABS_POOL_SIZE;
+#ifdef NVM
+    settings.ht_pool_size = HT_POOL_SIZE;
+#endif
+    settings.pool_stripe = POOL_STRIPE_RR;
+    settings.numa = false;
+    settings.hot_cache_size = 0;
+    settings.dram_tier_size = 0;
+    settings.admission = ADMIT_ALL;
+    settings.slab_alloc = SLAB_ALLOC_LIFO;
+    settings.engine = ENGINE_SLABS;
+    settings.zerocopy_min = 0;
+    settings.io_uring = false;
+    settings.listen_mode = LISTEN_DISPATCH;
+    settings.batch_responses = 0;
 }
 
 /*
@@ -375,6 +436,7 @@ conn *conn_new(const int sfd, enum conn_states init_state,
         c->iov = 0;
         c->msglist = 0;
         c->hdrbuf = 0;
+        c->udp = 0;
 
         c->rsize = read_buffer_size;
         c->wsize = DATA_BUFFER_SIZE;
@@ -409,6 +471,20 @@ conn *conn_new(const int sfd, enum conn_states init_state,
         conns[sfd] = c;
     }
 
+#ifdef USE_UDP_MMSG
+    if (!IS_UDP(transport)) {
+        /* a UDP conn struct reused for TCP has no use for the rings */
+        free(c->udp);
+        c->udp = NULL;
+    } else if (c->udp == NULL) {
+        /* without the rings the conn reads a datagram at a time */
+        c->udp = udp_batch_new();
+    } else {
+        c->udp->rx_next = c->udp->rx_count = 0;
+        c->udp->tx_count = 0;
+    }
+#endif
+
     c->transport = transport;
     c->protocol = settings.binding_protocol;
 
@@ -470,6 +546,38 @@ conn *conn_new(const int sfd, enum conn_states init_state,
     c->item = 0;
 
     c->noreply = false;
+    c->batching = false;
+    c->wbatch = 0;
+
+#ifdef NVM
+    c->zerocopy = false;
+    c->zc_pending = 0;
+#ifdef USE_ZEROCOPY
+    if (settings.zerocopy_min > 0 && transport == tcp_transport &&
+        init_state == conn_new_cmd) {
+        int one = 1;
+        /* fails on unix sockets, which then just copy */
+        c->zerocopy = setsockopt(sfd, SOL_SOCKET, SO_ZEROCOPY,
+                                 &one, sizeof(one)) == 0;
+    }
+#endif
+#endif
+#ifdef USE_IO_URING
+    /* conn_uring_attach() takes it over once the thread is known */
+    c->uring = false;
+    c->ur_gen++;
+    c->ur_head = c->ur_tail = -1;
+    c->ur_off = 0;
+    c->ur_nbufs = 0;
+    c->ur_err = 0;
+    c->ur_eof = false;
+    c->ur_recv_armed = false;
+    c->ur_recv_paused = false;
+    c->ur_send_busy = false;
+    c->ur_closing = false;
+    c->ur_send_done = false;
+    c->ur_wake_pending = false;
+#endif
 
     event_set(&c->event, sfd, event_flags, event_handler, (void *)c);
     event_base_set(base, &c->event);
@@ -575,13 +683,163 @@ void conn_free(conn *c) {
             free(c->suffixlist);
         if (c->iov)
             free(c->iov);
+        if (c->udp)
+            free(c->udp);
+#ifdef NVM
+        if (c->zc_keep)
+            free(c->zc_keep);
+#endif
         free(c);
     }
 }
 
+#ifdef USE_ZEROCOPY
+/* How often a worker collects completions for the sockets it kept open */
+#define ZEROCOPY_ORPHAN_POLL_MS 10
+
+/* The socket of a closed connection, kept open until the MSG_ZEROCOPY
+ * sends still out on it complete. Only the owning thread touches these. */
+typedef struct zc_orphan {
+    int sfd;
+    unsigned int pending;
+    LIBEVENT_THREAD *thread;
+    struct zc_orphan *next;
+} zc_orphan_t;
+
+static __thread zc_orphan_t *zc_orphans = NULL;
+static __thread struct event zc_orphan_timer;
+static __thread bool zc_orphan_timer_armed = false;
+
+/*
+ * Collects completions of MSG_ZEROCOPY sends from a socket's error queue,
+ * so the items they read from may be reused. Only the sends the kernel
+ * reported are taken off *pending.
+ */
+static void zerocopy_reap(int sfd, unsigned int *pending, LIBEVENT_THREAD *me) {
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err *serr;
+    uint32_t done;
+
+    while (*pending > 0) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sfd, &msg, MSG_ERRQUEUE) == -1)
+            break;
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if (!(cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) &&
+                !(cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR))
+                continue;
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            /* one notification covers the sends ee_info..ee_data */
+            done = serr->ee_data - serr->ee_info + 1;
+            if (done > *pending)
+                done = *pending;
+            *pending -= done;
+            item_zerocopy_completed(done);
+
+            if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                uint64_t *copied = &me->stats.zerocopy_copied;
+                __atomic_store_n(copied, __atomic_load_n(copied, __ATOMIC_RELAXED) + done,
+                                 __ATOMIC_RELAXED);
+            }
+        }
+    }
+}
+
+static void conn_zerocopy_reap(conn *c) {
+    zerocopy_reap(c->sfd, &c->zc_pending, c->thread);
+}
+
+/* Collects what it can for the sockets this thread kept open at close,
+ * and closes those that have nothing out any more */
+static void zerocopy_reap_orphans(void) {
+    zc_orphan_t **op = &zc_orphans;
+
+    while (*op != NULL) {
+        zc_orphan_t *o = *op;
+        zerocopy_reap(o->sfd, &o->pending, o->thread);
+        if (o->pending == 0) {
+            close(o->sfd);
+            *op = o->next;
+            free(o);
+        } else {
+            op = &o->next;
+        }
+    }
+}
+
+/* Reaps the orphans of an otherwise idle worker, which gets no other event
+ * to do it on, until none are left */
+static void zerocopy_orphan_timer(const int fd, const short which, void *arg) {
+    LIBEVENT_THREAD *me = (LIBEVENT_THREAD *)arg;
+    struct timeval t = {0, ZEROCOPY_ORPHAN_POLL_MS * 1000};
+
+    zerocopy_reap_orphans();
+    if (zc_orphans == NULL) {
+        zc_orphan_timer_armed = false;
+        return;
+    }
+    evtimer_set(&zc_orphan_timer, zerocopy_orphan_timer, me);
+    event_base_set(me->base, &zc_orphan_timer);
+    evtimer_add(&zc_orphan_timer, &t);
+}
+
+/*
+ * Hands the socket of a closing connection with MSG_ZEROCOPY sends still
+ * out to the thread's orphans. Those sends are not credited: the NIC may
+ * yet read the items they point at, so reclamation has to keep waiting for
+ * them. The socket is shut down but kept open, and a timer collects the
+ * completions. transmit() took c->zc_keep before the first such send, so
+ * this never allocates. Returns true if the socket was kept.
+ */
+static bool conn_zerocopy_orphan(conn *c) {
+    zc_orphan_t *o = c->zc_keep;
+
+    conn_zerocopy_reap(c);
+    if (c->zc_pending == 0)
+        return false;
+
+    assert(o != NULL);
+    c->zc_keep = NULL;
+    shutdown(c->sfd, SHUT_RDWR);
+    o->sfd = c->sfd;
+    o->pending = c->zc_pending;
+    o->thread = c->thread;
+    o->next = zc_orphans;
+    zc_orphans = o;
+    c->zc_pending = 0;
+
+    if (!zc_orphan_timer_armed) {
+        struct timeval t = {0, ZEROCOPY_ORPHAN_POLL_MS * 1000};
+        evtimer_set(&zc_orphan_timer, zerocopy_orphan_timer, c->thread);
+        event_base_set(c->thread->base, &zc_orphan_timer);
+        evtimer_add(&zc_orphan_timer, &t);
+        zc_orphan_timer_armed = true;
+    }
+    return true;
+}
+#endif
+
 static void conn_close(conn *c) {
     assert(c != NULL);
 
+#ifdef USE_IO_URING
+    /* A sendmsg in the ring still reads from the connection's items and
+     * buffers: cancel it and finish once its completion is in. */
+    if (c->uring && c->ur_send_busy) {
+        if (!c->ur_closing)
+            conn_uring_cancel_send(c);
+        return;
+    }
+#endif
+
     /* delete the event, the socket and the conn */
     event_del(&c->event);
 
@@ -590,9 +848,24 @@ static void conn_close(conn *c) {
 
     conn_cleanup(c);
 
+#ifdef USE_ZEROCOPY
+    bool kept_open = false;
+    if (c->zc_pending > 0)
+        kept_open = conn_zerocopy_orphan(c);
+    if (zc_orphans != NULL)
+        zerocopy_reap_orphans();
+#endif
+#ifdef USE_IO_URING
+    if (c->uring)
+        conn_uring_detach(c);
+#endif
+
     MEMCACHED_CONN_RELEASE(c->sfd);
     conn_set_state(c, conn_closed);
-    close(c->sfd);
+#ifdef USE_ZEROCOPY
+    if (!kept_open)
+#endif
+        close(c->sfd);
 
     pthread_mutex_lock(&conn_lock);
     allow_new_conns = true;
@@ -616,7 +889,8 @@ static void conn_close(conn *c) {
 static void conn_shrink(conn *c) {
     assert(c != NULL);
 
-    if (IS_UDP(c->transport))
+    /* collected responses still point into the lists */
+    if (IS_UDP(c->transport) || c->batching)
         return;
 
     if (c->rsize > READ_BUFFER_HIGHWAT && c->rbytes < DATA_BUFFER_SIZE) {
@@ -856,6 +1130,34 @@ static void out_string(conn *c, const char *str) {
     if (settings.verbose > 1)
         fprintf(stderr, ">%d %s\n", c->sfd, str);
 
+    if (c->batching) {
+        /* Nuke the partial output of this command only and queue the line
+         * behind the responses collected so far. */
+        c->msgused = c->batch_msgused;
+        c->iovused = c->batch_iovused;
+        c->msgbytes = c->batch_msgbytes;
+        c->msglist[c->msgused - 1].msg_iovlen = c->batch_iovlen;
+
+        len = strlen(str);
+        if ((len + 2) > (size_t)(c->wsize - c->wbatch)) {
+            str = "SERVER_ERROR output line too long";
+            len = strlen(str);
+        }
+
+        memcpy(c->wbuf + c->wbatch, str, len);
+        memcpy(c->wbuf + c->wbatch + len, "\r\n", 2);
+        if (add_iov(c, c->wbuf + c->wbatch, len + 2) != 0) {
+            c->batching = false;
+            conn_set_state(c, conn_closing);
+            return;
+        }
+        c->wbatch += len + 2;
+
+        conn_set_state(c, conn_mwrite);
+        c->write_and_go = conn_new_cmd;
+        return;
+    }
+
     /* Nuke a partial output... */
     c->msgcurr = 0;
     c->msgused = 0;
@@ -879,6 +1181,113 @@ static void out_string(conn *c, const char *str) {
     return;
 }
 
+/* wbuf kept free for the next line of a batch, see out_string() */
+#define BATCH_WBUF_RESERVE 128
+
+/*
+ * Returns true if rbuf holds all of the next ascii command, data block
+ * included, and the command only ever answers through out_string() or
+ * process_get_command(). Its response can then join a batch without the
+ * batch waiting on the network.
+ */
+static bool ascii_batch_ready(conn *c) {
+    static const struct {
+        const char *name;
+        size_t len;
+        bool storage;
+    } cmds[] = {
+        { "get", 3, false }, { "gets", 4, false }, { "bget", 4, false },
+        { "delete", 6, false }, { "incr", 4, false }, { "decr", 4, false },
+        { "touch", 5, false }, { "set", 3, true }, { "add", 3, true },
+        { "replace", 7, true }, { "append", 6, true }, { "prepend", 7, true },
+        { "cas", 3, true },
+    };
+    const char *tok[5];
+    int ntok = 0;
+    size_t i;
+
+    if (c->rbytes <= 0)
+        return false;
+    const char *el = (const char *)memchr(c->rcurr, '\n', c->rbytes);
+    if (el == NULL)
+        return false;
+
+    const char *p = c->rcurr;
+    while (p < el && ntok < 5) {
+        while (p < el && *p == ' ')
+            p++;
+        if (p == el || *p == '\r')
+            break;
+        tok[ntok++] = p;
+        while (p < el && *p != ' ' && *p != '\r')
+            p++;
+        if (ntok == 1) {
+            size_t len = p - tok[0];
+            for (i = 0; i < sizeof(cmds) / sizeof(cmds[0]); i++) {
+                if (cmds[i].len == len && memcmp(cmds[i].name, tok[0], len) == 0)
+                    break;
+            }
+            if (i == sizeof(cmds) / sizeof(cmds[0]))
+                return false;
+            if (!cmds[i].storage)
+                return true;
+        }
+    }
+
+    if (ntok < 5)
+        return ntok > 0;   /* malformed, answered without reading data */
+
+    /* the data block and its \r\n must be in rbuf as well */
+    long vlen = strtol(tok[4], NULL, 10);
+    if (vlen < 0)
+        return true;
+    return (el - c->rcurr) + 1 + vlen + 2 <= c->rbytes;
+}
+
+/*
+ * Called right after an ascii command has built its response. If the next
+ * command of a pipeline is already waiting in rbuf, the response is held
+ * back and the next command runs first, so a pipeline of small requests
+ * goes out in one sendmsg() instead of one per request. Later responses
+ * are appended to the iov list behind this one; conn_new_cmd flushes the
+ * lot through conn_mwrite once the pipeline runs dry or nreqs is used up.
+ */
+static void conn_batch_response(conn *c) {
+    int wbytes = 0;
+
+    if (settings.batch_responses == 0 || c->protocol != ascii_prot ||
+        IS_UDP(c->transport) || c->write_and_go != conn_new_cmd)
+        return;
+#ifdef NVM
+    /* An item is only safe from reuse until the thread's next lookup, see
+     * do_item_get(), so responses that send items go out right away */
+    if (c->ileft > 0)
+        return;
+#endif
+
+    if (c->state == conn_write) {
+        /* a lone line in wbuf, not on the iov list yet */
+        if (c->batching || c->write_and_free || c->wcurr != c->wbuf)
+            return;
+        wbytes = c->wbytes;
+    } else if (c->state != conn_mwrite) {
+        return;
+    }
+
+    if (c->iovused >= settings.batch_responses ||
+        c->wsize - c->wbatch - wbytes < BATCH_WBUF_RESERVE ||
+        !ascii_batch_ready(c))
+        return;
+
+    if (c->state == conn_write) {
+        if (add_iov(c, c->wbuf, wbytes) != 0)
+            return;
+        c->wbatch = wbytes;
+    }
+    c->batching = true;
+    conn_set_state(c, conn_new_cmd);
+}
+
 /*
  * Outputs a protocol-specific "out of memory" error. For ASCII clients,
  * this is equivalent to out_string().
@@ -898,6 +1307,85 @@ static void out_of_memory(conn *c, char *ascii_error) {
     }
 }
 
+/*
+ * Counts an access to an item for the NUMA stats, if the worker is pinned.
+ */
+static inline void numa_count_access(conn *c, item *it) {
+    if (c->thread->numa_node < 0)
+        return;
+    if (slabs_is_local(it, c->thread->numa_node)) {
+        THR_STATS_INCR(c, numa_local_accesses);
+    } else {
+        THR_STATS_INCR(c, numa_remote_accesses);
+    }
+}
+
+#ifdef NVM
+/* Copies at least this large go to NVM with streaming stores */
+#define NVM_NT_COPY_MIN 256
+
+/* Starts writing back the cache lines of a range, without waiting */
+static void nvm_flush(const void *p, size_t n) {
+    uintptr_t start = (uintptr_t)p & ~(uintptr_t)(CACHE_LINE_SIZE - 1);
+    if (n == 0)
+        return;
+    write_data_nowait((void *)start,
+                      ((uintptr_t)p + n - start + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE);
+}
+
+/*
+ * Copies part of a value into an NVM item. Large copies use streaming
+ * stores, which skip the cache and need no flush; the unaligned ends and
+ * small copies go through the cache and are flushed. Nothing waits here:
+ * nvm_persist_item() drains once the whole value is in.
+ */
+static void nvm_copy(char *dst, const char *src, size_t n) {
+#ifdef __SSE2__
+    if (n >= NVM_NT_COPY_MIN) {
+        size_t head = (16 - ((uintptr_t)dst & 15)) & 15;
+        memcpy(dst, src, head);
+        nvm_flush(dst, head);
+        dst += head;
+        src += head;
+        n -= head;
+        while (n >= 16) {
+            _mm_stream_si128((__m128i *)dst, _mm_loadu_si128((const __m128i *)src));
+            dst += 16;
+            src += 16;
+            n -= 16;
+        }
+    }
+#endif
+    memcpy(dst, src, n);
+    nvm_flush(dst, n);
+}
+
+/* Makes a fully read NVM item durable before it is linked: the header and
+ * key written by do_item_alloc() and the value ends the protocol code may
+ * have touched are flushed, then all outstanding writes are drained. The
+ * flushes and the drain are timed as LAT_PERSIST. */
+static void nvm_persist_item(item *it) {
+    if (!slabs_is_persistent(it))
+        return;
+    uint64_t t0 = latency_now();
+    nvm_flush(it, ITEM_data(it) - (char *)it);
+    nvm_flush(ITEM_data(it) + it->nbytes - 2, 2);
+    wait_writes();
+    stats_latency_record(LAT_PERSIST, t0);
+}
+
+/* Same for an item the server filled itself, by append, prepend or incr:
+ * its value went through the cache, so all of it is flushed. */
+static void nvm_persist_new_item(item *it) {
+    if (!slabs_is_persistent(it))
+        return;
+    uint64_t t0 = latency_now();
+    nvm_flush(it, ITEM_ntotal(it));
+    wait_writes();
+    stats_latency_record(LAT_PERSIST, t0);
+}
+#endif
+
 /*
  * we get here after reading the value in set/add/replace commands. The command
  * has been stored in c->cmd, and the item is ready in c->item.
@@ -909,13 +1397,15 @@ static void complete_nread_ascii(conn *c) {
     int comm = c->cmd;
     enum store_item_type ret = NOT_STORED;
 
-    pthread_mutex_lock(&c->thread->stats.mutex);
-    c->thread->stats.slab_stats[ITEM_clsid(it)].set_cmds++;
-    pthread_mutex_unlock(&c->thread->stats.mutex);
+    THR_STATS_INCR(c, slab_stats[ITEM_clsid(it)].set_cmds);
+    numa_count_access(c, it);
 
     if (strncmp(ITEM_data(it) + it->nbytes - 2, "\r\n", 2) != 0) {
         out_string(c, "CLIENT_ERROR bad data chunk");
     } else {
+#ifdef NVM
+      nvm_persist_item(it);
+#endif
       ret = store_item(it, comm, c);
 
 #ifdef ENABLE_DTRACE
@@ -1202,13 +1692,11 @@ static void complete_incr_bin(conn *c) {
                         "SERVER_ERROR Out of memory allocating new item");
             }
         } else {
-            pthread_mutex_lock(&c->thread->stats.mutex);
             if (c->cmd == PROTOCOL_BINARY_CMD_INCREMENT) {
-                c->thread->stats.incr_misses++;
+                THR_STATS_INCR(c, incr_misses);
             } else {
-                c->thread->stats.decr_misses++;
+                THR_STATS_INCR(c, decr_misses);
             }
-            pthread_mutex_unlock(&c->thread->stats.mutex);
 
             write_bin_error(c, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, NULL, 0);
         }
@@ -1226,15 +1714,17 @@ static void complete_update_bin(conn *c) {
 
     item *it = (item*)c->item;
 
-    pthread_mutex_lock(&c->thread->stats.mutex);
-    c->thread->stats.slab_stats[ITEM_clsid(it)].set_cmds++;
-    pthread_mutex_unlock(&c->thread->stats.mutex);
+    THR_STATS_INCR(c, slab_stats[ITEM_clsid(it)].set_cmds);
+    numa_count_access(c, it);
 
     /* We don't actually receive the trailing two characters in the bin
      * protocol, so we're going to just set them here */
     *(ITEM_data(it) + it->nbytes - 2) = '\r';
     *(ITEM_data(it) + it->nbytes - 1) = '\n';
 
+#ifdef NVM
+    nvm_persist_item(it);
+#endif
     ret = store_item(it, c->cmd, c);
 
 #ifdef ENABLE_DTRACE
@@ -1330,15 +1820,14 @@ static void process_bin_get_or_touch(conn *c) {
         uint32_t bodylen = sizeof(rsp->message.body) + (it->nbytes - 2);
 
         item_update(it);
-        pthread_mutex_lock(&c->thread->stats.mutex);
         if (should_touch) {
-            c->thread->stats.touch_cmds++;
-            c->thread->stats.slab_stats[ITEM_clsid(it)].touch_hits++;
+            THR_STATS_INCR(c, touch_cmds);
+            THR_STATS_INCR(c, slab_stats[ITEM_clsid(it)].touch_hits);
         } else {
-            c->thread->stats.get_cmds++;
-            c->thread->stats.slab_stats[ITEM_clsid(it)].get_hits++;
+            THR_STATS_INCR(c, get_cmds);
+            THR_STATS_INCR(c, slab_stats[ITEM_clsid(it)].get_hits);
         }
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        numa_count_access(c, it);
 
         if (should_touch) {
             MEMCACHED_COMMAND_TOUCH(c->sfd, ITEM_key(it), it->nkey,
@@ -1359,7 +1848,7 @@ static void process_bin_get_or_touch(conn *c) {
         rsp->message.header.response.cas = htonll(ITEM_get_cas(it));
 
         // add the flags
-        rsp->message.body.flags = htonl(strtoul(ITEM_suffix(it), NULL, 10));
+        rsp->message.body.flags = htonl(it->client_flags);
         add_iov(c, &rsp->message.body, sizeof(rsp->message.body));
 
         if (should_return_key) {
@@ -1383,15 +1872,13 @@ static void process_bin_get_or_touch(conn *c) {
         c->ileft = 1;
 #endif
     } else {
-        pthread_mutex_lock(&c->thread->stats.mutex);
         if (should_touch) {
-            c->thread->stats.touch_cmds++;
-            c->thread->stats.touch_misses++;
+            THR_STATS_INCR(c, touch_cmds);
+            THR_STATS_INCR(c, touch_misses);
         } else {
-            c->thread->stats.get_cmds++;
-            c->thread->stats.get_misses++;
+            THR_STATS_INCR(c, get_cmds);
+            THR_STATS_INCR(c, get_misses);
         }
-        pthread_mutex_unlock(&c->thread->stats.mutex);
 
         if (should_touch) {
             MEMCACHED_COMMAND_TOUCH(c->sfd, key, nkey, -1, 0);
@@ -1803,9 +2290,7 @@ static void process_bin_complete_sasl_auth(conn *c) {
     case SASL_OK:
         c->authenticated = true;
         write_bin_response(c, (void*)"Authenticated", 0, 0, strlen("Authenticated"));
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.auth_cmds++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_INCR(c, auth_cmds);
         break;
     case SASL_CONTINUE:
         add_bin_header(c, PROTOCOL_BINARY_RESPONSE_AUTH_CONTINUE, 0, 0, outlen);
@@ -1819,10 +2304,8 @@ static void process_bin_complete_sasl_auth(conn *c) {
         if (settings.verbose)
             fprintf(stderr, "Unknown sasl response:  %d\n", result);
         write_bin_error(c, PROTOCOL_BINARY_RESPONSE_AUTH_ERROR, NULL, 0);
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.auth_cmds++;
-        c->thread->stats.auth_errors++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_INCR(c, auth_cmds);
+        THR_STATS_INCR(c, auth_errors);
     }
 }
 
@@ -2206,14 +2689,12 @@ static void process_bin_flush(conn *c) {
     if (settings.use_cas) {
         settings.oldest_live = new_oldest - 1;
         if (settings.oldest_live <= current_time)
-            settings.oldest_cas = get_cas_id();
+            settings.oldest_cas = get_cas_id_fence();
     } else {
         settings.oldest_live = new_oldest;
     }
 
-    pthread_mutex_lock(&c->thread->stats.mutex);
-    c->thread->stats.flush_cmds++;
-    pthread_mutex_unlock(&c->thread->stats.mutex);
+    THR_STATS_INCR(c, flush_cmds);
 
     write_bin_response(c, NULL, 0, 0, 0);
 }
@@ -2246,9 +2727,7 @@ static void process_bin_delete(conn *c) {
         uint64_t cas = ntohll(req->message.header.request.cas);
         if (cas == 0 || cas == ITEM_get_cas(it)) {
             MEMCACHED_COMMAND_DELETE(c->sfd, ITEM_key(it), it->nkey);
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.slab_stats[ITEM_clsid(it)].delete_hits++;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THR_STATS_INCR(c, slab_stats[ITEM_clsid(it)].delete_hits);
             item_unlink(it);
             write_bin_response(c, NULL, 0, 0, 0);
         } else {
@@ -2261,13 +2740,14 @@ static void process_bin_delete(conn *c) {
 #endif
     } else {
         write_bin_error(c, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, NULL, 0);
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.delete_misses++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_INCR(c, delete_misses);
     }
 }
 
 static void complete_nread_binary(conn *c) {
+    uint64_t t0 = latency_now();
+    enum latency_op op = LAT_OPS;
+
     assert(c != NULL);
     assert(c->cmd >= 0);
 
@@ -2282,9 +2762,11 @@ static void complete_nread_binary(conn *c) {
         break;
     case bin_read_set_value:
         complete_update_bin(c);
+        op = LAT_SET;
         break;
     case bin_reading_get_key:
     case bin_reading_touch_key:
+        op = c->substate == bin_reading_touch_key ? LAT_TOUCH : LAT_GET;
         process_bin_get_or_touch(c);
         break;
     case bin_reading_stat:
@@ -2292,9 +2774,11 @@ static void complete_nread_binary(conn *c) {
         break;
     case bin_reading_del_header:
         process_bin_delete(c);
+        op = LAT_DELETE;
         break;
     case bin_reading_incr_header:
         complete_incr_bin(c);
+        op = LAT_INCR;
         break;
     case bin_read_flush_exptime:
         process_bin_flush(c);
@@ -2309,6 +2793,8 @@ static void complete_nread_binary(conn *c) {
         fprintf(stderr, "Not handling substate %d\n", c->substate);
         assert(0);
     }
+    if (op != LAT_OPS)
+        stats_latency_record(op, t0);
 }
 
 static void reset_cmd_handler(conn *c) {
@@ -2342,7 +2828,9 @@ static void complete_nread(conn *c) {
            || c->protocol == binary_prot);
 
     if (c->protocol == ascii_prot) {
+        uint64_t t0 = latency_now();
         complete_nread_ascii(c);
+        stats_latency_record(LAT_SET, t0);
     } else if (c->protocol == binary_prot) {
         complete_nread_binary(c);
     }
@@ -2374,24 +2862,18 @@ enum store_item_type do_store_item(item *it, int comm, conn *c, const uint32_t h
         if(old_it == NULL) {
             // LRU expired
             stored = NOT_FOUND;
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.cas_misses++;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THR_STATS_INCR(c, cas_misses);
         }
         else if (ITEM_get_cas(it) == ITEM_get_cas(old_it)) {
             // cas validates
             // it and old_it may belong to different classes.
             // I'm updating the stats for the one that's getting pushed out
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.slab_stats[ITEM_clsid(old_it)].cas_hits++;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THR_STATS_INCR(c, slab_stats[ITEM_clsid(old_it)].cas_hits);
 
             item_replace(old_it, it, hv);
             stored = STORED;
         } else {
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.slab_stats[ITEM_clsid(old_it)].cas_badval++;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THR_STATS_INCR(c, slab_stats[ITEM_clsid(old_it)].cas_badval);
 
             if(settings.verbose > 1) {
                 fprintf(stderr, "CAS:  failure: expected %llu, got %llu\n",
@@ -2418,16 +2900,20 @@ enum store_item_type do_store_item(item *it, int comm, conn *c, const uint32_t h
 
             if (stored == NOT_STORED) {
                 /* we have it and old_it here - alloc memory to hold both */
-                /* flags was already lost - so recover them from ITEM_suffix(it) */
+                /* flags was already lost - so recover them from old_it */
 
-                flags = (int) strtol(ITEM_suffix(old_it), (char **) NULL, 10);
+                flags = (int) old_it->client_flags;
 
                 new_it = do_item_alloc(key, it->nkey, flags, old_it->exptime, it->nbytes + old_it->nbytes - 2 /* CRLF */, hv);
 
                 if (new_it == NULL) {
                     /* SERVER_ERROR out of memory */
                     if (old_it != NULL)
+#ifndef NVM
                         do_item_remove(old_it);
+#else
+                        do_item_release(old_it);
+#endif
 
                     return NOT_STORED;
                 }
@@ -2442,6 +2928,11 @@ enum store_item_type do_store_item(item *it, int comm, conn *c, const uint32_t h
                     memcpy(ITEM_data(new_it), ITEM_data(it), it->nbytes);
                     memcpy(ITEM_data(new_it) + it->nbytes - 2 /* CRLF */, ITEM_data(old_it), old_it->nbytes);
                 }
+#ifdef NVM
+                nvm_persist_new_item(new_it);
+                /* the caller only frees its item if nothing was stored */
+                item_free(it);
+#endif
 
                 it = new_it;
             }
@@ -2457,18 +2948,18 @@ enum store_item_type do_store_item(item *it, int comm, conn *c, const uint32_t h
             c->cas = ITEM_get_cas(it);
             stored = STORED;
 #else
-            if (comm == NREAD_SET) {
-                do_item_set(it, hv);
-
-                c->cas = ITEM_get_cas(it);
-                stored = STORED;
-            } else { // comm == NREAD_ADD
-                assert(comm == NREAD_ADD);
-
+            if (comm == NREAD_ADD) {
                 if (do_item_add(it, hv)) {
                     c->cas = ITEM_get_cas(it);
                     stored = STORED;
                 }
+            } else {
+                /* set, or replace/append/prepend of old_it, which can't go
+                 * away while we hold its item lock */
+                do_item_set(it, hv);
+
+                c->cas = ITEM_get_cas(it);
+                stored = STORED;
             }
 #endif
         }
@@ -2480,8 +2971,10 @@ enum store_item_type do_store_item(item *it, int comm, conn *c, const uint32_t h
 #else
         do_item_release(old_it);
 #endif
+#ifndef NVM
     if (new_it != NULL)
         do_item_remove(new_it);
+#endif
 
     if (stored == STORED) {
         c->cas = ITEM_get_cas(it);
@@ -2501,6 +2994,35 @@ typedef struct token_s {
 
 #define MAX_TOKENS 8
 
+/*
+ * Returns the first ' ' or '\0' at or after p. With SSE2 this looks at 16
+ * bytes per step; the loads are aligned, so they never cross into a page
+ * past the end of the string.
+ */
+static inline char *token_end(char *p) {
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i nul = _mm_setzero_si128();
+    uintptr_t off = (uintptr_t)p & 15;
+    const __m128i *v = (const __m128i *)(p - off);
+    __m128i x = _mm_load_si128(v);
+    unsigned int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, space),
+                                                       _mm_cmpeq_epi8(x, nul)));
+    mask >>= off;
+    while (mask == 0) {
+        x = _mm_load_si128(++v);
+        mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, space),
+                                              _mm_cmpeq_epi8(x, nul)));
+        p = (char *)v;
+    }
+    return p + __builtin_ctz(mask);
+#else
+    while (*p != ' ' && *p != '\0')
+        p++;
+    return p;
+#endif
+}
+
 /*
  * Tokenize the command string by replacing whitespace with '\0' and update
  * the token array tokens with pointer to start of each token and length.
@@ -2521,41 +3043,33 @@ typedef struct token_s {
 static size_t tokenize_command(char *command, token_t *tokens, const size_t max_tokens) {
     char *s, *e;
     size_t ntokens = 0;
-    size_t len = strlen(command);
-    unsigned int i = 0;
 
     assert(command != NULL && tokens != NULL && max_tokens > 1);
 
-    s = e = command;
-    for (i = 0; i < len; i++) {
-        if (*e == ' ') {
-            if (s != e) {
-                tokens[ntokens].value = s;
-                tokens[ntokens].length = e - s;
-                ntokens++;
-                *e = '\0';
-                if (ntokens == max_tokens - 1) {
-                    e++;
-                    s = e; /* so we don't add an extra token */
-                    break;
-                }
-            }
-            s = e + 1;
-        }
-        e++;
-    }
+    s = command;
+    for (;;) {
+        while (*s == ' ')
+            s++;
+        if (*s == '\0' || ntokens == max_tokens - 1)
+            break;
 
-    if (s != e) {
+        e = token_end(s);
         tokens[ntokens].value = s;
         tokens[ntokens].length = e - s;
         ntokens++;
+        if (*e == '\0') {
+            s = e;
+            break;
+        }
+        *e = '\0';
+        s = e + 1;
     }
 
     /*
      * If we scanned the whole string, the terminal value pointer is null,
      * otherwise it is the first unprocessed character.
      */
-    tokens[ntokens].value =  *e == '\0' ? NULL : e;
+    tokens[ntokens].value =  *s == '\0' ? NULL : s;
     tokens[ntokens].length = 0;
     ntokens++;
 
@@ -2691,8 +3205,16 @@ static void server_stats(ADD_STAT add_stats, conn *c) {
     APPEND_STAT("touch_misses", "%llu", (unsigned long long)thread_stats.touch_misses);
     APPEND_STAT("auth_cmds", "%llu", (unsigned long long)thread_stats.auth_cmds);
     APPEND_STAT("auth_errors", "%llu", (unsigned long long)thread_stats.auth_errors);
+    if (settings.numa) {
+        APPEND_STAT("numa_local_accesses", "%llu", (unsigned long long)thread_stats.numa_local_accesses);
+        APPEND_STAT("numa_remote_accesses", "%llu", (unsigned long long)thread_stats.numa_remote_accesses);
+    }
     APPEND_STAT("bytes_read", "%llu", (unsigned long long)thread_stats.bytes_read);
     APPEND_STAT("bytes_written", "%llu", (unsigned long long)thread_stats.bytes_written);
+    if (settings.zerocopy_min > 0) {
+        APPEND_STAT("zerocopy_sends", "%llu", (unsigned long long)thread_stats.zerocopy_sends);
+        APPEND_STAT("zerocopy_copied", "%llu", (unsigned long long)thread_stats.zerocopy_copied);
+    }
     APPEND_STAT("limit_maxbytes", "%llu", (unsigned long long)settings.maxbytes);
     APPEND_STAT("accepting_conns", "%u", stats.accepting_conns);
     APPEND_STAT("listen_disabled_num", "%llu", (unsigned long long)stats.listen_disabled_num);
@@ -2759,6 +3281,27 @@ static void process_stat_settings(ADD_STAT add_stats, void *c) {
     APPEND_STAT("warm_lru_pct", "%d", settings.hot_lru_pct);
     APPEND_STAT("expirezero_does_not_evict", "%s", settings.expirezero_does_not_evict ? "yes" : "no");
     APPEND_STAT("free_list_size_limit", "%d", settings.free_list_size_limit);
+    APPEND_STAT("pool_dirs", "%s", settings.pool_dirs);
+    APPEND_STAT("slabs_pool_size", "%llu", (unsigned long long)settings.slabs_pool_size);
+#ifdef NVM
+    APPEND_STAT("ht_pool_size", "%llu", (unsigned long long)settings.ht_pool_size);
+#endif
+    APPEND_STAT("pool_stripe", "%s",
+                settings.pool_stripe == POOL_STRIPE_NUMA ? "numa" : "rr");
+    APPEND_STAT("numa", "%s", settings.numa ? "yes" : "no");
+    APPEND_STAT("hot_cache_size", "%llu", (unsigned long long)settings.hot_cache_size);
+    APPEND_STAT("dram_tier_size", "%llu", (unsigned long long)settings.dram_tier_size);
+    APPEND_STAT("admission", "%s",
+                settings.admission == ADMIT_TINYLFU ? "tinylfu" : "none");
+    APPEND_STAT("slab_alloc", "%s",
+                settings.slab_alloc == SLAB_ALLOC_FIFO ? "fifo" : "lifo");
+    APPEND_STAT("engine", "%s", settings.engine == ENGINE_LOG ? "log" : "slabs");
+    APPEND_STAT("zerocopy_min", "%d", settings.zerocopy_min);
+    APPEND_STAT("io_uring", "%s", settings.io_uring ? "yes" : "no");
+    APPEND_STAT("listen_mode", "%s",
+                settings.listen_mode == LISTEN_REUSEPORT_CPU ? "reuseport_cpu" :
+                settings.listen_mode == LISTEN_REUSEPORT ? "reuseport" : "dispatch");
+    APPEND_STAT("batch_responses", "%d", settings.batch_responses);
 }
 
 static void conn_to_str(const conn *c, char *buf) {
@@ -2919,6 +3462,8 @@ static void process_stat(conn *c, token_t *tokens, const size_t ntokens) {
         return ;
     } else if (strcmp(subcommand, "conns") == 0) {
         process_stats_conns(&append_stats, c);
+    } else if (strcmp(subcommand, "latency") == 0) {
+        stats_latency(&append_stats, c);
     } else {
         /* getting here means that the subcommand is either engine specific or
            is invalid. query the engine and see. */
@@ -2950,7 +3495,9 @@ static void process_stat(conn *c, token_t *tokens, const size_t ntokens) {
 static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens, bool return_cas) {
     char *key;
     size_t nkey;
-    int i = 0;
+    /* hits of the commands whose responses are being batched stay first */
+    int first = c->batching ? c->ileft : 0;
+    int i = first;
     item *it;
     token_t *key_token = &tokens[KEY_TOKEN];
     char *suffix;
@@ -2964,7 +3511,7 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
 
             if(nkey > KEY_MAX_LENGTH) {
                 out_string(c, "CLIENT_ERROR bad command line format");
-                while (i-- > 0) {
+                while (i-- > first) {
 #ifndef NVM
                     item_remove(*(c->ilist + i));
 #else
@@ -2998,19 +3545,20 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                 }
 
                 /*
-                 * Construct the response. Each hit adds three elements to the
+                 * Construct the response. Each hit adds four elements to the
                  * outgoing data list:
                  *   "VALUE "
                  *   key
-                 *   " " + flags + " " + data length + "\r\n" + data (with \r\n)
+                 *   " " + flags + " " + data length [+ " " + cas] + "\r\n"
+                 *   data (with \r\n)
+                 * The suffix is built here from the binary flags field into a
+                 * buffer from the thread's suffix cache, and released when
+                 * the response has been sent.
                  */
-
-                if (return_cas)
-                {
-                  MEMCACHED_COMMAND_GET(c->sfd, ITEM_key(it), it->nkey,
-                                        it->nbytes, ITEM_get_cas(it));
-                  /* Goofy mid-flight realloc. */
-                  if (i >= c->suffixsize) {
+                MEMCACHED_COMMAND_GET(c->sfd, ITEM_key(it), it->nkey,
+                                      it->nbytes, ITEM_get_cas(it));
+                /* Goofy mid-flight realloc. */
+                if (i >= c->suffixsize) {
                     char **new_suffix_list = (char **)realloc(c->suffixlist,
                                            sizeof(char *) * c->suffixsize * 2);
                     if (new_suffix_list) {
@@ -3027,61 +3575,53 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
 #endif
                         break;
                     }
-                  }
-
-                  suffix = (char*)cache_alloc(c->thread->suffix_cache);
-                  if (suffix == NULL) {
-                      STATS_LOCK();
-                      stats.malloc_fails++;
-                      STATS_UNLOCK();
-                      out_of_memory(c, "SERVER_ERROR out of memory making CAS suffix");
-#ifndef NVM
-                      item_remove(it);
-                      while (i-- > 0) {
-                          item_remove(*(c->ilist + i));
-                      }
-#else
-                      item_release(it);
-                      while (i-- > 0) {
-                          item_release(*(c->ilist + i));
-                      }
-#endif
-                      return;
-                  }
-                  *(c->suffixlist + i) = suffix;
-                  int suffix_len = snprintf(suffix, SUFFIX_SIZE,
-                                            " %llu\r\n",
-                                            (unsigned long long)ITEM_get_cas(it));
-                  if (add_iov(c, "VALUE ", 6) != 0 ||
-                      add_iov(c, ITEM_key(it), it->nkey) != 0 ||
-                      add_iov(c, ITEM_suffix(it), it->nsuffix - 2) != 0 ||
-                      add_iov(c, suffix, suffix_len) != 0 ||
-                      add_iov(c, ITEM_data(it), it->nbytes) != 0)
-                      {
+                }
+
+                suffix = (char*)cache_alloc(c->thread->suffix_cache);
+                if (suffix == NULL) {
+                    STATS_LOCK();
+                    stats.malloc_fails++;
+                    STATS_UNLOCK();
+                    out_of_memory(c, "SERVER_ERROR out of memory making VALUE suffix");
 #ifndef NVM
-                          item_remove(it);
+                    item_remove(it);
+                    while (i-- > first) {
+                        item_remove(*(c->ilist + i));
+                        cache_free(c->thread->suffix_cache, *(c->suffixlist + i));
+                    }
 #else
-                          item_release(it);
+                    item_release(it);
+                    while (i-- > first) {
+                        item_release(*(c->ilist + i));
+                        cache_free(c->thread->suffix_cache, *(c->suffixlist + i));
+                    }
 #endif
-                          break;
-                      }
+                    return;
+                }
+                *(c->suffixlist + i) = suffix;
+                int suffix_len;
+                if (return_cas) {
+                    suffix_len = snprintf(suffix, SUFFIX_SIZE,
+                                          " %u %d %llu\r\n",
+                                          it->client_flags, it->nbytes - 2,
+                                          (unsigned long long)ITEM_get_cas(it));
+                } else {
+                    suffix_len = snprintf(suffix, SUFFIX_SIZE, " %u %d\r\n",
+                                          it->client_flags, it->nbytes - 2);
                 }
-                else
-                {
-                  MEMCACHED_COMMAND_GET(c->sfd, ITEM_key(it), it->nkey,
-                                        it->nbytes, ITEM_get_cas(it));
-                  if (add_iov(c, "VALUE ", 6) != 0 ||
-                      add_iov(c, ITEM_key(it), it->nkey) != 0 ||
-                      add_iov(c, ITEM_suffix(it), it->nsuffix + it->nbytes) != 0)
-                      {
+                if (add_iov(c, "VALUE ", 6) != 0 ||
+                    add_iov(c, ITEM_key(it), it->nkey) != 0 ||
+                    add_iov(c, suffix, suffix_len) != 0 ||
+                    add_iov(c, ITEM_data(it), it->nbytes) != 0)
+                    {
+                        cache_free(c->thread->suffix_cache, suffix);
 #ifndef NVM
-                          item_remove(it);
+                        item_remove(it);
 #else
-                          item_release(it);
+                        item_release(it);
 #endif
-                          break;
-                      }
-                }
+                        break;
+                    }
 
 
                 if (settings.verbose > 1) {
@@ -3094,19 +3634,16 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
                 }
 
                 /* item_get() has incremented it->refcount for us */
-                pthread_mutex_lock(&c->thread->stats.mutex);
-                c->thread->stats.slab_stats[ITEM_clsid(it)].get_hits++;
-                c->thread->stats.get_cmds++;
-                pthread_mutex_unlock(&c->thread->stats.mutex);
+                THR_STATS_INCR(c, slab_stats[ITEM_clsid(it)].get_hits);
+                THR_STATS_INCR(c, get_cmds);
+                numa_count_access(c, it);
                 item_update(it);
                 *(c->ilist + i) = it;
                 i++;
 
             } else {
-                pthread_mutex_lock(&c->thread->stats.mutex);
-                c->thread->stats.get_misses++;
-                c->thread->stats.get_cmds++;
-                pthread_mutex_unlock(&c->thread->stats.mutex);
+                THR_STATS_INCR(c, get_misses);
+                THR_STATS_INCR(c, get_cmds);
                 MEMCACHED_COMMAND_GET(c->sfd, key, nkey, -1, 0);
             }
 
@@ -3126,10 +3663,8 @@ static inline void process_get_command(conn *c, token_t *tokens, size_t ntokens,
 
     c->icurr = c->ilist;
     c->ileft = i;
-    if (return_cas) {
-        c->suffixcurr = c->suffixlist;
-        c->suffixleft = i;
-    }
+    c->suffixcurr = c->suffixlist;
+    c->suffixleft = i;
 
     if (settings.verbose > 1)
         fprintf(stderr, ">%d END\n", c->sfd);
@@ -3267,10 +3802,8 @@ static void process_touch_command(conn *c, token_t *tokens, const size_t ntokens
     it = item_touch(key, nkey, realtime(exptime_int));
     if (it) {
         item_update(it);
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.touch_cmds++;
-        c->thread->stats.slab_stats[ITEM_clsid(it)].touch_hits++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_INCR(c, touch_cmds);
+        THR_STATS_INCR(c, slab_stats[ITEM_clsid(it)].touch_hits);
 
         out_string(c, "TOUCHED");
 #ifndef NVM
@@ -3279,10 +3812,8 @@ static void process_touch_command(conn *c, token_t *tokens, const size_t ntokens
         item_release(it);
 #endif
     } else {
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.touch_cmds++;
-        c->thread->stats.touch_misses++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_INCR(c, touch_cmds);
+        THR_STATS_INCR(c, touch_misses);
 
         out_string(c, "NOT_FOUND");
     }
@@ -3322,13 +3853,11 @@ static void process_arithmetic_command(conn *c, token_t *tokens, const size_t nt
         out_of_memory(c, "SERVER_ERROR out of memory");
         break;
     case DELTA_ITEM_NOT_FOUND:
-        pthread_mutex_lock(&c->thread->stats.mutex);
         if (incr) {
-            c->thread->stats.incr_misses++;
+            THR_STATS_INCR(c, incr_misses);
         } else {
-            c->thread->stats.decr_misses++;
+            THR_STATS_INCR(c, decr_misses);
         }
-        pthread_mutex_unlock(&c->thread->stats.mutex);
 
         out_string(c, "NOT_FOUND");
         break;
@@ -3364,18 +3893,29 @@ enum delta_result_type do_add_delta(conn *c, const char *key, const size_t nkey,
 
     /* Can't delta zero byte values. 2-byte are the "\r\n" */
     if (it->nbytes <= 2) {
+#ifdef NVM
+        do_item_release(it);
+#endif
         return NON_NUMERIC;
     }
 
     if (cas != NULL && *cas != 0 && ITEM_get_cas(it) != *cas) {
+#ifndef NVM
         do_item_remove(it);
+#else
+        do_item_release(it);
+#endif
         return DELTA_ITEM_CAS_MISMATCH;
     }
 
     ptr = ITEM_data(it);
 
     if (!safe_strtoull(ptr, &value)) {
+#ifndef NVM
         do_item_remove(it);
+#else
+        do_item_release(it);
+#endif
         return NON_NUMERIC;
     }
 
@@ -3391,16 +3931,33 @@ enum delta_result_type do_add_delta(conn *c, const char *key, const size_t nkey,
         MEMCACHED_COMMAND_DECR(c->sfd, ITEM_key(it), it->nkey, value);
     }
 
-    pthread_mutex_lock(&c->thread->stats.mutex);
     if (incr) {
-        c->thread->stats.slab_stats[ITEM_clsid(it)].incr_hits++;
+        THR_STATS_INCR(c, slab_stats[ITEM_clsid(it)].incr_hits);
     } else {
-        c->thread->stats.slab_stats[ITEM_clsid(it)].decr_hits++;
+        THR_STATS_INCR(c, slab_stats[ITEM_clsid(it)].decr_hits);
     }
-    pthread_mutex_unlock(&c->thread->stats.mutex);
 
     snprintf(buf, INCR_MAX_STORAGE_LEN, "%llu", (unsigned long long)value);
     res = strlen(buf);
+#ifdef NVM
+    /* Readers hold no reference, so the value is never rewritten in place:
+     * a new item is made durable and then swapped in for the old one. */
+    item *new_it = do_item_alloc(ITEM_key(it), it->nkey, it->client_flags, it->exptime, res + 2, hv);
+    if (new_it == NULL) {
+        do_item_release(it);
+        return EOM;
+    }
+    memcpy(ITEM_data(new_it), buf, res);
+    memcpy(ITEM_data(new_it) + res, "\r\n", 2);
+    nvm_persist_new_item(new_it);
+    do_item_set(new_it, hv);
+    do_item_release(it);
+
+    if (cas) {
+        *cas = ITEM_get_cas(new_it);    /* swap the incoming CAS value */
+    }
+    return OK;
+#else
     /* refcount == 2 means we are the only ones holding the item, and it is
      * linked. We hold the item's lock in this function, so refcount cannot
      * increase. */
@@ -3414,7 +3971,7 @@ enum delta_result_type do_add_delta(conn *c, const char *key, const size_t nkey,
         do_item_update(it);
     } else if (it->refcount > 1) {
         item *new_it;
-        new_it = do_item_alloc(ITEM_key(it), it->nkey, atoi(ITEM_suffix(it) + 1), it->exptime, res + 2, hv);
+        new_it = do_item_alloc(ITEM_key(it), it->nkey, it->client_flags, it->exptime, res + 2, hv);
         if (new_it == 0) {
             do_item_remove(it);
             return EOM;
@@ -3442,6 +3999,7 @@ enum delta_result_type do_add_delta(conn *c, const char *key, const size_t nkey,
     }
     do_item_remove(it);         /* release our reference */
     return OK;
+#endif
 }
 
 static void process_delete_command(conn *c, token_t *tokens, const size_t ntokens) {
@@ -3480,9 +4038,7 @@ static void process_delete_command(conn *c, token_t *tokens, const size_t ntoken
     if (it) {
         MEMCACHED_COMMAND_DELETE(c->sfd, ITEM_key(it), it->nkey);
 
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.slab_stats[ITEM_clsid(it)].delete_hits++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_INCR(c, slab_stats[ITEM_clsid(it)].delete_hits);
 
         item_unlink(it);
 #ifndef NVM
@@ -3492,9 +4048,7 @@ static void process_delete_command(conn *c, token_t *tokens, const size_t ntoken
 #endif
         out_string(c, "DELETED");
     } else {
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.delete_misses++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_INCR(c, delete_misses);
 
         out_string(c, "NOT_FOUND");
     }
@@ -3551,24 +4105,74 @@ static void process_command(conn *c, char *command) {
      * directly into it, then continue in nread_complete().
      */
 
-    c->msgcurr = 0;
-    c->msgused = 0;
-    c->iovused = 0;
-    if (add_msghdr(c) != 0) {
-        out_of_memory(c, "SERVER_ERROR out of memory preparing response");
-        return;
+    if (c->batching) {
+        /* Keep the responses collected so far; out_string() rewinds to
+         * here if this command fails half way. */
+        c->batch_msgused = c->msgused;
+        c->batch_iovused = c->iovused;
+        c->batch_msgbytes = c->msgbytes;
+        c->batch_iovlen = c->msglist[c->msgused - 1].msg_iovlen;
+    } else {
+        c->msgcurr = 0;
+        c->msgused = 0;
+        c->iovused = 0;
+        if (add_msghdr(c) != 0) {
+            out_of_memory(c, "SERVER_ERROR out of memory preparing response");
+            return;
+        }
     }
 
     ntokens = tokenize_command(command, tokens, MAX_TOKENS);
-    if (ntokens >= 3 &&
-        ((strcmp(tokens[COMMAND_TOKEN].value, "get") == 0) ||
-         (strcmp(tokens[COMMAND_TOKEN].value, "bget") == 0))) {
 
+    /* The hot commands go by length and first bytes, no strcmp() chain;
+     * the chain below only has the others. An empty line has only the
+     * terminal token, of length 0. */
+    const char *cmd = tokens[COMMAND_TOKEN].value;
+    switch (tokens[COMMAND_TOKEN].length) {
+    case 3:
+        if (ntokens >= 3 && memcmp(cmd, "get", 3) == 0) {
+            uint64_t t0 = latency_now();
+            process_get_command(c, tokens, ntokens, false);
+            stats_latency_record(LAT_GET, t0);
+            return;
+        }
+        if ((ntokens == 6 || ntokens == 7) && memcmp(cmd, "set", 3) == 0) {
+            process_update_command(c, tokens, ntokens, NREAD_SET, false);
+            return;
+        }
+        break;
+    case 4:
+        if (ntokens >= 3 && memcmp(cmd, "gets", 4) == 0) {
+            uint64_t t0 = latency_now();
+            process_get_command(c, tokens, ntokens, true);
+            stats_latency_record(LAT_GET, t0);
+            return;
+        }
+        if ((ntokens == 4 || ntokens == 5) && memcmp(cmd, "incr", 4) == 0) {
+            uint64_t t0 = latency_now();
+            process_arithmetic_command(c, tokens, ntokens, 1);
+            stats_latency_record(LAT_INCR, t0);
+            return;
+        }
+        break;
+    case 6:
+        if (ntokens >= 3 && ntokens <= 5 && memcmp(cmd, "delete", 6) == 0) {
+            uint64_t t0 = latency_now();
+            process_delete_command(c, tokens, ntokens);
+            stats_latency_record(LAT_DELETE, t0);
+            return;
+        }
+        break;
+    }
+
+    if (ntokens >= 3 && (strcmp(tokens[COMMAND_TOKEN].value, "bget") == 0)) {
+
+        uint64_t t0 = latency_now();
         process_get_command(c, tokens, ntokens, false);
+        stats_latency_record(LAT_GET, t0);
 
     } else if ((ntokens == 6 || ntokens == 7) &&
                ((strcmp(tokens[COMMAND_TOKEN].value, "add") == 0 && (comm = NREAD_ADD)) ||
-                (strcmp(tokens[COMMAND_TOKEN].value, "set") == 0 && (comm = NREAD_SET)) ||
                 (strcmp(tokens[COMMAND_TOKEN].value, "replace") == 0 && (comm = NREAD_REPLACE)) ||
                 (strcmp(tokens[COMMAND_TOKEN].value, "prepend") == 0 && (comm = NREAD_PREPEND)) ||
                 (strcmp(tokens[COMMAND_TOKEN].value, "append") == 0 && (comm = NREAD_APPEND)) )) {
@@ -3579,25 +4183,17 @@ static void process_command(conn *c, char *command) {
 
         process_update_command(c, tokens, ntokens, comm, true);
 
-    } else if ((ntokens == 4 || ntokens == 5) && (strcmp(tokens[COMMAND_TOKEN].value, "incr") == 0)) {
-
-        process_arithmetic_command(c, tokens, ntokens, 1);
-
-    } else if (ntokens >= 3 && (strcmp(tokens[COMMAND_TOKEN].value, "gets") == 0)) {
-
-        process_get_command(c, tokens, ntokens, true);
-
     } else if ((ntokens == 4 || ntokens == 5) && (strcmp(tokens[COMMAND_TOKEN].value, "decr") == 0)) {
 
+        uint64_t t0 = latency_now();
         process_arithmetic_command(c, tokens, ntokens, 0);
-
-    } else if (ntokens >= 3 && ntokens <= 5 && (strcmp(tokens[COMMAND_TOKEN].value, "delete") == 0)) {
-
-        process_delete_command(c, tokens, ntokens);
+        stats_latency_record(LAT_INCR, t0);
 
     } else if ((ntokens == 4 || ntokens == 5) && (strcmp(tokens[COMMAND_TOKEN].value, "touch") == 0)) {
 
+        uint64_t t0 = latency_now();
         process_touch_command(c, tokens, ntokens);
+        stats_latency_record(LAT_TOUCH, t0);
 
     } else if (ntokens >= 2 && (strcmp(tokens[COMMAND_TOKEN].value, "stats") == 0)) {
 
@@ -3609,9 +4205,7 @@ static void process_command(conn *c, char *command) {
 
         set_noreply_maybe(c, tokens, ntokens);
 
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.flush_cmds++;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_INCR(c, flush_cmds);
 
         if (!settings.flush_enabled) {
             // flush_all is not allowed but we log it on stats
@@ -3642,7 +4236,7 @@ static void process_command(conn *c, char *command) {
         if (settings.use_cas) {
             settings.oldest_live = new_oldest - 1;
             if (settings.oldest_live <= current_time)
-                settings.oldest_cas = get_cas_id();
+                settings.oldest_cas = get_cas_id_fence();
         } else {
             settings.oldest_live = new_oldest;
         }
@@ -3920,20 +4514,153 @@ static int try_read_command(conn *c) {
 /*
  * read a UDP request.
  */
-static enum try_read_result try_read_udp(conn *c) {
-    int res;
+#ifdef USE_UDP_MMSG
+/*
+ * UDP connections move datagrams in batches. try_read_udp() takes up to
+ * UDP_BATCH requests with one recvmmsg() and hands them to the state
+ * machine one at a time; transmit() copies each response datagram into a
+ * send ring that goes out with one sendmmsg() when it fills up, before the
+ * next recvmmsg() and when the connection yields. The memcached frame
+ * header is built and parsed exactly as for single datagrams.
+ */
+#define UDP_BATCH 16
+
+struct udp_batch {
+    struct mmsghdr rx[UDP_BATCH];
+    struct iovec rx_iov[UDP_BATCH];
+    struct sockaddr_in6 rx_addr[UDP_BATCH];
+    int rx_next;            /* next received datagram to process */
+    int rx_count;           /* datagrams the last recvmmsg() returned */
+    struct mmsghdr tx[UDP_BATCH];
+    struct iovec tx_iov[UDP_BATCH];
+    struct sockaddr_in6 tx_addr[UDP_BATCH];
+    int tx_count;           /* responses waiting for sendmmsg() */
+    char tx_buf[UDP_BATCH][UDP_MAX_PAYLOAD_SIZE];
+    char rx_buf[UDP_BATCH][UDP_READ_BUFFER_SIZE];
+};
 
-    assert(c != NULL);
+static struct udp_batch *udp_batch_new(void) {
+    struct udp_batch *b = (struct udp_batch *)calloc(1, sizeof(*b));
+    int i;
 
-    c->request_addr_size = sizeof(c->request_addr);
-    res = recvfrom(c->sfd, c->rbuf, c->rsize,
-                   0, (struct sockaddr *)&c->request_addr,
-                   &c->request_addr_size);
+    if (b == NULL)
+        return NULL;
+    for (i = 0; i < UDP_BATCH; i++) {
+        b->rx_iov[i].iov_base = b->rx_buf[i];
+        b->rx_iov[i].iov_len = UDP_READ_BUFFER_SIZE;
+        b->rx[i].msg_hdr.msg_iov = &b->rx_iov[i];
+        b->rx[i].msg_hdr.msg_iovlen = 1;
+        b->rx[i].msg_hdr.msg_name = &b->rx_addr[i];
+        b->tx_iov[i].iov_base = b->tx_buf[i];
+        b->tx[i].msg_hdr.msg_iov = &b->tx_iov[i];
+        b->tx[i].msg_hdr.msg_iovlen = 1;
+        b->tx[i].msg_hdr.msg_name = &b->tx_addr[i];
+    }
+    return b;
+}
+
+static inline bool udp_rx_pending(conn *c) {
+    return c->udp != NULL && c->udp->rx_next < c->udp->rx_count;
+}
+
+/*
+ * Sends the queued responses. Datagrams the socket refuses are dropped as
+ * if lost on the wire; clients already retry by request id.
+ */
+static void udp_flush(conn *c) {
+    struct udp_batch *b = c->udp;
+    int sent = 0;
+
+    while (sent < b->tx_count) {
+        int res = sendmmsg(c->sfd, b->tx + sent, b->tx_count - sent, 0);
+        if (res <= 0) {
+            if (settings.verbose > 0)
+                perror("Failed to write UDP responses");
+            break;
+        }
+        sent += res;
+    }
+    b->tx_count = 0;
+}
+
+/* transmit() for batched UDP: queues the datagrams of the response. */
+static enum transmit_result udp_queue(conn *c) {
+    struct udp_batch *b = c->udp;
+    size_t written = 0;
+
+    for (; c->msgcurr < c->msgused; c->msgcurr++) {
+        struct msghdr *m = &c->msglist[c->msgcurr];
+        size_t len = 0;
+        size_t i;
+
+        for (i = 0; i < m->msg_iovlen; i++)
+            len += m->msg_iov[i].iov_len;
+        if (len > sizeof(b->tx_buf[0])) {
+            /* add_iov() keeps datagrams below this; just in case */
+            if (sendmsg(c->sfd, m, 0) > 0)
+                written += len;
+            continue;
+        }
+
+        if (b->tx_count == UDP_BATCH)
+            udp_flush(c);
+        char *p = b->tx_buf[b->tx_count];
+        for (i = 0; i < m->msg_iovlen; i++) {
+            memcpy(p, m->msg_iov[i].iov_base, m->msg_iov[i].iov_len);
+            p += m->msg_iov[i].iov_len;
+        }
+        b->tx_iov[b->tx_count].iov_len = len;
+        memcpy(&b->tx_addr[b->tx_count], m->msg_name, m->msg_namelen);
+        b->tx[b->tx_count].msg_hdr.msg_namelen = m->msg_namelen;
+        b->tx_count++;
+        written += len;
+    }
+
+    THR_STATS_ADD(c, bytes_written, written);
+    return TRANSMIT_COMPLETE;
+}
+#endif
+
+static enum try_read_result try_read_udp(conn *c) {
+    int res;
+    unsigned char *buf;
+
+    assert(c != NULL);
+
+#ifdef USE_UDP_MMSG
+    if (c->udp != NULL) {
+        struct udp_batch *b = c->udp;
+        int i;
+
+        if (b->rx_next == b->rx_count) {
+            /* answer the last batch before asking for the next one */
+            if (b->tx_count > 0)
+                udp_flush(c);
+            for (i = 0; i < UDP_BATCH; i++)
+                b->rx[i].msg_hdr.msg_namelen = sizeof(b->rx_addr[i]);
+            res = recvmmsg(c->sfd, b->rx, UDP_BATCH, 0, NULL);
+            b->rx_next = 0;
+            b->rx_count = res > 0 ? res : 0;
+            if (res <= 0)
+                return READ_NO_DATA_RECEIVED;
+        }
+
+        i = b->rx_next++;
+        res = b->rx[i].msg_len;
+        memcpy(&c->request_addr, &b->rx_addr[i], b->rx[i].msg_hdr.msg_namelen);
+        c->request_addr_size = b->rx[i].msg_hdr.msg_namelen;
+        buf = (unsigned char *)b->rx_buf[i];
+    } else
+#endif
+    {
+        c->request_addr_size = sizeof(c->request_addr);
+        res = recvfrom(c->sfd, c->rbuf, c->rsize,
+                       0, (struct sockaddr *)&c->request_addr,
+                       &c->request_addr_size);
+        buf = (unsigned char *)c->rbuf;
+    }
     if (res > 8) {
-        unsigned char *buf = (unsigned char *)c->rbuf;
-        pthread_mutex_lock(&c->thread->stats.mutex);
-        c->thread->stats.bytes_read += res;
-        pthread_mutex_unlock(&c->thread->stats.mutex);
+        THR_STATS_ADD(c, bytes_read, res);
 
         /* Beginning of UDP packet is the request ID; save it. */
         c->request_id = buf[0] * 256 + buf[1];
@@ -3946,7 +4673,7 @@ static enum try_read_result try_read_udp(conn *c) {
 
         /* Don't care about any of the rest of the header. */
         res -= 8;
-        memmove(c->rbuf, c->rbuf + 8, res);
+        memmove(c->rbuf, buf + 8, res);
 
         c->rbytes = res;
         c->rcurr = c->rbuf;
@@ -3955,6 +4682,406 @@ static enum try_read_result try_read_udp(conn *c) {
     return READ_NO_DATA_RECEIVED;
 }
 
+#ifdef USE_IO_URING
+/*
+ * io_uring backend (-o io_uring).
+ *
+ * Each worker owns a ring whose completions are signalled through an eventfd
+ * that sits in the worker's libevent base next to the notify pipe, so new
+ * connections, UDP and listening sockets keep using libevent. A TCP
+ * connection handed to such a worker keeps a multishot receive posted at all
+ * times; received data lands in a buffer ring registered with the kernel and
+ * is queued on the connection until the state machine reads it. A connection
+ * that has UR_CONN_RX_BUFS queued has its receive cancelled until it has
+ * read them all, so one client can't take the buffers of the others.
+ * Responses go out as sendmsg requests that are submitted together once all
+ * completions of a wakeup have been handled.
+ */
+#define UR_ENTRIES 1024
+#define UR_RX_BUFS 512          /* must be a power of two */
+#define UR_RX_BUF_SIZE 4096
+#define UR_CONN_RX_BUFS 16      /* buffers one connection may queue */
+#define UR_BGID 0
+
+enum uring_op {
+    UR_OP_RECV = 0, UR_OP_SEND, UR_OP_WAKE, UR_OP_CANCEL
+};
+
+#define UR_DATA(c, op) \
+    (((uint64_t)(c)->ur_gen << 32) | ((uint64_t)(c)->sfd << 2) | (op))
+#define UR_DATA_OP(d) ((int)((d) & 3))
+#define UR_DATA_FD(d) ((int)(((d) >> 2) & 0x3fffffff))
+#define UR_DATA_GEN(d) ((uint32_t)((d) >> 32))
+
+struct thread_uring {
+    struct io_uring ring;
+    struct io_uring_buf_ring *rx_ring;
+    char *rx_bufs;
+    int rx_len[UR_RX_BUFS];
+    int rx_next[UR_RX_BUFS];
+    unsigned int rx_recycled;   /* buffers handed back since the last wakeup */
+    uint64_t *starved;          /* receives that ran out of buffers */
+    int nstarved;
+    int starved_size;
+    int efd;
+    struct event efd_event;
+};
+
+static void uring_event_handler(const int fd, const short which, void *arg);
+
+static struct io_uring_sqe *uring_sqe(struct thread_uring *u) {
+    struct io_uring_sqe *sqe = io_uring_get_sqe(&u->ring);
+
+    if (sqe == NULL) {
+        /* submission queue full, flush it early */
+        io_uring_submit(&u->ring);
+        sqe = io_uring_get_sqe(&u->ring);
+    }
+    assert(sqe != NULL);
+    return sqe;
+}
+
+static void uring_recycle(struct thread_uring *u, int bid) {
+    io_uring_buf_ring_add(u->rx_ring, u->rx_bufs + (size_t)bid * UR_RX_BUF_SIZE,
+                          UR_RX_BUF_SIZE, bid,
+                          io_uring_buf_ring_mask(UR_RX_BUFS), 0);
+    io_uring_buf_ring_advance(u->rx_ring, 1);
+    u->rx_recycled++;
+}
+
+int uring_thread_init(LIBEVENT_THREAD *me) {
+    struct thread_uring *u;
+    int i, ret;
+
+    u = (struct thread_uring *)calloc(1, sizeof(*u));
+    if (u == NULL)
+        return -1;
+    if (io_uring_queue_init(UR_ENTRIES, &u->ring, 0) != 0) {
+        free(u);
+        return -1;
+    }
+    u->rx_bufs = (char *)malloc((size_t)UR_RX_BUFS * UR_RX_BUF_SIZE);
+    u->rx_ring = io_uring_setup_buf_ring(&u->ring, UR_RX_BUFS, UR_BGID, 0, &ret);
+    u->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (u->rx_bufs == NULL || u->rx_ring == NULL || u->efd == -1 ||
+        io_uring_register_eventfd(&u->ring, u->efd) != 0) {
+        if (u->efd != -1)
+            close(u->efd);
+        free(u->rx_bufs);
+        io_uring_queue_exit(&u->ring);
+        free(u);
+        return -1;
+    }
+    for (i = 0; i < UR_RX_BUFS; i++)
+        uring_recycle(u, i);
+
+    event_set(&u->efd_event, u->efd, EV_READ | EV_PERSIST,
+              uring_event_handler, me);
+    event_base_set(me->base, &u->efd_event);
+    if (event_add(&u->efd_event, 0) == -1) {
+        close(u->efd);
+        free(u->rx_bufs);
+        io_uring_queue_exit(&u->ring);
+        free(u);
+        return -1;
+    }
+    me->uring = u;
+    return 0;
+}
+
+static void uring_arm_recv(conn *c) {
+    struct io_uring_sqe *sqe = uring_sqe(c->thread->uring);
+
+    io_uring_prep_recv_multishot(sqe, c->sfd, NULL, 0, 0);
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = UR_BGID;
+    io_uring_sqe_set_data64(sqe, UR_DATA(c, UR_OP_RECV));
+    c->ur_recv_armed = true;
+}
+
+/* Stops a connection's receive once it has queued its share of buffers.
+ * Buffers already on their way still come in. */
+static void uring_pause_recv(conn *c) {
+    struct io_uring_sqe *sqe = uring_sqe(c->thread->uring);
+
+    io_uring_prep_cancel64(sqe, UR_DATA(c, UR_OP_RECV), 0);
+    io_uring_sqe_set_data64(sqe, UR_DATA(c, UR_OP_CANCEL));
+    c->ur_recv_paused = true;
+}
+
+/* Posts the receive again once a paused connection has read its queue */
+static void uring_resume_recv(conn *c) {
+    if (c->ur_recv_paused && c->ur_nbufs == 0 && !c->ur_recv_armed) {
+        c->ur_recv_paused = false;
+        if (!c->ur_eof)
+            uring_arm_recv(c);
+    }
+}
+
+/* Drives the connection again on the next wakeup. */
+static void uring_wake(conn *c) {
+    struct io_uring_sqe *sqe;
+
+    if (c->ur_wake_pending)
+        return;
+    sqe = uring_sqe(c->thread->uring);
+    io_uring_prep_nop(sqe);
+    io_uring_sqe_set_data64(sqe, UR_DATA(c, UR_OP_WAKE));
+    c->ur_wake_pending = true;
+}
+
+/*
+ * Moves a TCP connection a worker just set up from libevent to the worker's
+ * ring. The socket goes back to blocking mode, as the ring would otherwise
+ * hand EAGAIN back instead of waiting for it.
+ */
+void conn_uring_attach(conn *c) {
+    struct thread_uring *u = c->thread->uring;
+    int flags;
+
+    if (c->transport != tcp_transport || c->state != conn_new_cmd)
+        return;
+    flags = fcntl(c->sfd, F_GETFL);
+    if (flags < 0 || fcntl(c->sfd, F_SETFL, flags & ~O_NONBLOCK) < 0)
+        return;
+
+    event_del(&c->event);
+    c->ev_flags = 0;
+#ifdef NVM
+    c->zerocopy = false;
+#endif
+    c->uring = true;
+    uring_arm_recv(c);
+    io_uring_submit(&u->ring);
+}
+
+/* Gives back what the connection still holds of the ring, before close(). */
+static void conn_uring_detach(conn *c) {
+    struct thread_uring *u = c->thread->uring;
+    struct io_uring_sqe *sqe;
+    int bid;
+
+    if (c->ur_recv_armed) {
+        sqe = uring_sqe(u);
+        io_uring_prep_cancel64(sqe, UR_DATA(c, UR_OP_RECV), 0);
+        io_uring_sqe_set_data64(sqe, UR_DATA(c, UR_OP_CANCEL));
+        c->ur_recv_armed = false;
+    }
+    while ((bid = c->ur_head) != -1) {
+        c->ur_head = u->rx_next[bid];
+        uring_recycle(u, bid);
+    }
+    c->ur_tail = -1;
+    c->ur_off = 0;
+    c->ur_nbufs = 0;
+    c->ur_recv_paused = false;
+}
+
+/* Asks the ring to drop a connection's sendmsg; its completion then
+ * finishes conn_close(), see uring_complete() */
+static void conn_uring_cancel_send(conn *c) {
+    struct io_uring_sqe *sqe = uring_sqe(c->thread->uring);
+
+    io_uring_prep_cancel64(sqe, UR_DATA(c, UR_OP_SEND), 0);
+    io_uring_sqe_set_data64(sqe, UR_DATA(c, UR_OP_CANCEL));
+    c->ur_closing = true;
+}
+
+/* read() for connections on the ring: takes from the received buffers. */
+static ssize_t uring_recv(conn *c, char *buf, size_t n) {
+    struct thread_uring *u = c->thread->uring;
+    size_t done = 0, len;
+    int bid;
+
+    while (done < n && (bid = c->ur_head) != -1) {
+        len = u->rx_len[bid] - c->ur_off;
+        if (len > n - done)
+            len = n - done;
+        memcpy(buf + done, u->rx_bufs + (size_t)bid * UR_RX_BUF_SIZE + c->ur_off, len);
+        done += len;
+        c->ur_off += len;
+        if (c->ur_off == u->rx_len[bid]) {
+            c->ur_head = u->rx_next[bid];
+            if (c->ur_head == -1)
+                c->ur_tail = -1;
+            c->ur_off = 0;
+            c->ur_nbufs--;
+            uring_recycle(u, bid);
+        }
+    }
+    uring_resume_recv(c);
+    if (done > 0)
+        return done;
+    if (c->ur_eof) {
+        if (c->ur_err == 0)
+            return 0;
+        errno = c->ur_err;
+        return -1;
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+/*
+ * sendmsg() for connections on the ring. Returns true with the result in res
+ * once the send queued by an earlier call has completed; otherwise queues m
+ * (unless already in flight) and returns false.
+ */
+static bool uring_send(conn *c, struct msghdr *m, ssize_t *res) {
+    struct io_uring_sqe *sqe;
+
+    if (c->ur_send_done) {
+        c->ur_send_done = false;
+        if (c->ur_send_res < 0) {
+            errno = -c->ur_send_res;
+            *res = -1;
+        } else {
+            *res = c->ur_send_res;
+        }
+        return true;
+    }
+    if (!c->ur_send_busy) {
+        sqe = uring_sqe(c->thread->uring);
+        io_uring_prep_sendmsg(sqe, c->sfd, m, MSG_NOSIGNAL);
+        io_uring_sqe_set_data64(sqe, UR_DATA(c, UR_OP_SEND));
+        c->ur_send_busy = true;
+    }
+    return false;
+}
+
+static void uring_starve(struct thread_uring *u, conn *c) {
+    if (u->nstarved == u->starved_size) {
+        int size = u->starved_size ? u->starved_size * 2 : 16;
+        uint64_t *s = (uint64_t *)realloc(u->starved, size * sizeof(uint64_t));
+        if (s == NULL) {
+            /* try again right away rather than forget the connection */
+            uring_arm_recv(c);
+            return;
+        }
+        u->starved = s;
+        u->starved_size = size;
+    }
+    u->starved[u->nstarved++] = UR_DATA(c, UR_OP_RECV);
+}
+
+static void uring_complete(struct thread_uring *u, struct io_uring_cqe *cqe) {
+    uint64_t data = io_uring_cqe_get_data64(cqe);
+    int op = UR_DATA_OP(data);
+    int fd = UR_DATA_FD(data);
+    int bid = -1;
+    conn *c = fd < max_fds ? conns[fd] : NULL;
+
+    if (op == UR_OP_RECV && (cqe->flags & IORING_CQE_F_BUFFER))
+        bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+    /* completions for a connection that has been closed since, or that
+     * only waits for its send before closing */
+    if (op == UR_OP_CANCEL || c == NULL || !c->uring ||
+        c->ur_gen != UR_DATA_GEN(data) || c->state == conn_closed ||
+        (c->ur_closing && op != UR_OP_SEND)) {
+        if (bid != -1)
+            uring_recycle(u, bid);
+        return;
+    }
+
+    switch (op) {
+    case UR_OP_RECV:
+        if (!(cqe->flags & IORING_CQE_F_MORE))
+            c->ur_recv_armed = false;
+        if (cqe->res > 0 && bid != -1) {
+            u->rx_len[bid] = cqe->res;
+            u->rx_next[bid] = -1;
+            if (c->ur_tail == -1)
+                c->ur_head = bid;
+            else
+                u->rx_next[c->ur_tail] = bid;
+            c->ur_tail = bid;
+            if (++c->ur_nbufs >= UR_CONN_RX_BUFS && c->ur_recv_armed &&
+                !c->ur_recv_paused)
+                uring_pause_recv(c);
+        } else {
+            if (bid != -1)
+                uring_recycle(u, bid);
+            if (cqe->res == -ENOBUFS) {
+                uring_starve(u, c);
+            } else if (cqe->res == -ECANCELED && c->ur_recv_paused) {
+                /* uring_pause_recv() took effect */
+            } else if (cqe->res <= 0) {
+                c->ur_eof = true;
+                c->ur_err = -cqe->res;
+            }
+        }
+        if (c->ur_recv_paused)
+            uring_resume_recv(c);
+        else if (!c->ur_recv_armed && !c->ur_eof && cqe->res != -ENOBUFS)
+            uring_arm_recv(c);
+        break;
+    case UR_OP_SEND:
+        c->ur_send_busy = false;
+        if (c->ur_closing) {
+            conn_close(c);
+            return;
+        }
+        c->ur_send_done = true;
+        c->ur_send_res = cqe->res;
+        break;
+    case UR_OP_WAKE:
+        c->ur_wake_pending = false;
+        break;
+    }
+
+    /* a connection waiting on its send stays parked, whatever it received */
+    if (!c->ur_send_busy)
+        drive_machine(c);
+}
+
+static void uring_event_handler(const int fd, const short which, void *arg) {
+    LIBEVENT_THREAD *me = (LIBEVENT_THREAD *)arg;
+    struct thread_uring *u = me->uring;
+    struct io_uring_cqe *cqe;
+    uint64_t count;
+    int i, n;
+
+    if (read(fd, &count, sizeof(count)) != sizeof(count) && errno != EAGAIN) {
+        if (settings.verbose > 0)
+            perror("Can't read io_uring eventfd");
+    }
+
+    u->rx_recycled = 0;
+    while (io_uring_peek_cqe(&u->ring, &cqe) == 0) {
+        uring_complete(u, cqe);
+        io_uring_cqe_seen(&u->ring, cqe);
+    }
+
+    /* buffers came back; receives that ran dry may go again */
+    if (u->rx_recycled > 0 && u->nstarved > 0) {
+        n = u->nstarved;
+        u->nstarved = 0;
+        for (i = 0; i < n; i++) {
+            conn *c = conns[UR_DATA_FD(u->starved[i])];
+            if (c != NULL && c->uring && c->state != conn_closed &&
+                c->ur_gen == UR_DATA_GEN(u->starved[i]) &&
+                !c->ur_recv_armed && !c->ur_recv_paused && !c->ur_eof)
+                uring_arm_recv(c);
+        }
+    }
+
+    /* everything the state machines queued goes out in one system call */
+    io_uring_submit(&u->ring);
+}
+#endif
+
+/*
+ * Reads from a connection's socket, or from what its ring received.
+ */
+static ssize_t conn_recv(conn *c, void *buf, size_t n) {
+#ifdef USE_IO_URING
+    if (c->uring)
+        return uring_recv(c, (char *)buf, n);
+#endif
+    return read(c->sfd, buf, n);
+}
+
 /*
  * read from network as much as we can, handle buffer overflow and connection
  * close.
@@ -4003,11 +5130,9 @@ static enum try_read_result try_read_network(conn *c) {
         }
 
         int avail = c->rsize - c->rbytes;
-        res = read(c->sfd, c->rbuf + c->rbytes, avail);
+        res = conn_recv(c, c->rbuf + c->rbytes, avail);
         if (res > 0) {
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.bytes_read += res;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THR_STATS_ADD(c, bytes_read, res);
             gotdata = READ_DATA_RECEIVED;
             c->rbytes += res;
             if (res == avail) {
@@ -4032,6 +5157,15 @@ static enum try_read_result try_read_network(conn *c) {
 static bool update_event(conn *c, const int new_flags) {
     assert(c != NULL);
 
+#ifdef USE_IO_URING
+    if (c->uring) {
+        /* The ring always has a receive posted, so only ask to be driven
+         * again when waiting to write or when input is already queued. */
+        if ((new_flags & EV_WRITE) || c->ur_head != -1 || c->ur_eof)
+            uring_wake(c);
+        return true;
+    }
+#endif
     struct event_base *base = c->event.ev_base;
     if (c->ev_flags == new_flags)
         return true;
@@ -4078,6 +5212,32 @@ void do_accept_new_conns(const bool do_accept) {
     }
 }
 
+#ifdef USE_ZEROCOPY
+/*
+ * Limits m to what the next sendmsg() should cover and returns its flags.
+ * A value of at least zerocopy_min bytes in NVM goes out alone with
+ * MSG_ZEROCOPY. The entries before it are copied, since they point into
+ * connection buffers that are rewritten as soon as the response is done.
+ */
+static int zerocopy_split(struct msghdr *m) {
+    size_t i;
+
+    for (i = 0; i < m->msg_iovlen; i++) {
+        if (m->msg_iov[i].iov_len >= (size_t)settings.zerocopy_min &&
+            slabs_is_persistent(m->msg_iov[i].iov_base))
+            break;
+    }
+    if (i == m->msg_iovlen)
+        return 0;
+    if (i == 0) {
+        m->msg_iovlen = 1;
+        return MSG_ZEROCOPY;
+    }
+    m->msg_iovlen = i;
+    return 0;
+}
+#endif
+
 /*
  * Transmit the next chunk of data from our list of msgbuf structures.
  *
@@ -4090,6 +5250,11 @@ void do_accept_new_conns(const bool do_accept) {
 static enum transmit_result transmit(conn *c) {
     assert(c != NULL);
 
+#ifdef USE_UDP_MMSG
+    if (c->udp != NULL)
+        return udp_queue(c);
+#endif
+
     if (c->msgcurr < c->msgused &&
             c->msglist[c->msgcurr].msg_iovlen == 0) {
         /* Finished writing the current msg; advance to the next. */
@@ -4098,12 +5263,51 @@ static enum transmit_result transmit(conn *c) {
     if (c->msgcurr < c->msgused) {
         ssize_t res;
         struct msghdr *m = &c->msglist[c->msgcurr];
+        int flags = 0;
+#ifdef USE_ZEROCOPY
+        size_t iovlen = m->msg_iovlen;
+        bool zc = c->zerocopy;
+
+#ifdef USE_IO_URING
+        /* the ring queues plain sends, whose completions never reach the
+         * error queue; conn_uring_attach() clears zerocopy as well */
+        if (c->uring)
+            zc = false;
+#endif
+        if (zc)
+            flags = zerocopy_split(m);
+        if (flags != 0 && c->zc_keep == NULL &&
+            (c->zc_keep = (struct zc_orphan *)malloc(sizeof(*c->zc_keep))) == NULL) {
+            /* nothing could follow the send past close; copy it instead */
+            flags = 0;
+        }
+#endif
 
-        res = sendmsg(c->sfd, m, 0);
+#ifdef USE_IO_URING
+        if (c->uring) {
+            if (!uring_send(c, m, &res))
+                return TRANSMIT_SOFT_ERROR;
+        } else
+#endif
+        res = sendmsg(c->sfd, m, flags);
+#ifdef USE_ZEROCOPY
+        if (res == -1 && flags != 0 && errno == ENOBUFS) {
+            /* no optmem left to track pinned pages; copy this one */
+            flags = 0;
+            res = sendmsg(c->sfd, m, 0);
+        }
+        m->msg_iovlen = iovlen;
+        if (res > 0 && flags != 0) {
+            /* the item stays in use until the completion is reaped,
+             * which conn_close() may leave to c->zc_keep */
+            c->zc_pending++;
+            item_zerocopy_issued();
+        }
+#endif
         if (res > 0) {
-            pthread_mutex_lock(&c->thread->stats.mutex);
-            c->thread->stats.bytes_written += res;
-            pthread_mutex_unlock(&c->thread->stats.mutex);
+            THR_STATS_ADD(c, bytes_written, res);
+            if (flags != 0)
+                THR_STATS_INCR(c, zerocopy_sends);
 
             /* We've written some of the data. Remove the completed
                iovec entries from the list of pending writes. */
@@ -4187,7 +5391,11 @@ static void drive_machine(conn *c) {
                 } else if (errno == EMFILE) {
                     if (settings.verbose > 0)
                         fprintf(stderr, "Too many open connections\n");
-                    accept_new_conns(false);
+                    if (is_listen_thread()) {
+                        accept_new_conns(false);
+                    } else {
+                        worker_listen_backoff(c);
+                    }
                     stop = true;
                 } else {
                     perror("accept()");
@@ -4211,6 +5419,11 @@ static void drive_machine(conn *c) {
                 STATS_LOCK();
                 stats.rejected_conns++;
                 STATS_UNLOCK();
+            } else if (!is_listen_thread()) {
+                /* our own SO_REUSEPORT listener, no handoff needed */
+                dispatch_conn_local(c->thread, sfd, conn_new_cmd,
+                                    EV_READ | EV_PERSIST, DATA_BUFFER_SIZE,
+                                    tcp_transport);
             } else {
                 dispatch_conn_new(sfd, conn_new_cmd, EV_READ | EV_PERSIST,
                                      DATA_BUFFER_SIZE, tcp_transport);
@@ -4220,6 +5433,13 @@ static void drive_machine(conn *c) {
             break;
 
         case conn_waiting:
+#ifdef USE_UDP_MMSG
+            if (udp_rx_pending(c)) {
+                /* already received; no read event will announce it */
+                conn_set_state(c, conn_read);
+                break;
+            }
+#endif
             if (!update_event(c, EV_READ | EV_PERSIST)) {
                 if (settings.verbose > 0)
                     fprintf(stderr, "Couldn't update event\n");
@@ -4253,12 +5473,20 @@ static void drive_machine(conn *c) {
         case conn_parse_cmd :
             if (try_read_command(c) == 0) {
                 /* wee need more data! */
-                conn_set_state(c, conn_waiting);
+                conn_set_state(c, c->batching ? conn_mwrite : conn_waiting);
+            } else {
+                conn_batch_response(c);
             }
 
             break;
 
         case conn_new_cmd:
+            if (c->batching && (nreqs <= 0 || !ascii_batch_ready(c))) {
+                /* send the collected responses before reading or yielding */
+                conn_set_state(c, conn_mwrite);
+                break;
+            }
+
             /* Only process nreqs at a time to avoid starving other
                connections */
 
@@ -4266,9 +5494,7 @@ static void drive_machine(conn *c) {
             if (nreqs >= 0) {
                 reset_cmd_handler(c);
             } else {
-                pthread_mutex_lock(&c->thread->stats.mutex);
-                c->thread->stats.conn_yields++;
-                pthread_mutex_unlock(&c->thread->stats.mutex);
+                THR_STATS_INCR(c, conn_yields);
                 if (c->rbytes > 0) {
                     /* We have already read in data into the input buffer,
                        so libevent will most likely not signal read events
@@ -4283,6 +5509,27 @@ static void drive_machine(conn *c) {
                         break;
                     }
                 }
+#ifdef USE_IO_URING
+                else if (c->uring && c->ur_head != -1) {
+                    /* the rest of the input is queued on the ring, where
+                       no read event will announce it again */
+                    uring_wake(c);
+                }
+#endif
+#ifdef USE_UDP_MMSG
+                if (c->udp != NULL) {
+                    if (c->udp->tx_count > 0)
+                        udp_flush(c);
+                    /* same hack as above for datagrams left in the ring */
+                    if (udp_rx_pending(c) &&
+                        !update_event(c, EV_WRITE | EV_PERSIST)) {
+                        if (settings.verbose > 0)
+                            fprintf(stderr, "Couldn't update event\n");
+                        conn_set_state(c, conn_closing);
+                        break;
+                    }
+                }
+#endif
                 stop = true;
             }
             break;
@@ -4290,6 +5537,7 @@ static void drive_machine(conn *c) {
         case conn_nread:
             if (c->rlbytes == 0) {
                 complete_nread(c);
+                conn_batch_response(c);
                 break;
             }
 
@@ -4305,6 +5553,11 @@ static void drive_machine(conn *c) {
             /* first check if we have leftovers in the conn_read buffer */
             if (c->rbytes > 0) {
                 int tocopy = c->rbytes > c->rlbytes ? c->rlbytes : c->rbytes;
+#ifdef NVM
+                if (slabs_is_persistent(c->ritem)) {
+                    nvm_copy(c->ritem, c->rcurr, tocopy);
+                } else
+#endif
                 if (c->ritem != c->rcurr) {
                     memmove(c->ritem, c->rcurr, tocopy);
                 }
@@ -4318,14 +5571,17 @@ static void drive_machine(conn *c) {
             }
 
             /*  now try reading from the socket */
-            res = read(c->sfd, c->ritem, c->rlbytes);
+            res = conn_recv(c, c->ritem, c->rlbytes);
             if (res > 0) {
-                pthread_mutex_lock(&c->thread->stats.mutex);
-                c->thread->stats.bytes_read += res;
-                pthread_mutex_unlock(&c->thread->stats.mutex);
+                THR_STATS_ADD(c, bytes_read, res);
                 if (c->rcurr == c->ritem) {
                     c->rcurr += res;
                 }
+#ifdef NVM
+                /* the kernel copied through the cache */
+                if (slabs_is_persistent(c->ritem))
+                    nvm_flush(c->ritem, res);
+#endif
                 c->ritem += res;
                 c->rlbytes -= res;
                 break;
@@ -4373,11 +5629,9 @@ static void drive_machine(conn *c) {
             }
 
             /*  now try reading from the socket */
-            res = read(c->sfd, c->rbuf, c->rsize > c->sbytes ? c->sbytes : c->rsize);
+            res = conn_recv(c, c->rbuf, c->rsize > c->sbytes ? c->sbytes : c->rsize);
             if (res > 0) {
-                pthread_mutex_lock(&c->thread->stats.mutex);
-                c->thread->stats.bytes_read += res;
-                pthread_mutex_unlock(&c->thread->stats.mutex);
+                THR_STATS_ADD(c, bytes_read, res);
                 c->sbytes -= res;
                 break;
             }
@@ -4428,9 +5682,13 @@ static void drive_machine(conn *c) {
             switch (transmit(c)) {
             case TRANSMIT_COMPLETE:
                 if (c->state == conn_mwrite) {
+                    bool batched = c->batching;
                     conn_release_items(c);
+                    c->batching = false;
+                    c->wbatch = 0;
                     /* XXX:  I don't know why this wasn't the general case */
-                    if(c->protocol == binary_prot) {
+                    /* (a batch may end in a failed set that swallows data) */
+                    if(c->protocol == binary_prot || batched) {
                         conn_set_state(c, c->write_and_go);
                     } else {
                         conn_set_state(c, conn_new_cmd);
@@ -4496,6 +5754,14 @@ void event_handler(const int fd, const short which, void *arg) {
         return;
     }
 
+#ifdef USE_ZEROCOPY
+    /* completions show up as POLLERR, which libevent reports as readable */
+    if (c->zc_pending > 0)
+        conn_zerocopy_reap(c);
+    if (zc_orphans != NULL)
+        zerocopy_reap_orphans();
+#endif
+
     drive_machine(c);
 
     /* wait for next event */
@@ -4577,12 +5843,18 @@ static int server_socket(const char *interface,
     int error;
     int success = 0;
     int flags =1;
+    int listener, listeners = 1;
 
     hints.ai_socktype = IS_UDP(transport) ? SOCK_DGRAM : SOCK_STREAM;
 
     if (port == -1) {
         port = 0;
     }
+    /* One listener per worker, all bound to the same port; an ephemeral
+     * port can't be shared that way, so it keeps the dispatcher. */
+    if (settings.listen_mode != LISTEN_DISPATCH && !IS_UDP(transport) && port != 0) {
+        listeners = settings.num_threads;
+    }
     snprintf(port_buf, sizeof(port_buf), "%d", port);
     error= getaddrinfo(interface, port_buf, &hints, &ai);
     if (error != 0) {
@@ -4593,6 +5865,7 @@ static int server_socket(const char *interface,
         return 1;
     }
 
+    for (listener = 0; listener < listeners; listener++)
     for (next= ai; next; next= next->ai_next) {
         conn *listen_conn_add;
         if ((sfd = new_socket(next)) == -1) {
@@ -4619,6 +5892,15 @@ static int server_socket(const char *interface,
 #endif
 
         setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, (void *)&flags, sizeof(flags));
+#ifdef SO_REUSEPORT
+        if (listeners > 1 &&
+            setsockopt(sfd, SOL_SOCKET, SO_REUSEPORT, (void *)&flags, sizeof(flags)) != 0) {
+            perror("setsockopt(SO_REUSEPORT)");
+            close(sfd);
+            freeaddrinfo(ai);
+            return 1;
+        }
+#endif
         if (IS_UDP(transport)) {
             maximize_sndbuf(sfd);
         } else {
@@ -4652,7 +5934,7 @@ static int server_socket(const char *interface,
                 freeaddrinfo(ai);
                 return 1;
             }
-            if (portnumber_file != NULL &&
+            if (portnumber_file != NULL && listener == 0 &&
                 (next->ai_addr->sa_family == AF_INET ||
                  next->ai_addr->sa_family == AF_INET6)) {
                 union {
@@ -4691,6 +5973,11 @@ static int server_socket(const char *interface,
                                   EV_READ | EV_PERSIST,
                                   UDP_READ_BUFFER_SIZE, transport);
             }
+        } else if (listeners > 1) {
+            /* Worker i gets listener i of every address, so each worker
+             * listens on every family */
+            dispatch_conn_thread(listener, sfd, conn_listening,
+                                 EV_READ | EV_PERSIST, 1, transport);
         } else {
             if (!(listen_conn_add = conn_new(sfd, conn_listening,
                                              EV_READ | EV_PERSIST, 1,
@@ -4966,6 +6253,55 @@ static void usage(void) {
            "                (requires lru_maintainer)\n"
            "              - free_list_size_limit: Size limit after which we should try to switch\n"
            "                free lists.\n"
+           "              - pool_dirs: ':' separated directories to create the persistent\n"
+           "                pools in, one slab pool per entry (default: /tmp). Slab\n"
+           "                pages are striped across them. The first also keeps\n"
+           "                cas_high, which lets CAS ids grow across restarts.\n"
+           "              - slabs_pool_size: Size of each slab pool in megabytes\n"
+           "                (default: 2048)\n"
+           "              - ht_pool_size: Size of the hash table pool in megabytes\n"
+           "                (default: 1024)\n"
+           "              - pool_stripe: How slab pages are spread over the pools.\n"
+           "                options: rr (round-robin, default), numa (pool of the\n"
+           "                allocating thread's node). -L preallocates from the\n"
+           "                first pool only, so it needs a single pool_dirs entry.\n"
+           "              - numa: Pin each worker to a NUMA node, keep its slab table\n"
+           "                and free chunks on that node and stripe slab pages by\n"
+           "                node (implies pool_stripe=numa). Give one pool_dirs entry\n"
+           "                per online node, in node id order.\n"
+           "              - hot_cache_size: Megabytes of DRAM to keep copies of\n"
+           "                frequently read NVM items in (default: 0, disabled)\n"
+           "              - dram_tier_size: Megabytes of DRAM slab pages new items are\n"
+           "                stored in before a background thread moves them to NVM\n"
+           "                once they turn cold (default: 0, disabled). Items still\n"
+           "                in DRAM are lost on a restart.\n"
+           "              - admission: Which new items may evict from a full slab\n"
+           "                class. options: none (all, default), tinylfu (only\n"
+           "                items accessed more often than the eviction victim;\n"
+           "                rejected stores get the out of memory error and are\n"
+           "                counted in admission_rejects)\n"
+           "              - slab_alloc: Order free NVM chunks are reused in.\n"
+           "                options: lifo (most recently freed first, default),\n"
+           "                fifo (least recently freed first, spreads wear)\n"
+           "              - engine: How items are stored in NVM. options: slabs\n"
+           "                (slab classes, default), log (appended to per-thread\n"
+           "                log segments that a background thread compacts; not\n"
+           "                with hot_cache_size, dram_tier_size or admission)\n"
+           "              - zerocopy_min: Send NVM values of at least this many\n"
+           "                bytes to TCP clients with MSG_ZEROCOPY (default: 0,\n"
+           "                disabled; Linux 4.14 and later)\n"
+           "              - io_uring: Serve TCP connections through a per-worker\n"
+           "                io_uring instead of libevent (needs --enable-io-uring\n"
+           "                and Linux 6.0 or later)\n"
+           "              - listen_mode: Who accepts TCP connections. options:\n"
+           "                dispatch (main thread, default), reuseport (each\n"
+           "                worker on its own SO_REUSEPORT socket), reuseport_cpu\n"
+           "                (same, with worker N pinned to CPU N and taking the\n"
+           "                connections whose packets arrive there; not with numa)\n"
+           "              - batch_responses: Most iovecs of responses to pipelined\n"
+           "                ascii commands collected into one send (default: 0,\n"
+           "                each response is sent on its own). Get hits are sent\n"
+           "                right away, as their items may only be held briefly\n"
            );
     return;
 }
@@ -5174,6 +6510,16 @@ static bool sanitycheck(void) {
     return true;
 }
 
+/* Parses a size option given in megabytes. Rejects anything that isn't a
+ * plain non-negative number or would overflow once scaled to bytes. */
+static bool safe_strtosize_mb(const char *str, size_t *out) {
+    uint64_t mb;
+    if (str == NULL || !safe_strtoull(str, &mb) || mb > SIZE_MAX / (1024 * 1024))
+        return false;
+    *out = (size_t)mb * 1024 * 1024;
+    return true;
+}
+
 int main (int argc, char **argv) {
     int c;
     bool lock_memory = false;
@@ -5217,7 +6563,21 @@ int main (int argc, char **argv) {
         HOT_LRU_PCT,
         WARM_LRU_PCT,
         NOEXP_NOEVICT,
-        FREE_LIST_LIMIT
+        FREE_LIST_LIMIT,
+        POOL_DIRS,
+        SLABS_POOL_SIZE_MB,
+        HT_POOL_SIZE_MB,
+        POOL_STRIPE,
+        NUMA,
+        HOT_CACHE_SIZE_MB,
+        DRAM_TIER_SIZE_MB,
+        ADMISSION,
+        SLAB_ALLOC,
+        ENGINE,
+        ZEROCOPY_MIN,
+        IO_URING,
+        LISTEN_MODE,
+        BATCH_RESPONSES
     };
     char *const subopts_tokens[] = {
         [MAXCONNS_FAST] = "maxconns_fast",
@@ -5234,6 +6594,20 @@ int main (int argc, char **argv) {
         [WARM_LRU_PCT] = "warm_lru_pct",
         [NOEXP_NOEVICT] = "expirezero_does_not_evict",
         [FREE_LIST_LIMIT] = "free_list_size_limit",
+        [POOL_DIRS] = "pool_dirs",
+        [SLABS_POOL_SIZE_MB] = "slabs_pool_size",
+        [HT_POOL_SIZE_MB] = "ht_pool_size",
+        [POOL_STRIPE] = "pool_stripe",
+        [NUMA] = "numa",
+        [HOT_CACHE_SIZE_MB] = "hot_cache_size",
+        [DRAM_TIER_SIZE_MB] = "dram_tier_size",
+        [ADMISSION] = "admission",
+        [SLAB_ALLOC] = "slab_alloc",
+        [ENGINE] = "engine",
+        [ZEROCOPY_MIN] = "zerocopy_min",
+        [IO_URING] = "io_uring",
+        [LISTEN_MODE] = "listen_mode",
+        [BATCH_RESPONSES] = "batch_responses",
         NULL
     };
 
@@ -5594,6 +6968,161 @@ int main (int argc, char **argv) {
                 }
                 settings.free_list_size_limit = atoi(subopts_value);
                 break;
+            case POOL_DIRS:
+                if (subopts_value == NULL || *subopts_value == '\0') {
+                    fprintf(stderr, "Missing pool_dirs argument\n");
+                    return 1;
+                }
+                settings.pool_dirs = strdup(subopts_value);
+                break;
+            case SLABS_POOL_SIZE_MB:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing numeric argument for slabs_pool_size\n");
+                    return 1;
+                }
+                if (!safe_strtosize_mb(subopts_value, &settings.slabs_pool_size)) {
+                    fprintf(stderr, "Invalid slabs_pool_size value: %s\n", subopts_value);
+                    return 1;
+                }
+                if (settings.slabs_pool_size < PMEMOBJ_MIN_POOL) {
+                    fprintf(stderr, "slabs_pool_size is too small\n");
+                    return 1;
+                }
+                break;
+            case HT_POOL_SIZE_MB:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing numeric argument for ht_pool_size\n");
+                    return 1;
+                }
+                if (!safe_strtosize_mb(subopts_value, &settings.ht_pool_size)) {
+                    fprintf(stderr, "Invalid ht_pool_size value: %s\n", subopts_value);
+                    return 1;
+                }
+                if (settings.ht_pool_size < PMEMOBJ_MIN_POOL) {
+                    fprintf(stderr, "ht_pool_size is too small\n");
+                    return 1;
+                }
+                break;
+            case POOL_STRIPE:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing pool_stripe argument\n");
+                    return 1;
+                };
+                if (strcmp(subopts_value, "rr") == 0) {
+                    settings.pool_stripe = POOL_STRIPE_RR;
+                } else if (strcmp(subopts_value, "numa") == 0) {
+                    settings.pool_stripe = POOL_STRIPE_NUMA;
+                } else {
+                    fprintf(stderr, "Unknown pool_stripe option (rr, numa)\n");
+                    return 1;
+                }
+                break;
+            case NUMA:
+                settings.numa = true;
+                break;
+            case HOT_CACHE_SIZE_MB:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing numeric argument for hot_cache_size\n");
+                    return 1;
+                }
+                if (!safe_strtosize_mb(subopts_value, &settings.hot_cache_size)) {
+                    fprintf(stderr, "Invalid hot_cache_size value: %s\n", subopts_value);
+                    return 1;
+                }
+                break;
+            case DRAM_TIER_SIZE_MB:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing numeric argument for dram_tier_size\n");
+                    return 1;
+                }
+                if (!safe_strtosize_mb(subopts_value, &settings.dram_tier_size)) {
+                    fprintf(stderr, "Invalid dram_tier_size value: %s\n", subopts_value);
+                    return 1;
+                }
+                break;
+            case ADMISSION:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing admission argument\n");
+                    return 1;
+                };
+                if (strcmp(subopts_value, "none") == 0) {
+                    settings.admission = ADMIT_ALL;
+                } else if (strcmp(subopts_value, "tinylfu") == 0) {
+                    settings.admission = ADMIT_TINYLFU;
+                } else {
+                    fprintf(stderr, "Unknown admission option (none, tinylfu)\n");
+                    return 1;
+                }
+                break;
+            case SLAB_ALLOC:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing slab_alloc argument\n");
+                    return 1;
+                };
+                if (strcmp(subopts_value, "lifo") == 0) {
+                    settings.slab_alloc = SLAB_ALLOC_LIFO;
+                } else if (strcmp(subopts_value, "fifo") == 0) {
+                    settings.slab_alloc = SLAB_ALLOC_FIFO;
+                } else {
+                    fprintf(stderr, "Unknown slab_alloc option (lifo, fifo)\n");
+                    return 1;
+                }
+                break;
+            case ENGINE:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing engine argument\n");
+                    return 1;
+                };
+                if (strcmp(subopts_value, "slabs") == 0) {
+                    settings.engine = ENGINE_SLABS;
+                } else if (strcmp(subopts_value, "log") == 0) {
+                    settings.engine = ENGINE_LOG;
+                } else {
+                    fprintf(stderr, "Unknown engine option (slabs, log)\n");
+                    return 1;
+                }
+                break;
+            case ZEROCOPY_MIN:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing numeric argument for zerocopy_min\n");
+                    return 1;
+                }
+                settings.zerocopy_min = atoi(subopts_value);
+                if (settings.zerocopy_min < 0) {
+                    fprintf(stderr, "zerocopy_min must not be negative\n");
+                    return 1;
+                }
+                break;
+            case IO_URING:
+                settings.io_uring = true;
+                break;
+            case LISTEN_MODE:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing listen_mode argument\n");
+                    return 1;
+                };
+                if (strcmp(subopts_value, "dispatch") == 0) {
+                    settings.listen_mode = LISTEN_DISPATCH;
+                } else if (strcmp(subopts_value, "reuseport") == 0) {
+                    settings.listen_mode = LISTEN_REUSEPORT;
+                } else if (strcmp(subopts_value, "reuseport_cpu") == 0) {
+                    settings.listen_mode = LISTEN_REUSEPORT_CPU;
+                } else {
+                    fprintf(stderr, "Unknown listen_mode option (dispatch, reuseport, reuseport_cpu)\n");
+                    return 1;
+                }
+                break;
+            case BATCH_RESPONSES:
+                if (subopts_value == NULL) {
+                    fprintf(stderr, "Missing numeric argument for batch_responses\n");
+                    return 1;
+                }
+                settings.batch_responses = atoi(subopts_value);
+                if (settings.batch_responses < 0) {
+                    fprintf(stderr, "batch_responses must not be negative\n");
+                    return 1;
+                }
+                break;
             default:
                 printf("Illegal suboption \"%s\"\n", subopts_value);
                 return 1;
@@ -5607,6 +7136,51 @@ int main (int argc, char **argv) {
         }
     }
 
+    if (settings.numa) {
+        settings.pool_stripe = POOL_STRIPE_NUMA;
+    }
+
+    /* The preallocated chunk is carved out of the first pool only */
+    if (preallocate && (strchr(settings.pool_dirs, ':') != NULL ||
+                        settings.pool_stripe == POOL_STRIPE_NUMA)) {
+        fprintf(stderr, "-L cannot be combined with several pool_dirs, "
+                "pool_stripe=numa or numa\n");
+        exit(EX_USAGE);
+    }
+
+    /* These all pick victims through the slab clock */
+    if (settings.engine == ENGINE_LOG &&
+        (settings.hot_cache_size != 0 || settings.dram_tier_size != 0 ||
+         settings.admission != ADMIT_ALL)) {
+        fprintf(stderr, "engine=log cannot be combined with hot_cache_size, "
+                "dram_tier_size or admission\n");
+        exit(EX_USAGE);
+    }
+
+    if (settings.listen_mode == LISTEN_REUSEPORT_CPU && settings.numa) {
+        fprintf(stderr, "listen_mode=reuseport_cpu cannot be combined with numa\n");
+        exit(EX_USAGE);
+    }
+#ifndef SO_REUSEPORT
+    if (settings.listen_mode != LISTEN_DISPATCH) {
+        fprintf(stderr, "SO_REUSEPORT is not supported on this platform\n");
+        exit(EX_USAGE);
+    }
+#endif
+
+#ifndef USE_ZEROCOPY
+    if (settings.zerocopy_min > 0) {
+        fprintf(stderr, "zerocopy_min is not supported on this platform, ignoring\n");
+        settings.zerocopy_min = 0;
+    }
+#endif
+#ifndef USE_IO_URING
+    if (settings.io_uring) {
+        fprintf(stderr, "io_uring support was not compiled in, ignoring\n");
+        settings.io_uring = false;
+    }
+#endif
+
     if (settings.lru_maintainer_thread && settings.hot_lru_pct + settings.warm_lru_pct > 80) {
         fprintf(stderr, "hot_lru_pct + warm_lru_pct cannot be more than 80%% combined\n");
         exit(EX_USAGE);
@@ -5744,10 +7318,18 @@ int main (int argc, char **argv) {
     /* initialize other stuff */
     stats_init();
     slabs_init(settings.maxbytes, settings.factor, preallocate);
-    assoc_init(settings.hashpower_init, settings.num_threads);
+#ifdef NVM
+    /* the tier migrator or log cleaner needs its own epoch and timestamp,
+     * after the workers */
+    int gc_threads = settings.num_threads +
+        (settings.dram_tier_size != 0 || settings.engine == ENGINE_LOG ? 1 : 0);
+#else
+    int gc_threads = settings.num_threads;
+#endif
+    assoc_init(settings.hashpower_init, gc_threads);
     conn_init();
 #ifdef NVM
-    item_gc_init(settings.free_list_size_limit, settings.num_threads);
+    item_gc_init(settings.free_list_size_limit, gc_threads);
 #endif
 
     /*
@@ -5775,6 +7357,18 @@ int main (int argc, char **argv) {
         return 1;
     }
 
+#ifdef NVM
+    if (settings.dram_tier_size != 0 && start_tier_migrator_thread() != 0) {
+        fprintf(stderr, "Failed to enable tier migrator thread\n");
+        return 1;
+    }
+
+    if (settings.engine == ENGINE_LOG && start_log_cleaner_thread() != 0) {
+        fprintf(stderr, "Failed to enable log cleaner thread\n");
+        return 1;
+    }
+#endif
+
     if (settings.slab_reassign &&
         start_slab_maintenance_thread() == -1) {
         exit(EXIT_FAILURE);
@@ -12,6 +12,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <time.h>
 #include <netinet/in.h>
 #include <event.h>
 #include <netdb.h>
@@ -19,6 +20,9 @@
 #include <unistd.h>
 
 #include "protocol_binary.h"
+#ifdef USE_IO_URING
+#include <liburing.h>
+#endif
 #include "cache.h"
 
 #include "sasl_defs.h"
@@ -34,14 +38,15 @@
 #define UDP_MAX_PAYLOAD_SIZE 1400
 #define UDP_HEADER_SIZE 8
 #define MAX_SENDBUF_SIZE (256 * 1024 * 1024)
-/* I'm told the max length of a 64-bit num converted to string is 20 bytes.
+/* Room for the " flags length cas\r\n" part of a VALUE line: a 32-bit flags
+ * value and the length are at most 10 bytes each, a 64-bit CAS 20 bytes.
  * Plus a few for spaces, \r\n, \0 */
-#define SUFFIX_SIZE 24
+#define SUFFIX_SIZE 48
 
 /** Initial size of list of items being returned by "get". */
 #define ITEM_LIST_INITIAL 200
 
-/** Initial size of list of CAS suffixes appended to "gets" lines. */
+/** Initial size of list of suffixes appended to "get"/"gets" lines. */
 #define SUFFIX_LIST_INITIAL 20
 
 /** Initial size of the sendmsg() scatter/gather array. */
@@ -99,15 +104,11 @@
 #define ITEM_key(item) (((char*)&((item)->data)) \
          + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
 
-#define ITEM_suffix(item) ((char*) &((item)->data) + (item)->nkey + 1 \
-         + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
-
 #define ITEM_data(item) ((char*) &((item)->data) + (item)->nkey + 1 \
-         + (item)->nsuffix \
          + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
 
 #define ITEM_ntotal(item) (sizeof(item) + (item)->nkey + 1 \
-         + (item)->nsuffix + (item)->nbytes \
+         + (item)->nbytes \
          + (((item)->it_flags & ITEM_CAS) ? sizeof(uint64_t) : 0))
 
 #define ITEM_clsid(item) ((item)->slabs_clsid & ~(3<<6))
@@ -231,10 +232,12 @@ struct slab_stats {
 };
 
 /**
- * Stats stored per-thread.
+ * Stats stored per-thread. Only the owning worker writes them, with the
+ * THR_STATS_* macros; the stats command reads them from other threads
+ * without a lock, so a sum may be a few increments behind. The slab stats
+ * start on their own cache line, away from the per-thread counters.
  */
 struct thread_stats {
-    pthread_mutex_t   mutex;
     uint64_t          get_cmds;
     uint64_t          get_misses;
     uint64_t          touch_cmds;
@@ -249,17 +252,27 @@ struct thread_stats {
     uint64_t          conn_yields; /* # of yields for connections (-R option)*/
     uint64_t          auth_cmds;
     uint64_t          auth_errors;
-    struct slab_stats slab_stats[MAX_NUMBER_OF_SLAB_CLASSES];
-};
+    uint64_t          numa_local_accesses;  /* hits/stores on the worker's node */
+    uint64_t          numa_remote_accesses; /* hits/stores on another node */
+    uint64_t          zerocopy_sends;  /* sendmsg() calls with MSG_ZEROCOPY */
+    uint64_t          zerocopy_copied; /* of those, the kernel copied anyway */
+    struct slab_stats slab_stats[MAX_NUMBER_OF_SLAB_CLASSES] __attribute__((aligned(64)));
+} __attribute__((aligned(64)));
+
+/* Relaxed atomics: no lock or fence, but readers never see a torn value. */
+#define THR_STATS_ADD(c, field, n) do { \
+        uint64_t *thr_stat_ = &(c)->thread->stats.field; \
+        __atomic_store_n(thr_stat_, __atomic_load_n(thr_stat_, __ATOMIC_RELAXED) + (n), \
+                         __ATOMIC_RELAXED); \
+    } while (0)
+#define THR_STATS_INCR(c, field) THR_STATS_ADD(c, field, 1)
+#define THR_STATS_READ(v) __atomic_load_n(&(v), __ATOMIC_RELAXED)
 
 /**
  * Global stats.
  */
 struct stats {
     pthread_mutex_t mutex;
-    unsigned int  curr_items;
-    unsigned int  total_items;
-    uint64_t      curr_bytes;
     unsigned int  curr_conns;
     unsigned int  total_conns;
     uint64_t      rejected_conns;
@@ -292,6 +305,37 @@ struct stats {
 
 #define MAX_VERBOSITY_LEVEL 2
 
+/* How new slab pages are spread over several slab pools */
+enum pool_stripe {
+    POOL_STRIPE_RR = 0,     /* round-robin over all pools */
+    POOL_STRIPE_NUMA        /* pool matching the allocating thread's NUMA node */
+};
+
+/* Which free chunk of an NVM slab class is handed out next */
+enum slab_alloc_policy {
+    SLAB_ALLOC_LIFO = 0,    /* most recently freed, cache-warm */
+    SLAB_ALLOC_FIFO         /* least recently freed, spreads NVM wear */
+};
+
+/* Who accepts new TCP connections */
+enum listen_mode {
+    LISTEN_DISPATCH = 0,    /* main thread accepts and hands them out */
+    LISTEN_REUSEPORT,       /* each worker accepts on its own SO_REUSEPORT socket */
+    LISTEN_REUSEPORT_CPU    /* same, workers pinned to the CPU of their RX queue */
+};
+
+/* How items are laid out in NVM */
+enum storage_engine {
+    ENGINE_SLABS = 0,       /* slab classes with clock eviction */
+    ENGINE_LOG              /* per-thread log segments and a cleaner */
+};
+
+/* Which new items may evict from a full slab class */
+enum admission_policy {
+    ADMIT_ALL = 0,          /* every new item evicts the clock victim */
+    ADMIT_TINYLFU           /* only items used more often than the victim */
+};
+
 /* When adding a setting, be sure to update process_stat_settings */
 /**
  * Globally accessible settings as derived from the commandline.
@@ -338,6 +382,20 @@ struct settings {
     int crawls_persleep; /* Number of LRU crawls to run before sleeping */
     bool expirezero_does_not_evict; /* exptime == 0 goes into NOEXP_LRU */
     int free_list_size_limit; /* size limit after which we should try to switch free lists */
+    char *pool_dirs;        /* ':' separated directories holding the pmemobj pools */
+    size_t slabs_pool_size; /* size of each slab pool */
+    size_t ht_pool_size;    /* size of the hash table pool */
+    enum pool_stripe pool_stripe; /* how slab pages are spread over the pools */
+    bool numa;              /* pin workers and keep their memory on their node */
+    size_t hot_cache_size;  /* DRAM for copies of hot NVM items, 0 disables */
+    size_t dram_tier_size;  /* DRAM slab tier in front of NVM, 0 disables */
+    enum admission_policy admission; /* admission filter for full slab classes */
+    enum slab_alloc_policy slab_alloc; /* order free NVM chunks are reused in */
+    enum storage_engine engine; /* slab classes or log segments */
+    int zerocopy_min;       /* NVM values this large go out with MSG_ZEROCOPY, 0 disables */
+    bool io_uring;          /* serve TCP connections through a per-worker io_uring */
+    enum listen_mode listen_mode; /* dispatcher or per-worker listeners */
+    int batch_responses;    /* most iovecs collected before a flush, 0 disables */
 };
 
 extern struct stats stats;
@@ -354,6 +412,10 @@ extern struct settings settings;
 #define ITEM_FETCHED 8
 /* Appended on fetch, removed on LRU shuffling */
 #define ITEM_ACTIVE 16
+/* DRAM copy of an NVM item, owned by the hot cache in items.cpp */
+#define ITEM_HOT 32
+/* Item lives in the DRAM tier, see settings.dram_tier_size */
+#define ITEM_DRAM 64
 
 /**
  * Structure for storing items within memcached.
@@ -370,10 +432,11 @@ struct item {
     rel_time_t      exptime;    /* expire time */
     int             nbytes;     /* size of data */
     unsigned short  refcount;
-    uint8_t         nsuffix;    /* length of flags-and-length string */
     uint8_t         it_flags;   /* ITEM_* above */
     uint8_t         slabs_clsid;/* which slab class we're in */
+    uint32_t        client_flags;/* opaque flags set by the client */
 #ifdef NVM
+    uint32_t        hv;         /* hash of the key, set when allocated */
     void*           slab;       /* which slab are we in */
     unsigned int    slabs_index;/* index within slab class */
 #endif
@@ -386,7 +449,6 @@ struct item {
     } data[];
     /* if it_flags & ITEM_CAS we have 8 bytes CAS */
     /* then null-terminated key */
-    /* then " flags length\r\n" (no terminating null) */
     /* then data with terminating \r\n (no terminating null; it's binary!) */
 };
 
@@ -400,9 +462,9 @@ typedef struct {
     rel_time_t      exptime;    /* expire time */
     int             nbytes;     /* size of data */
     unsigned short  refcount;
-    uint8_t         nsuffix;    /* length of flags-and-length string */
     uint8_t         it_flags;   /* ITEM_* above */
     uint8_t         slabs_clsid;/* which slab class we're in */
+    uint32_t        client_flags;/* unused; mirrors struct item */
     uint8_t         nkey;       /* key length, w/terminating null and padding */
     uint32_t        remaining;  /* Max keys to crawl per slab per invocation */
 } crawler;
@@ -410,15 +472,18 @@ typedef struct {
 typedef struct {
     pthread_t thread_id;        /* unique ID of this thread */
     struct event_base *base;    /* libevent handle this thread uses */
-    struct event notify_event;  /* listen event for notify pipe */
-    int notify_receive_fd;      /* receiving end of notify pipe */
-    int notify_send_fd;         /* sending end of notify pipe */
+    struct event notify_event;  /* listen event for notify eventfd */
+    int notify_fd;              /* eventfd signalled when new_conn_queue grows */
     struct thread_stats stats;  /* Stats generated by this thread */
+    struct thread_stats stats_base; /* stats at the last "stats reset" */
     struct conn_queue *new_conn_queue; /* queue of new connections to handle */
     cache_t *suffix_cache;      /* suffix cache */
 #ifdef NVM
     int thread_index;
 #endif
+    int numa_node;              /* node the thread is pinned to, -1 if none */
+    int cpu;                    /* CPU the thread is pinned to, -1 if none */
+    struct thread_uring *uring; /* io_uring backend, NULL when on libevent */
 } LIBEVENT_THREAD;
 
 typedef struct {
@@ -500,8 +565,16 @@ struct conn {
     socklen_t request_addr_size;
     unsigned char *hdrbuf; /* udp packet headers */
     int    hdrsize;   /* number of headers' worth of space is allocated */
+    struct udp_batch *udp; /* udp: datagrams moved by recvmmsg/sendmmsg */
 
     bool   noreply;   /* True if the reply should not be sent. */
+    /* responses of pipelined ascii commands, see conn_batch_response() */
+    bool   batching;  /* responses are collected instead of sent */
+    int    wbatch;    /* bytes of wbuf holding collected lines */
+    int    batch_msgused;  /* output state before the current command */
+    int    batch_iovused;
+    int    batch_msgbytes;
+    int    batch_iovlen;
     /* current stats command */
     struct {
         char *buffer;
@@ -518,6 +591,30 @@ struct conn {
     int keylen;
     conn   *next;     /* Used for generating a list of conn structures */
     LIBEVENT_THREAD *thread; /* Pointer to the thread object serving this connection */
+#ifdef NVM
+    bool   zerocopy;  /* SO_ZEROCOPY is enabled on sfd */
+    unsigned int zc_pending; /* MSG_ZEROCOPY sends not yet completed */
+    struct zc_orphan *zc_keep; /* taken before the first MSG_ZEROCOPY send,
+                                  keeps the socket past conn_close() */
+#endif
+#ifdef USE_IO_URING
+    /* io_uring backend, see conn_uring_attach() */
+    bool   uring;     /* I/O goes through the thread's ring, not libevent */
+    uint32_t ur_gen;  /* tags completions, bumped each time the conn is reused */
+    int    ur_head;   /* received buffers not yet consumed, -1 if none */
+    int    ur_tail;
+    int    ur_off;    /* bytes of the head buffer already consumed */
+    int    ur_nbufs;  /* received buffers queued on the connection */
+    int    ur_err;    /* receive error, 0 on end of stream */
+    bool   ur_eof;    /* nothing more will be received */
+    bool   ur_recv_armed;  /* a multishot receive is posted */
+    bool   ur_recv_paused; /* receive cancelled until the queue is consumed */
+    bool   ur_send_busy;   /* a sendmsg is in the ring */
+    bool   ur_closing;     /* conn_close() waits for the sendmsg to finish */
+    bool   ur_send_done;   /* ur_send_res holds its result for transmit() */
+    bool   ur_wake_pending;
+    int    ur_send_res;
+#endif
 };
 
 /* array of conn structures, indexed by file descriptor */
@@ -551,6 +648,10 @@ enum delta_result_type do_add_delta(conn *c, const char *key,
                                     uint64_t *cas, const uint32_t hv);
 enum store_item_type do_store_item(item *item, int comm, conn* c, const uint32_t hv);
 conn *conn_new(const int sfd, const enum conn_states init_state, const int event_flags, const int read_buffer_size, enum network_transport transport, struct event_base *base);
+#ifdef USE_IO_URING
+int  uring_thread_init(LIBEVENT_THREAD *me);
+void conn_uring_attach(conn *c);
+#endif
 extern int daemonize(int nochdir, int noclose);
 
 #define mutex_lock(x) pthread_mutex_lock(x)
@@ -584,6 +685,8 @@ extern int daemonize(int nochdir, int noclose);
 void memcached_thread_init(int nthreads, struct event_base *main_base);
 int  dispatch_event_add(int thread, conn *c);
 void dispatch_conn_new(int sfd, enum conn_states init_state, int event_flags, int read_buffer_size, enum network_transport transport);
+void dispatch_conn_thread(int tid, int sfd, enum conn_states init_state, int event_flags, int read_buffer_size, enum network_transport transport);
+void dispatch_conn_local(LIBEVENT_THREAD *me, int sfd, enum conn_states init_state, int event_flags, int read_buffer_size, enum network_transport transport);
 
 /* Lock wrappers for cache functions that are called from main loop. */
 enum delta_result_type add_delta(conn *c, const char *key,
@@ -594,6 +697,8 @@ void accept_new_conns(const bool do_accept);
 conn *conn_from_freelist(void);
 bool  conn_add_to_freelist(conn *c);
 int   is_listen_thread(void);
+int   thread_numa_node(void);
+int   numa_node_index(int node);
 item *item_alloc(char *key, size_t nkey, int flags, rel_time_t exptime, int nbytes);
 item *item_get(const char *key, const size_t nkey);
 item *item_touch(const char *key, const size_t nkey, uint32_t exptime);
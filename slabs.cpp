@@ -19,34 +19,59 @@
 #include <stdio.h>
 #include <string.h>
 #include <assert.h>
+#include <limits.h>
 #include <pthread.h>
+#include <sys/syscall.h>
 
 /* powers-of-N allocation structures */
 
+/* The slab list and the clock bitmap are kept as segments behind an
+ * append-only directory. Growing either one allocates at most a new segment
+ * and never moves existing entries, so readers need no lock. Slab list
+ * segments have a fixed size. The first bitmap segment covers the class's
+ * chunks per page, rounded up to a power of two, and every later one is as
+ * large as all before it, so a class with few pages has a small bitmap. */
+#define SLAB_LIST_SEG_SIZE  4096        /* slab pointers per segment */
+#define SLAB_LIST_SEGMENTS  256
+#define CLOCK_SEG_MIN_SHIFT 6           /* at least one 64-bit word */
+#define CLOCK_SEGMENTS      32
+
+#define SLAB_LIST_ENTRY(p, index) \
+    (D_RW((p)->slab_list[(index) / SLAB_LIST_SEG_SIZE])[(index) % SLAB_LIST_SEG_SIZE])
+/* Entries the clock reads without slabs_lock are set with release stores */
+#define SLAB_LIST_PUBLISH(p, index, ptr) \
+    __atomic_store_n(&SLAB_LIST_ENTRY(p, index), (void *)(ptr), __ATOMIC_RELEASE)
+
 struct _slabclass {
     unsigned int size;      /* sizes of items */
     unsigned int perslab;   /* how many items per slab */
 
+#ifndef NVM
     void *slots;           /* list of item ptrs */
     unsigned int sl_curr;   /* total free items in list */
+#endif
+
+    void *end_page_ptr;         /* next never-used chunk in the newest page */
+    unsigned int end_page_free; /* number of never-used chunks left there */
 
     unsigned int slabs;     /* how many slabs were allocated for this class */
 
 #ifdef NVM
-    TOID(void_p) slab_list;
+    TOID(void_p) slab_list[SLAB_LIST_SEGMENTS]; /* segments of slab pointers */
 #else
-
-
-    void **slab_list;       /* array of slab pointers */
+    void **slab_list[SLAB_LIST_SEGMENTS];       /* segments of slab pointers */
 #endif
-    unsigned int list_size; /* size of prev array */
+    unsigned int list_size; /* slab pointers the allocated segments hold */
 
     unsigned int killing;  /* index+1 of dying slab, or zero if none */
     size_t requested; /* The number of requested bytes */
 
 #ifdef NVM
-    TOID(char) bitmap;             /* bit per slot for clock alg. */
+    TOID(char) bitmap[CLOCK_SEGMENTS]; /* bit per slot for clock alg., segmented */
+    unsigned int bitmap_size;          /* slots the allocated segments cover */
+    unsigned int bitmap_shift;         /* log2 of the first segment's slots */
     unsigned int clock_hand;  /* current slot for clock alg. */
+    volatile unsigned int clock_slots; /* slots carved so far, clock stays below */
 #endif
 };
 
@@ -62,23 +87,95 @@ struct slab_root {
     void *mem_base = NULL;
     void *mem_current = NULL;
     size_t mem_avail = 0;
+
+    void *log_head = NULL;  /* every log segment ever allocated, see below */
 };
 
 static slab_root* root;
 static PMEMobjpool *pop = NULL;
 
+/* Slab pages are striped over one pool per entry of settings.pool_dirs. The
+ * first pool is also pop, which holds the slab classes. */
+static PMEMobjpool *pools[MAX_SLAB_POOLS];
+static unsigned int num_pools = 0;
+static unsigned int next_pool = 0;              /* under slabs_lock */
+static size_t pool_malloced[MAX_SLAB_POOLS];    /* under slabs_lock */
+static char *pool_base[MAX_SLAB_POOLS];         /* mapped range of each pool */
+static char *pool_end[MAX_SLAB_POOLS];
+
+#ifdef NVM
+static void cas_high_open(const char *dir);
+#endif
+
 /**
  * Access to the slab allocator is protected by this lock
  */
 static pthread_mutex_t slabs_lock = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t slabs_rebalance_lock = PTHREAD_MUTEX_INITIALIZER;
+#ifdef NVM
+/* Protects the clock hand of each class; the bitmap itself needs no lock */
+static pthread_mutex_t clock_locks[MAX_NUMBER_OF_SLAB_CLASSES];
+
+/*
+ * Free chunks of NVM slab classes are only tracked in DRAM, so allocating and
+ * freeing never write list pointers into persistent chunks. Each class has a
+ * shared stack protected by slabs_lock, fronted by a small cache per thread.
+ * ITEM_SLABBED in the chunk itself stays authoritative: slabs_recover()
+ * rebuilds the stacks from it.
+ */
+#define THREAD_FREE_CHUNKS 64   /* chunks per class cached by each thread */
+#define NUMA_REFILL_SCAN   256  /* shared stack entries searched for local chunks */
+
+/* Free chunks are chunks[head..count). Only slab classes under
+ * SLAB_ALLOC_FIFO ever take from the head; everything else uses it as a
+ * stack and head stays 0. */
+typedef struct {
+    item **chunks;
+    unsigned int head;
+    unsigned int count;
+    unsigned int size;
+} chunk_stack_t;
+
+#define CHUNK_STACK_LEN(s) ((s)->count - (s)->head)
+
+typedef struct _thread_chunks {
+    /* Taken by the owning thread; by others only while holding slabs_lock.
+     * Never acquire slabs_lock while holding it. */
+    pthread_mutex_t lock;
+    unsigned int count[MAX_NUMBER_OF_SLAB_CLASSES];
+    item *chunks[MAX_NUMBER_OF_SLAB_CLASSES][THREAD_FREE_CHUNKS];
+    struct _thread_chunks *next;
+} thread_chunks_t;
+
+static chunk_stack_t free_chunks[MAX_NUMBER_OF_SLAB_CLASSES];
+static thread_chunks_t *all_thread_chunks = NULL;   /* under slabs_lock */
+static __thread thread_chunks_t *my_chunks = NULL;
+
+/* Writes into each slab page since startup, for spotting wear hotspots.
+ * Kept in DRAM segments parallel to the slab list, indexed by slabs_index. */
+static uint32_t *page_writes[MAX_NUMBER_OF_SLAB_CLASSES][SLAB_LIST_SEGMENTS];
+
+#define SLABS_FREE_COUNT(p, id) CHUNK_STACK_LEN(&free_chunks[(id)])
+#define SLABS_REQUESTED_ADD(p, n) __sync_fetch_and_add(&(p)->requested, (n))
+#else
+#define SLABS_FREE_COUNT(p, id) ((p)->sl_curr)
+#define SLABS_REQUESTED_ADD(p, n) ((p)->requested += (n))
+#endif
 
 /*
  * Forward Declarations
  */
 static int do_slabs_newslab(const unsigned int id);
 static void *memory_allocate(size_t size);
+static void memory_release(void *ptr, size_t size);
 static void do_slabs_free(void *ptr, const size_t size, unsigned int id);
+#ifdef NVM
+static void chunk_stack_push(chunk_stack_t *s, item *it);
+static item *chunk_stack_take(chunk_stack_t *s);
+static void do_thread_chunks_drain(const unsigned int id);
+static void slabs_log_init(const size_t limit);
+static void slabs_count_write(const unsigned int id, item *it);
+#endif
 
 /* Preallocate as many slab pages as possible (called from slabs_init)
    on start-up, so users don't get confused out-of-memory errors when
@@ -107,6 +204,90 @@ unsigned int slabs_clsid(const size_t size) {
     return res;
 }
 
+static PMEMobjpool *slabs_pool_open(const char *path) {
+    PMEMobjpool *p = NULL;
+
+    //remove file if it exists
+    //TODO might want to remove this instruction in the future
+    remove(path);
+
+    if (access(path, F_OK) != 0) {
+        if ((p = pmemobj_create(path, POBJ_LAYOUT_NAME(slabs),
+            settings.slabs_pool_size, S_IWUSR | S_IRUSR)) == NULL) {
+            printf("failed to create pool with name %s\n", path);
+            exit(1);
+        }
+    } else {
+        if ((p = pmemobj_open(path, POBJ_LAYOUT_NAME(slabs))) == NULL) {
+            printf("failed to open pool with name %s\n", path);
+            exit(1);
+        }
+    }
+    return p;
+}
+
+/* NUMA node of the calling thread: the one it is pinned to, otherwise the
+ * one it happens to run on. -1 if unknown. */
+static int slabs_my_node(void) {
+    int node = thread_numa_node();
+    if (node < 0) {
+        unsigned int cpu, n;
+        if (syscall(SYS_getcpu, &cpu, &n, NULL) == 0)
+            node = (int)n;
+    }
+    return node;
+}
+
+/* Pool the next slab page should come from */
+static unsigned int slabs_pick_pool(void) {
+    if (num_pools == 1)
+        return 0;
+    if (settings.pool_stripe == POOL_STRIPE_NUMA) {
+        int node = slabs_my_node();
+        if (node >= 0)
+            return numa_node_index(node) % num_pools;
+    }
+    return next_pool++ % num_pools;
+}
+
+/* Index of the pool holding ptr, -1 if it is in none of them */
+static int slabs_pool_of(const void *ptr) {
+    unsigned int k;
+    for (k = 0; k < num_pools; k++) {
+        if ((const char *)ptr >= pool_base[k] && (const char *)ptr < pool_end[k])
+            return k;
+    }
+    return -1;
+}
+
+/* Whether ptr lives in the pool of the given NUMA node. With a single pool
+ * everything is local, and so is DRAM. */
+bool slabs_is_local(const void *ptr, int node) {
+    int k;
+    if (num_pools == 1 || node < 0)
+        return true;
+    /* DRAM outside the pools was allocated by the thread itself */
+    k = slabs_pool_of(ptr);
+    return k < 0 || k == numa_node_index(node) % (int)num_pools;
+}
+
+/* Allocates a slab page from the pool the striping policy picks, falling back
+ * to the other pools once that one is full. */
+static void *slabs_pool_alloc(size_t size) {
+    unsigned int first = slabs_pick_pool();
+    unsigned int k;
+
+    for (k = 0; k < num_pools; k++) {
+        unsigned int idx = (first + k) % num_pools;
+        PMEMoid oid;
+        if (pmemobj_alloc(pools[idx], &oid, size, 0, NULL, NULL) == 0) {
+            pool_malloced[idx] += size;
+            return pmemobj_direct(oid);
+        }
+    }
+    return NULL;
+}
+
 /**
  * Determines the chunk sizes and initializes the slab class descriptors
  * accordingly.
@@ -116,29 +297,51 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc) {
     int i = POWER_SMALLEST - 1;
     unsigned int size = sizeof(item) + settings.chunk_size;
 
-    // Start setting up pmemobj pool
-    char path[32];
-    sprintf(path, "/tmp/slabs");
-
-    remove(path);
-
-    if (access(path, F_OK) != 0) {
-        if ((pop = pmemobj_create(path, POBJ_LAYOUT_NAME(slabs),
-            SLABS_POOL_SIZE, S_IWUSR | S_IRUSR)) == NULL) {
-            printf("failed to create pool1 wiht name %s\n", path);
-            exit(1);
+    // Start setting up pmemobj pools
+    char *list = strdup(settings.pool_dirs);
+    char *b;
+    if (list == NULL) {
+        fprintf(stderr, "Failed to allocate memory for parsing pool_dirs\n");
+        exit(1);
+    }
+    for (char *dir = strtok_r(list, ":", &b);
+         dir != NULL;
+         dir = strtok_r(NULL, ":", &b)) {
+        char path[PATH_MAX];
+        if (num_pools == MAX_SLAB_POOLS) {
+            fprintf(stderr, "Only the first %d pool_dirs are used\n", MAX_SLAB_POOLS);
+            break;
         }
-    } else {
-      if ((pop = pmemobj_open(path, POBJ_LAYOUT_NAME(slabs))) == NULL) {
-          printf("failed to open pool with name %s\n", path);
-          exit(1);
-      }
+        if (num_pools == 0) {
+#ifdef NVM
+            cas_high_open(dir);
+#endif
+            snprintf(path, sizeof(path), "%s/slabs", dir);
+        } else {
+            snprintf(path, sizeof(path), "%s/slabs.%u", dir, num_pools);
+        }
+        pools[num_pools] = slabs_pool_open(path);
+        pool_base[num_pools] = (char *)pools[num_pools];
+        pool_end[num_pools] = pool_base[num_pools] + settings.slabs_pool_size;
+        num_pools++;
+    }
+    free(list);
+    if (num_pools == 0) {
+        fprintf(stderr, "No directory given for the slab pools\n");
+        exit(1);
     }
+    pop = pools[0];
 
     TOID(struct slab_root) _root = POBJ_ROOT(pop, struct slab_root);
     root = D_RW(_root);
     // Done setting up pmemobj pool
 
+#ifdef NVM
+    for (int j = 0; j < MAX_NUMBER_OF_SLAB_CLASSES; j++) {
+        pthread_mutex_init(&clock_locks[j], NULL);
+    }
+#endif
+
     TX_BEGIN(pop) {
         TX_ADD_DIRECT(root);
         root->mem_limit = limit;
@@ -188,152 +391,250 @@ void slabs_init(const size_t limit, const double factor, const bool prealloc) {
             }
 
         }
-
-        if (prealloc) {
-            slabs_preallocate(root->power_largest);
-        }
     } TX_END
 
+    /* the log engine carves no class pages. Outside the transaction above,
+     * as do_slabs_newslab() allocates pages outside of any. */
+    if (prealloc && settings.engine != ENGINE_LOG) {
+        slabs_preallocate(root->power_largest);
+    }
+#ifdef NVM
+    if (settings.engine == ENGINE_LOG)
+        slabs_log_init(limit);
+#endif
+
 }
 
 static void slabs_preallocate (const unsigned int maxslabs) {
-    TX_BEGIN(pop) {
-        int i;
-        unsigned int prealloc = 0;
-
-        /* pre-allocate a 1MB slab in every size class so people don't get
-           confused by non-intuitive "SERVER_ERROR out of memory"
-           messages.  this is the most common question on the mailing
-           list.  if you really don't want this, you can rebuild without
-           these three lines.  */
-
-        for (i = POWER_SMALLEST; i < MAX_NUMBER_OF_SLAB_CLASSES; i++) {
-            if (++prealloc > maxslabs)
-                return;
-            if (do_slabs_newslab(i) == 0) {
-                fprintf(stderr, "Error while preallocating slab memory!\n"
-                    "If using -L or other prealloc options, max memory must be "
-                    "at least %d megabytes.\n", root->power_largest);
-                exit(1);
-            }
+    int i;
+    unsigned int prealloc = 0;
+
+    /* pre-allocate a 1MB slab in every size class so people don't get
+       confused by non-intuitive "SERVER_ERROR out of memory"
+       messages.  this is the most common question on the mailing
+       list.  if you really don't want this, you can rebuild without
+       these three lines.  */
+
+    for (i = POWER_SMALLEST; i < MAX_NUMBER_OF_SLAB_CLASSES; i++) {
+        if (++prealloc > maxslabs)
+            return;
+        if (do_slabs_newslab(i) == 0) {
+            fprintf(stderr, "Error while preallocating slab memory!\n"
+                "If using -L or other prealloc options, max memory must be "
+                "at least %d megabytes.\n", root->power_largest);
+            exit(1);
         }
-    } TX_END
+    }
 }
 
 static int grow_slab_list (const unsigned int id) {
     TX_BEGIN(pop) {
         slabclass_t *p = &root->slabclass[id];
         if (p->slabs == p->list_size) {
-            size_t new_size =  (p->list_size != 0) ? p->list_size * 2 : 16;
-            TOID(void_p) new_list = TX_REALLOC(p->slab_list, new_size * sizeof(void *));
-            if (TOID_IS_NULL(new_list)) return 0;
-            p->list_size = new_size;
-            p->slab_list = new_list;
+            unsigned int seg = p->list_size / SLAB_LIST_SEG_SIZE;
+            if (seg >= SLAB_LIST_SEGMENTS) return 0;
+            TOID(void_p) new_seg = TX_ALLOC(void_p, SLAB_LIST_SEG_SIZE);
+            if (TOID_IS_NULL(new_seg)) return 0;
+            p->slab_list[seg] = new_seg;
+            p->list_size += SLAB_LIST_SEG_SIZE;
         }
         return 1;
         
     } TX_END
 }
 
-static void assign_slab_ids(const unsigned int id, const void* slab) {
-    TX_BEGIN(pop) {
-        slabclass_t *p = &root->slabclass[id];
-        char* ptr = (char*)slab;
-        int x;
-        for (x = 0; x < p->perslab; x++) {
-            item* it = (item*) ptr;
-            it->slab = (void*)slab;
-            ptr += p->size;
-        }
-    } TX_END
+#ifdef NVM
+// Bitmap segment holding slot index: 0 below the first segment's size,
+// then one more per doubling
+static inline unsigned int clock_seg(const slabclass_t* p, unsigned int index) {
+    unsigned int q = index >> p->bitmap_shift;
+    return q == 0 ? 0 : 32 - __builtin_clz(q);
 }
 
-static void split_slab_page_into_freelist(char *ptr, const unsigned int id) {
-    TX_BEGIN(pop) {
-        slabclass_t *p = &root->slabclass[id];
-        int x;
-        for (x = 0; x < p->perslab; x++) {
-            do_slabs_free(ptr, 0, id);
-            ptr += p->size;
-        }
-    } TX_END
+// First slot of a segment; for seg > 0 also the number of slots it covers
+static inline unsigned int clock_seg_start(const slabclass_t* p, unsigned int seg) {
+    return seg == 0 ? 0 : (1u << p->bitmap_shift) << (seg - 1);
+}
+
+// Slots from index to the end of its segment
+static inline unsigned int clock_seg_left(const slabclass_t* p, unsigned int index) {
+    unsigned int seg = clock_seg(p, index);
+    unsigned int end = seg == 0 ? 1u << p->bitmap_shift : clock_seg_start(p, seg) * 2;
+    return end - index;
 }
 
-#ifdef NVM
 // Initial contents of bitmap don't matter, since we set bit when item is used
 static int clock_grow_bitmap(const unsigned int id) {
     TX_BEGIN(pop) {
         slabclass_t* p = &root->slabclass[id];
         unsigned int total_slots = (p->slabs + 1) * p->perslab; //nakon ove fje se slabs inkr
-        unsigned int bitmap_size = (total_slots + 7) / 8;
 
-        if (TOID_IS_NULL(p->bitmap)) {
-            p->bitmap = TX_ALLOC(char, bitmap_size);
-            if (TOID_IS_NULL(p->bitmap))
+        if (p->bitmap_size == 0) {
+            p->bitmap_shift = CLOCK_SEG_MIN_SHIFT;
+            while ((1u << p->bitmap_shift) < p->perslab)
+                p->bitmap_shift++;
+        }
+        while (p->bitmap_size < total_slots) {
+            unsigned int seg = clock_seg(p, p->bitmap_size);
+            unsigned int slots = seg == 0 ? 1u << p->bitmap_shift : p->bitmap_size;
+            if (seg >= CLOCK_SEGMENTS || slots > UINT_MAX - p->bitmap_size)
                 return 0;
-        } else {
-            TOID(char) new_bitmap = TX_REALLOC(p->bitmap, bitmap_size);
-            if (TOID_IS_NULL(new_bitmap))
+            TOID(char) new_seg = TX_ALLOC(char, slots / 8);
+            if (TOID_IS_NULL(new_seg))
                 return 0;
-            p->bitmap = new_bitmap;
+            p->bitmap[seg] = new_seg;
+            p->bitmap_size += slots;
         }
         return 1;
     } TX_END
 }
+#endif
 
-static void set_item_indices(char *ptr, const unsigned int id) {
-    TX_BEGIN(pop){
-        slabclass_t* p = &root->slabclass[id];
-        unsigned int current_items = p->slabs * p->perslab;
+#ifdef NVM
+/* Makes sure the write counters cover the page about to be added */
+static int page_writes_grow(const unsigned int id) {
+    unsigned int seg = root->slabclass[id].slabs / SLAB_LIST_SEG_SIZE;
 
-        int i;
-        for (i = 0; i < p->perslab; i++) {
-            item* it = (item*)ptr;
-            it->slabs_index = current_items + i;
-            ptr += p->size;
-        }
-    } TX_END
+    if (page_writes[id][seg] == NULL) {
+        page_writes[id][seg] = (uint32_t *)calloc(SLAB_LIST_SEG_SIZE, sizeof(uint32_t));
+    }
+    return page_writes[id][seg] != NULL;
 }
-#endif
 
-static int do_slabs_newslab(const unsigned int id) {
-    TX_BEGIN(pop) {
-        slabclass_t *p = &root->slabclass[id];
-        int len = settings.slab_reassign ? settings.item_size_max
-            : p->size * p->perslab;
-        char *ptr;
+/* Counts an item written into chunk it of class id */
+static void slabs_count_write(const unsigned int id, item *it) {
+    unsigned int page = it->slabs_index / root->slabclass[id].perslab;
+    uint32_t *seg = page_writes[id][page / SLAB_LIST_SEG_SIZE];
 
-        if ((root->mem_limit && root->mem_malloced + len > root->mem_limit && p->slabs > 0)) {
-            root->mem_limit_reached = true;
-            MEMCACHED_SLABS_SLABCLASS_ALLOCATE_FAILED(id);
-            return 0;
-        }
+    /* pages recovered from a previous run have no counters yet */
+    if (page / SLAB_LIST_SEG_SIZE < SLAB_LIST_SEGMENTS && seg != NULL)
+        __sync_fetch_and_add(&seg[page % SLAB_LIST_SEG_SIZE], 1);
+}
 
-        if ((grow_slab_list(id) == 0) ||
-#ifdef NVM
-            (clock_grow_bitmap(id) == 0) ||
-#endif
-            ((ptr = (char*)memory_allocate((size_t)len)) == 0)) {
+/* Follows a page moved to another slot of the slab list; the slot it
+ * leaves starts over at zero. Called with slabs_lock held. */
+static void page_writes_move(const unsigned int id, unsigned int from, unsigned int to) {
+    uint32_t *src = page_writes[id][from / SLAB_LIST_SEG_SIZE];
+    uint32_t *dst = page_writes[id][to / SLAB_LIST_SEG_SIZE];
+    uint32_t w = 0;
 
-            MEMCACHED_SLABS_SLABCLASS_ALLOCATE_FAILED(id);
-            return 0;
-        }
+    if (src != NULL) {
+        w = src[from % SLAB_LIST_SEG_SIZE];
+        src[from % SLAB_LIST_SEG_SIZE] = 0;
+    }
+    if (dst != NULL)
+        dst[to % SLAB_LIST_SEG_SIZE] = w;
+}
 
-        memset(ptr, 0, (size_t)len);
-        split_slab_page_into_freelist(ptr, id);
-        assign_slab_ids(id, ptr);
+/* Renumbers the chunks of the page in slot pg of the slab list after it
+ * moved there, so the clock and the write counters, which find a chunk's
+ * page by its slabs_index, follow it. Every chunk of the page has been
+ * carved. Called with slabs_lock held. */
+static void do_slabs_reindex_page(const unsigned int id, unsigned int pg) {
+    slabclass_t *p = &root->slabclass[id];
+    char *page = (char *)SLAB_LIST_ENTRY(p, pg);
+    unsigned int k;
+
+    for (k = 0; k < p->perslab; k++) {
+        item *it = (item *)(page + (size_t)k * p->size);
+        it->slabs_index = pg * p->perslab + k;
+        pmemobj_persist(pop, &it->slabs_index, sizeof(it->slabs_index));
+    }
+}
+#endif
 
+/* Hands out the next never-used chunk of the newest page. Pages come from
+ * pmemobj_alloc() unzeroed, so the header is persisted before the
+ * high-water mark moves past it: recovery must never find stale flag bytes
+ * below the mark. */
+static item *do_slabs_carve(const unsigned int id) {
+    slabclass_t *p = &root->slabclass[id];
+    item *it = (item *)p->end_page_ptr;
 
+    assert(it != NULL && p->end_page_free != 0);
+    memset(it, 0, sizeof(item));
 #ifdef NVM
-        set_item_indices(ptr, id);
+    it->slab = SLAB_LIST_ENTRY(p, p->slabs - 1);
+    it->slabs_index = p->slabs * p->perslab - p->end_page_free;
+    /* publish the slot to the clock only once its header is in place */
+    __sync_synchronize();
+    p->clock_slots = it->slabs_index + 1;
 #endif
+    pmemobj_persist(pop, it, sizeof(item));
+
+    if (--p->end_page_free != 0) {
+        p->end_page_ptr = ((char *)p->end_page_ptr) + p->size;
+    } else {
+        p->end_page_ptr = 0;
+    }
+    pmemobj_persist(pop, &p->end_page_ptr,
+                    sizeof(p->end_page_ptr) + sizeof(p->end_page_free));
+    return it;
+}
 
-        D_RW(p->slab_list)[p->slabs++] = ptr;
-        root->mem_malloced += len;
-        MEMCACHED_SLABS_SLABCLASS_ALLOCATE(id);
+/* Moves whatever is left of the newest page onto the freelist. */
+static void do_slabs_retire_end_page(const unsigned int id) {
+    slabclass_t *p = &root->slabclass[id];
 
-        return 1;
+    while (p->end_page_free != 0) {
+        do_slabs_free(do_slabs_carve(id), 0, id);
+    }
+}
+
+/*
+ * The page is allocated before the transaction that links it: it may come
+ * from any of the pools, and a transaction can only allocate from its own.
+ * If the transaction fails, the page is handed back. A crash in between
+ * leaks it, which is harmless while slabs_pool_open() recreates the pools.
+ */
+static int do_slabs_newslab(const unsigned int id) {
+    slabclass_t *p = &root->slabclass[id];
+    int len = settings.slab_reassign ? settings.item_size_max
+        : p->size * p->perslab;
+    char *ptr;
+    volatile int linked = 0;
+
+    if ((root->mem_limit && root->mem_malloced + len > root->mem_limit && p->slabs > 0)) {
+        root->mem_limit_reached = true;
+        MEMCACHED_SLABS_SLABCLASS_ALLOCATE_FAILED(id);
+        return 0;
+    }
+
+    if ((ptr = (char*)memory_allocate((size_t)len)) == 0) {
+        MEMCACHED_SLABS_SLABCLASS_ALLOCATE_FAILED(id);
+        return 0;
+    }
+
+    TX_BEGIN(pop) {
+        if ((grow_slab_list(id) != 0)
+#ifdef NVM
+            && (clock_grow_bitmap(id) != 0)
+            && (page_writes_grow(id) != 0)
+#endif
+            ) {
+            TX_ADD_DIRECT(&root->mem_malloced);
+            /* Chunks are carved off lazily by do_slabs_alloc(); the page
+             * itself is never touched here. Any tail left in the previous
+             * page goes to the freelist first, so only the newest page has
+             * one. */
+            do_slabs_retire_end_page(id);
+            p->end_page_ptr = ptr;
+            p->end_page_free = p->perslab;
+
+            SLAB_LIST_PUBLISH(p, p->slabs, ptr);
+            p->slabs++;
+            root->mem_malloced += len;
+            linked = 1;
+        }
     } TX_END
+
+    if (!linked) {
+        memory_release(ptr, (size_t)len);
+        MEMCACHED_SLABS_SLABCLASS_ALLOCATE_FAILED(id);
+        return 0;
+    }
+    MEMCACHED_SLABS_SLABCLASS_ALLOCATE(id);
+    return 1;
 }
 
 /*@null@*/
@@ -347,41 +648,62 @@ static void *do_slabs_alloc(const size_t size, unsigned int id, unsigned int *to
         return NULL;
     }
     p = &root->slabclass[id];
+#ifndef NVM
     assert(p->sl_curr == 0 || ((item *)p->slots)->slabs_clsid == 0);
+#endif
+    assert(p->end_page_free == 0 || p->end_page_ptr != NULL);
 
     *total_chunks = p->slabs * p->perslab;
+#ifdef NVM
+    /* Before growing the class or letting the caller evict, pull back the
+     * free chunks stranded in other threads' caches. */
+    if (p->end_page_ptr == 0 && SLABS_FREE_COUNT(p, id) == 0)
+        do_thread_chunks_drain(id);
+#endif
     /* fail unless we have space at the end of a recently allocated page,
        we have something on our freelist, or we could allocate a new page */
-    if (! (p->sl_curr != 0 || do_slabs_newslab(id) != 0)) {
+    if (! (p->end_page_ptr != 0 || SLABS_FREE_COUNT(p, id) != 0 ||
+           do_slabs_newslab(id) != 0)) {
         /* We don't have more memory available */
         ret = NULL;
-    } else if (p->sl_curr != 0) {
-        /* return off our freelist */
+    } else {
         TX_BEGIN(pop) {
-            it = (item *)p->slots;
-            p->slots = it->next;
-            if (it->next) it->next->prev = 0;
+            if (SLABS_FREE_COUNT(p, id) != 0) {
+                /* return off our freelist */
+#ifdef NVM
+                it = chunk_stack_take(&free_chunks[id]);
+#else
+                it = (item *)p->slots;
+                p->slots = it->next;
+                if (it->next) it->next->prev = 0;
+#endif
 
-            /* Kill flag and initialize refcount here for lock safety in slab
-             * mover's freeness detection. */
-            it->it_flags &= ~ITEM_SLABBED;
+                /* Kill flag and initialize refcount here for lock safety in slab
+                 * mover's freeness detection. */
+                it->it_flags &= ~ITEM_SLABBED;
+#ifndef NVM
+                p->sl_curr--;
+#endif
+            } else {
+                /* if we recently allocated a whole page, return from that */
+                it = do_slabs_carve(id);
+            }
 #ifndef NVM
             it->refcount = 1;
 #endif
-
-            p->sl_curr--;
         } TX_ONCOMMIT {
             active_slab_table_t* my_slab_table = getMySlabTable();
             uint64_t my_current_timestamp = getMyTimestamp();
             uint64_t my_last_collect = getMyLastCollect();
-            mark_slab(my_slab_table, it, it->slab, it->slabs_clsid, my_current_timestamp, my_last_collect, 0);
+            mark_slab(my_slab_table, it, it->slab, id, my_current_timestamp, my_last_collect, 0);
+            slabs_count_write(id, it);
         } TX_FINALLY {
             ret = (void *)it;
         } TX_END
     }
 
     if (ret) {
-        p->requested += size;
+        SLABS_REQUESTED_ADD(p, size);
         MEMCACHED_SLABS_ALLOCATE(size, id, p->size, ret);
     } else {
         MEMCACHED_SLABS_ALLOCATE_FAILED(size, id);
@@ -404,6 +726,17 @@ static void do_slabs_free(void *ptr, const size_t size, unsigned int id) {
     it = (item *)ptr;
     it->slabs_clsid = 0;
 
+#ifdef NVM
+    it->it_flags |= ITEM_SLABBED;
+    /* A chunk of the page being moved away is not handed out again */
+    if (slab_rebalance_signal && ptr >= slab_rebal.slab_start &&
+        ptr < slab_rebal.slab_end) {
+        it->it_flags = 0;
+        it->slabs_clsid = 255;
+    } else {
+        chunk_stack_push(&free_chunks[id], it);
+    }
+#else
     it->prev = 0;
     it->next = (item*)p->slots;
     if (it->next) it->next->prev = it;
@@ -411,47 +744,749 @@ static void do_slabs_free(void *ptr, const size_t size, unsigned int id) {
     it->it_flags |= ITEM_SLABBED;
 
     p->sl_curr++;
-    p->requested -= size;
+#endif
+    SLABS_REQUESTED_ADD(p, -size);
     return;
 }
 
-void slabs_recover(active_slab_table_t** slab_tables, ht_intset_t* ht, int num_threads) {
+#ifdef NVM
+/* Pushes a chunk on a shared free stack. Called with slabs_lock held. If the
+ * stack can't grow the chunk stays ITEM_SLABBED and is only found again by
+ * slabs_recover(). */
+static void chunk_stack_push(chunk_stack_t *s, item *it) {
+    if (s->count == s->size && s->head != 0) {
+        /* reuse the slots the head has moved past */
+        memmove(s->chunks, s->chunks + s->head,
+                CHUNK_STACK_LEN(s) * sizeof(item *));
+        s->count -= s->head;
+        s->head = 0;
+    }
+    if (s->count == s->size) {
+        unsigned int new_size = (s->size != 0) ? s->size * 2 : 1024;
+        item **new_chunks = (item **)realloc(s->chunks, new_size * sizeof(item *));
+        if (new_chunks == NULL) {
+            STATS_LOCK();
+            stats.malloc_fails++;
+            STATS_UNLOCK();
+            return;
+        }
+        s->chunks = new_chunks;
+        s->size = new_size;
+    }
+    s->chunks[s->count++] = it;
+}
+
+/* Takes a chunk off a non-empty shared free list. Called with slabs_lock
+ * held. The LIFO default hands the most recently freed chunk out again,
+ * which is cache-warm but keeps rewriting the same NVM lines under churn;
+ * FIFO cycles through every free chunk to spread the wear. */
+static item *chunk_stack_take(chunk_stack_t *s) {
+    item *it;
+
+    assert(CHUNK_STACK_LEN(s) != 0);
+    if (settings.slab_alloc == SLAB_ALLOC_FIFO) {
+        it = s->chunks[s->head++];
+        if (s->head == s->count)
+            s->head = s->count = 0;
+    } else {
+        it = s->chunks[--s->count];
+    }
+    return it;
+}
+
+/* Takes up to max chunks of the given node out of the next NUMA_REFILL_SCAN
+ * that chunk_stack_take() would hand out, in the same order. The chunks
+ * left behind keep their order too. Returns the number taken. */
+static unsigned int chunk_stack_take_local(chunk_stack_t *s, int node,
+                                           item **out, unsigned int max) {
+    unsigned int len = CHUNK_STACK_LEN(s);
+    unsigned int scan = len > NUMA_REFILL_SCAN ? NUMA_REFILL_SCAN : len;
+    unsigned int n = 0, i, w;
+
+    if (settings.slab_alloc == SLAB_ALLOC_FIFO) {
+        /* oldest first; the rest slides up to the new head */
+        unsigned int end = s->head + scan;
+        for (i = s->head; i < end && n < max; i++) {
+            if (slabs_is_local(s->chunks[i], node)) {
+                out[n++] = s->chunks[i];
+                s->chunks[i] = NULL;
+            }
+        }
+        for (i = w = end; i > s->head; i--) {
+            if (s->chunks[i - 1] != NULL)
+                s->chunks[--w] = s->chunks[i - 1];
+        }
+        s->head = w;
+    } else {
+        /* top first; the rest slides down to the new top */
+        unsigned int start = s->count - scan;
+        for (i = s->count; i > start && n < max; i--) {
+            if (slabs_is_local(s->chunks[i - 1], node)) {
+                out[n++] = s->chunks[i - 1];
+                s->chunks[i - 1] = NULL;
+            }
+        }
+        for (i = w = start; i < s->count; i++) {
+            if (s->chunks[i] != NULL)
+                s->chunks[w++] = s->chunks[i];
+        }
+        s->count = w;
+    }
+    if (s->head == s->count)
+        s->head = s->count = 0;
+    return n;
+}
+
+static thread_chunks_t *get_my_chunks(void) {
+    if (my_chunks == NULL) {
+        thread_chunks_t *tc = (thread_chunks_t *)calloc(1, sizeof(thread_chunks_t));
+        if (tc == NULL)
+            return NULL;
+        pthread_mutex_init(&tc->lock, NULL);
+        pthread_mutex_lock(&slabs_lock);
+        tc->next = all_thread_chunks;
+        all_thread_chunks = tc;
+        pthread_mutex_unlock(&slabs_lock);
+        my_chunks = tc;
+    }
+    return my_chunks;
+}
+
+/* Free chunks of a class, shared and cached. Called with slabs_lock held;
+ * the cached counts are read without their locks, which is fine for stats. */
+static unsigned int do_slabs_free_chunks(const unsigned int id) {
+    unsigned int total = CHUNK_STACK_LEN(&free_chunks[id]);
+    thread_chunks_t *tc;
+    for (tc = all_thread_chunks; tc != NULL; tc = tc->next) {
+        total += tc->count[id];
+    }
+    return total;
+}
+
+/* While a class is being rebalanced its chunks bypass the thread caches. */
+static inline bool thread_chunks_usable(const unsigned int id) {
+    return !(slab_rebalance_signal && slab_rebal.s_clsid == id);
+}
+
+/* Takes a chunk from the calling thread's cache, NULL if it has none */
+static void *thread_chunks_alloc(const size_t size, unsigned int id,
+                                 unsigned int *total_chunks) {
+    thread_chunks_t *tc;
+    item *it = NULL;
+
+    if (id < POWER_SMALLEST || id > root->power_largest)
+        return NULL;
+    if ((tc = get_my_chunks()) == NULL)
+        return NULL;
+
+    pthread_mutex_lock(&tc->lock);
+    if (tc->count[id] != 0 && thread_chunks_usable(id)) {
+        it = tc->chunks[id][--tc->count[id]];
+    }
+    pthread_mutex_unlock(&tc->lock);
+    if (it == NULL)
+        return NULL;
+
+    slabclass_t *p = &root->slabclass[id];
+    it->it_flags &= ~ITEM_SLABBED;
+    mark_slab(getMySlabTable(), it, it->slab, id, getMyTimestamp(), getMyLastCollect(), 0);
+    slabs_count_write(id, it);
+    *total_chunks = p->slabs * p->perslab;
+    SLABS_REQUESTED_ADD(p, size);
+    MEMCACHED_SLABS_ALLOCATE(size, id, p->size, it);
+    return it;
+}
+
+/* Moves up to n chunks from the shared stack into the calling thread's
+ * cache, so the next allocations don't need slabs_lock. */
+static void thread_chunks_refill(unsigned int id) {
+    item *batch[THREAD_FREE_CHUNKS / 2];
+    unsigned int n = 0;
+    thread_chunks_t *tc = get_my_chunks();
+
+    if (tc == NULL || id < POWER_SMALLEST || id > root->power_largest)
+        return;
+
+    pthread_mutex_lock(&slabs_lock);
+    if (thread_chunks_usable(id)) {
+        chunk_stack_t *s = &free_chunks[id];
+        if (settings.numa) {
+            n = chunk_stack_take_local(s, thread_numa_node(), batch,
+                                       THREAD_FREE_CHUNKS / 2);
+        }
+        while (n < THREAD_FREE_CHUNKS / 2 && CHUNK_STACK_LEN(s) != 0) {
+            batch[n++] = chunk_stack_take(s);
+        }
+    }
+    pthread_mutex_unlock(&slabs_lock);
+    if (n == 0)
+        return;
+
+    pthread_mutex_lock(&tc->lock);
+    while (n != 0 && tc->count[id] < THREAD_FREE_CHUNKS && thread_chunks_usable(id)) {
+        tc->chunks[id][tc->count[id]++] = batch[--n];
+    }
+    pthread_mutex_unlock(&tc->lock);
+
+    if (n != 0) {
+        pthread_mutex_lock(&slabs_lock);
+        while (n != 0) {
+            do_slabs_free(batch[--n], 0, id);
+        }
+        pthread_mutex_unlock(&slabs_lock);
+    }
+}
+
+/* Frees a chunk into the calling thread's cache, spilling half of it to the
+ * shared stack when full. Returns false if the chunk must go to the shared
+ * stack directly. */
+static bool thread_chunks_free(void *ptr, const size_t size, unsigned int id) {
+    item *batch[THREAD_FREE_CHUNKS / 2];
+    unsigned int n = 0;
+    thread_chunks_t *tc;
+    item *it = (item *)ptr;
+
+    if (id < POWER_SMALLEST || id > root->power_largest)
+        return false;
+    /* Under FIFO freed chunks queue up behind every other free chunk */
+    if (settings.slab_alloc == SLAB_ALLOC_FIFO)
+        return false;
+    /* Chunks of another node go back to the shared stack for its workers */
+    if (settings.numa && !slabs_is_local(ptr, thread_numa_node()))
+        return false;
+    if ((tc = get_my_chunks()) == NULL)
+        return false;
+
+    pthread_mutex_lock(&tc->lock);
+    if (!thread_chunks_usable(id)) {
+        pthread_mutex_unlock(&tc->lock);
+        return false;
+    }
+    MEMCACHED_SLABS_FREE(size, id, ptr);
+    it->slabs_clsid = 0;
+    it->it_flags |= ITEM_SLABBED;
+    if (tc->count[id] == THREAD_FREE_CHUNKS) {
+        while (n < THREAD_FREE_CHUNKS / 2) {
+            batch[n++] = tc->chunks[id][--tc->count[id]];
+        }
+    }
+    tc->chunks[id][tc->count[id]++] = it;
+    pthread_mutex_unlock(&tc->lock);
+    SLABS_REQUESTED_ADD(&root->slabclass[id], -size);
+
+    if (n != 0) {
+        pthread_mutex_lock(&slabs_lock);
+        while (n != 0) {
+            do_slabs_free(batch[--n], 0, id);
+        }
+        pthread_mutex_unlock(&slabs_lock);
+    }
+    return true;
+}
+
+/* Returns the cached chunks of a class to its shared stack. Called with
+ * slabs_lock held. */
+static void do_thread_chunks_drain(const unsigned int id) {
+    thread_chunks_t *tc;
+    for (tc = all_thread_chunks; tc != NULL; tc = tc->next) {
+        pthread_mutex_lock(&tc->lock);
+        while (tc->count[id] != 0) {
+            chunk_stack_push(&free_chunks[id], tc->chunks[id][--tc->count[id]]);
+        }
+        pthread_mutex_unlock(&tc->lock);
+    }
+}
+#endif
+
+#ifdef NVM
+/*
+ * DRAM tier. With settings.dram_tier_size set, new items are carved from
+ * DRAM pages using the chunk sizes of the NVM classes, and the tier migrator
+ * in items.cpp moves them to NVM once they turn cold. Nothing here is
+ * persistent: items in the tier carry ITEM_DRAM and the index entries
+ * pointing at them are dropped on recovery. Pages are never given back, so
+ * a chunk pointer stays readable after its item is freed.
+ */
+typedef struct {
+    void **pages;               /* every page of the class, in carve order */
+    unsigned int npages;
+    unsigned int pages_size;
+    void *end_page_ptr;         /* next never-used chunk in the newest page */
+    unsigned int end_page_free;
+    chunk_stack_t free_chunks;
+} dram_class_t;
+
+static dram_class_t dram_classes[MAX_NUMBER_OF_SLAB_CLASSES]; /* under dram_lock */
+static pthread_mutex_t dram_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t dram_malloced = 0;    /* under dram_lock */
+static size_t dram_used = 0;        /* bytes in allocated chunks, atomic */
+
+static int do_slabs_dram_newpage(const unsigned int id) {
+    slabclass_t *p = &root->slabclass[id];
+    dram_class_t *d = &dram_classes[id];
+    size_t len = (size_t)p->size * p->perslab;
+    void *page;
+
+    if (dram_malloced + len > settings.dram_tier_size)
+        return 0;
+    if (d->npages == d->pages_size) {
+        unsigned int new_size = (d->pages_size != 0) ? d->pages_size * 2 : 16;
+        void **new_pages = (void **)realloc(d->pages, new_size * sizeof(void *));
+        if (new_pages == NULL)
+            return 0;
+        d->pages = new_pages;
+        d->pages_size = new_size;
+    }
+    if ((page = malloc(len)) == NULL)
+        return 0;
+
+    d->pages[d->npages++] = page;
+    d->end_page_ptr = page;
+    d->end_page_free = p->perslab;
+    dram_malloced += len;
+    return 1;
+}
+
+/* Allocates a chunk of class id in the DRAM tier, NULL if the tier is full */
+void *slabs_dram_alloc(size_t size, unsigned int id) {
+    dram_class_t *d;
+    item *it = NULL;
+
+    if (id < POWER_SMALLEST || id > root->power_largest)
+        return NULL;
+    d = &dram_classes[id];
+
+    pthread_mutex_lock(&dram_lock);
+    if (d->free_chunks.count != 0) {
+        it = d->free_chunks.chunks[--d->free_chunks.count];
+    } else if (d->end_page_free != 0 || do_slabs_dram_newpage(id)) {
+        it = (item *)d->end_page_ptr;
+        if (--d->end_page_free != 0) {
+            d->end_page_ptr = (char *)d->end_page_ptr + root->slabclass[id].size;
+        } else {
+            d->end_page_ptr = NULL;
+        }
+    }
+    pthread_mutex_unlock(&dram_lock);
+
+    if (it != NULL) {
+        memset(it, 0, sizeof(item));
+        __sync_fetch_and_add(&dram_used, root->slabclass[id].size);
+    }
+    return it;
+}
+
+void slabs_dram_free(void *ptr, size_t size, unsigned int id) {
+    item *it = (item *)ptr;
+
+    it->slabs_clsid = 0;
+    it->it_flags = ITEM_SLABBED | ITEM_DRAM;
+    pthread_mutex_lock(&dram_lock);
+    chunk_stack_push(&dram_classes[id].free_chunks, it);
+    pthread_mutex_unlock(&dram_lock);
+    __sync_fetch_and_sub(&dram_used, root->slabclass[id].size);
+}
+
+/* Bytes of the DRAM tier held by allocated chunks */
+size_t slabs_dram_used(void) {
+    return dram_used;
+}
+
+/* Number of chunks ever carved in a class of the DRAM tier */
+unsigned int slabs_dram_chunks(unsigned int id) {
+    unsigned int n;
+    pthread_mutex_lock(&dram_lock);
+    n = dram_classes[id].npages * root->slabclass[id].perslab
+        - dram_classes[id].end_page_free;
+    pthread_mutex_unlock(&dram_lock);
+    return n;
+}
+
+/* Chunk at index of a class of the DRAM tier, below slabs_dram_chunks() */
+item *slabs_dram_chunk(unsigned int id, unsigned int index) {
+    unsigned int perslab = root->slabclass[id].perslab;
+    item *it;
+    pthread_mutex_lock(&dram_lock);
+    it = (item *)((char *)dram_classes[id].pages[index / perslab]
+                  + (size_t)(index % perslab) * root->slabclass[id].size);
+    pthread_mutex_unlock(&dram_lock);
+    return it;
+}
+
+/* Whether ptr is in one of the pmemobj pools, i.e. survives a restart */
+bool slabs_is_persistent(const void *ptr) {
+    return slabs_pool_of(ptr) >= 0;
+}
+#endif
+
+#ifdef NVM
+/*
+ * CAS ids are leased in blocks by get_cas_id(). The high-water mark is kept
+ * in a file of its own next to the first slab pool, which slabs_pool_open()
+ * does not remove, and is persisted before any id of the block is used. Ids
+ * issued after a restart are thus above all those of earlier runs, and a
+ * client can't match a CAS it got before the restart.
+ */
+#define CAS_HIGH_FILE_SIZE 4096
+
+static uint64_t *cas_high;
+static int cas_high_is_pmem;
+static pthread_mutex_t cas_lease_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void cas_high_open(const char *dir) {
+    char path[PATH_MAX];
+    size_t len;
+
+    snprintf(path, sizeof(path), "%s/cas_high", dir);
+    cas_high = (uint64_t *)pmem_map_file(path, CAS_HIGH_FILE_SIZE, PMEM_FILE_CREATE,
+                                         S_IWUSR | S_IRUSR, &len, &cas_high_is_pmem);
+    if (cas_high == NULL) {
+        fprintf(stderr, "failed to map %s\n", path);
+        exit(1);
+    }
+}
+
+uint64_t slabs_cas_lease(uint64_t n) {
+    uint64_t first;
+
+    pthread_mutex_lock(&cas_lease_lock);
+    first = *cas_high + 1;
+    *cas_high += n;
+    if (cas_high_is_pmem)
+        pmem_persist(cas_high, sizeof(*cas_high));
+    else
+        pmem_msync(cas_high, sizeof(*cas_high));
+    pthread_mutex_unlock(&cas_lease_lock);
+    return first;
+}
+#else
+uint64_t slabs_cas_lease(uint64_t n) {
+    static uint64_t cas_high = 0;
+    return __atomic_fetch_add(&cas_high, n, __ATOMIC_RELAXED) + 1;
+}
+#endif
+
+#ifdef NVM
+/*
+ * Log-structured engine. With settings.engine == ENGINE_LOG items are not
+ * kept in slab classes: each thread appends them to its own open segment, a
+ * large block from the pools filled strictly front to back. Classes are
+ * still used to size items and for stats, but own no pages.
+ *
+ * The persistent state is the segment header and, in each entry, the slab
+ * and slabs_index fields of the item header, which hold the segment and the
+ * entry length. Segments are chained from root->log_head, so recovery walks
+ * every segment up to its used mark. Everything else lives in DRAM: live
+ * bytes per segment, the free segment stack and the open segment of each
+ * thread.
+ *
+ * A segment is sealed once full. Freed entries only lower its live count,
+ * and a sealed segment whose live count drops to zero is reused. Entries are
+ * released through the item free lists, so by then no reader holds them. The
+ * cleaner in items.cpp claims sealed segments, copies their live items to its
+ * own segment or evicts them, then hands the segments back.
+ */
+#define LOG_SEGMENT_MIN     (4 * 1024 * 1024)
+
+enum log_seg_state { LOG_FREE = 0, LOG_OPEN, LOG_SEALED, LOG_CLEANING };
+
+typedef struct _log_segment {
+    struct _log_segment *next;  /* chain of all segments, for recovery */
+    uint64_t seq;               /* order segments were opened in */
+    uint32_t id;                /* slot in log_segs, rebuilt on recovery */
+    uint32_t used;              /* bytes appended, header included */
+} log_segment_t;
+
+typedef struct {
+    log_segment_t *seg;
+    uint32_t live;              /* bytes of entries not yet freed, atomic */
+    volatile int state;         /* enum log_seg_state, changed by CAS */
+} log_seg_t;
+
+static log_seg_t *log_segs = NULL;
+static unsigned int log_nsegs = 0;      /* allocated so far, under log_lock */
+static unsigned int log_max_segs = 0;
+static uint32_t log_seg_size = 0;
+static unsigned int *log_free = NULL;   /* free segment stack, under log_lock */
+static unsigned int log_nfree = 0;
+static uint64_t log_seq = 0;            /* under log_lock */
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread log_seg_t *my_log_seg = NULL;
+
+#define LOG_ENTRY_SIZE(n) (((n) + CHUNK_ALIGN_BYTES - 1) & ~(size_t)(CHUNK_ALIGN_BYTES - 1))
+
+static PMEMobjpool *log_pool_of(const void *ptr) {
+    int k = slabs_pool_of(ptr);
+    return k >= 0 ? pools[k] : pop;
+}
+
+static void slabs_log_init(const size_t limit) {
+    size_t budget = limit ? limit : num_pools * settings.slabs_pool_size;
+
+    log_seg_size = LOG_SEGMENT_MIN;
+    if ((uint32_t)settings.item_size_max * 2 > log_seg_size)
+        log_seg_size = settings.item_size_max * 2;
+    log_max_segs = budget / log_seg_size + 1;
+    log_segs = (log_seg_t *)calloc(log_max_segs, sizeof(log_seg_t));
+    log_free = (unsigned int *)calloc(log_max_segs, sizeof(unsigned int));
+    if (log_segs == NULL || log_free == NULL) {
+        fprintf(stderr, "Failed to init the log segment tables\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Marks a sealed segment free once nothing in it is live. Whoever wins the
+ * CAS pushes it, so a racing free and seal can't both do it. */
+static void log_try_free(log_seg_t *s) {
+    if (s->live == 0 && __sync_bool_compare_and_swap(&s->state, LOG_SEALED, LOG_FREE)) {
+        pthread_mutex_lock(&log_lock);
+        log_free[log_nfree++] = s->seg->id;
+        pthread_mutex_unlock(&log_lock);
+    }
+}
+
+/* Takes a free segment, or allocates a new one while under the memory
+ * limit, and makes it the calling thread's open segment. */
+static log_seg_t *log_open_segment(void) {
+    log_seg_t *s = NULL;
+    log_segment_t *seg;
+
+    pthread_mutex_lock(&log_lock);
+    if (log_nfree != 0) {
+        s = &log_segs[log_free[--log_nfree]];
+    } else if (log_nsegs < log_max_segs) {
+        pthread_mutex_lock(&slabs_lock);
+        if (!root->mem_limit || root->mem_malloced + log_seg_size <= root->mem_limit) {
+            seg = (log_segment_t *)slabs_pool_alloc(log_seg_size);
+            if (seg != NULL) {
+                root->mem_malloced += log_seg_size;
+                pmemobj_persist(pop, &root->mem_malloced, sizeof(root->mem_malloced));
+                /* A crash before the head is updated leaks the segment */
+                seg->next = (log_segment_t *)root->log_head;
+                seg->seq = 0;
+                seg->id = log_nsegs;
+                seg->used = LOG_ENTRY_SIZE(sizeof(log_segment_t));
+                pmemobj_persist(log_pool_of(seg), seg, sizeof(*seg));
+                root->log_head = seg;
+                pmemobj_persist(pop, &root->log_head, sizeof(root->log_head));
+                s = &log_segs[log_nsegs++];
+                s->seg = seg;
+            }
+        } else {
+            root->mem_limit_reached = true;
+        }
+        pthread_mutex_unlock(&slabs_lock);
+    }
+    if (s != NULL) {
+        seg = s->seg;
+        seg->seq = ++log_seq;
+        seg->used = LOG_ENTRY_SIZE(sizeof(log_segment_t));
+        pmemobj_persist(log_pool_of(seg), &seg->seq,
+                        sizeof(seg->seq) + sizeof(seg->id) + sizeof(seg->used));
+        s->live = 0;
+        s->state = LOG_OPEN;
+    }
+    pthread_mutex_unlock(&log_lock);
+    return s;
+}
+
+static void log_seal(log_seg_t *s) {
+    s->state = LOG_SEALED;
+    __sync_synchronize();
+    log_try_free(s);
+}
+
+/* Appends an entry of class id to the calling thread's open segment, NULL if
+ * no segment can be had. The entry length goes to it->slabs_index so that
+ * recovery and the cleaner can step through a segment. */
+void *slabs_log_alloc(size_t size, unsigned int id) {
+    log_seg_t *s = my_log_seg;
+    log_segment_t *seg;
+    item *it;
+
+    size = LOG_ENTRY_SIZE(size);
+    if (size > log_seg_size - LOG_ENTRY_SIZE(sizeof(log_segment_t)))
+        return NULL;
+    if (s == NULL || s->state != LOG_OPEN || s->seg->used + size > log_seg_size) {
+        if (s != NULL && s->state == LOG_OPEN)
+            log_seal(s);
+        if ((s = my_log_seg = log_open_segment()) == NULL)
+            return NULL;
+    }
+
+    seg = s->seg;
+    it = (item *)((char *)seg + seg->used);
+    memset(it, 0, sizeof(item));
+    it->slab = seg;
+    it->slabs_index = size;
+    pmemobj_persist(log_pool_of(seg), &it->slab, sizeof(it->slab) + sizeof(it->slabs_index));
+    seg->used += size;
+    pmemobj_persist(log_pool_of(seg), &seg->used, sizeof(seg->used));
+    __sync_fetch_and_add(&s->live, size);
+
+    mark_slab(getMySlabTable(), it, it->slab, id, getMyTimestamp(), getMyLastCollect(), 0);
+    SLABS_REQUESTED_ADD(&root->slabclass[id], size);
+    MEMCACHED_SLABS_ALLOCATE(size, id, size, it);
+    return it;
+}
+
+static void slabs_log_free(void *ptr, unsigned int id) {
+    item *it = (item *)ptr;
+    log_seg_t *s = &log_segs[((log_segment_t *)it->slab)->id];
+
+    MEMCACHED_SLABS_FREE(it->slabs_index, id, ptr);
+    it->slabs_clsid = 0;
+    it->it_flags |= ITEM_SLABBED;
+    SLABS_REQUESTED_ADD(&root->slabclass[id], -(size_t)it->slabs_index);
+    if (__sync_sub_and_fetch(&s->live, it->slabs_index) == 0)
+        log_try_free(s);
+}
+
+/* Claims a sealed segment for the cleaner: the one with the least live data
+ * if it is below pct percent live, otherwise with pct == 100 the oldest.
+ * NULL if there is none. Give it back with slabs_log_release(). */
+void *slabs_log_claim(unsigned int pct) {
+    log_seg_t *best = NULL;
+    unsigned int i, n;
+
+    pthread_mutex_lock(&log_lock);
+    n = log_nsegs;
+    pthread_mutex_unlock(&log_lock);
+    for (i = 0; i < n; i++) {
+        log_seg_t *s = &log_segs[i];
+        if (s->state != LOG_SEALED)
+            continue;
+        if (pct < 100) {
+            if ((uint64_t)s->live * 100 < (uint64_t)s->seg->used * pct &&
+                (best == NULL || s->live < best->live))
+                best = s;
+        } else if (best == NULL || s->seg->seq < best->seg->seq) {
+            best = s;
+        }
+    }
+    if (best == NULL || !__sync_bool_compare_and_swap(&best->state, LOG_SEALED, LOG_CLEANING))
+        return NULL;
+    return best->seg;
+}
+
+void slabs_log_release(void *ptr) {
+    log_seg_t *s = &log_segs[((log_segment_t *)ptr)->id];
+    s->state = LOG_SEALED;
+    __sync_synchronize();
+    log_try_free(s);
+}
+
+/* Steps through the entries of a claimed segment: the first one when it is
+ * NULL, NULL after the last. */
+item *slabs_log_next(void *ptr, item *it) {
+    log_segment_t *seg = (log_segment_t *)ptr;
+    char *next;
+
+    if (it != NULL && it->slabs_index == 0)
+        return NULL;    /* torn entry, nothing valid follows */
+    next = (it == NULL) ? (char *)seg + LOG_ENTRY_SIZE(sizeof(log_segment_t))
+                        : (char *)it + it->slabs_index;
+
+    return (next < (char *)seg + seg->used) ? (item *)next : NULL;
+}
+
+/* Segments that can be opened without reclaiming anything */
+unsigned int slabs_log_spare_segments(void) {
+    unsigned int n;
+    size_t room = 0;
+
+    pthread_mutex_lock(&log_lock);
+    n = log_nfree;
+    if (root->mem_limit > root->mem_malloced)
+        room = (root->mem_limit - root->mem_malloced) / log_seg_size;
+    if (room > log_max_segs - log_nsegs)
+        room = log_max_segs - log_nsegs;
+    pthread_mutex_unlock(&log_lock);
+    return n + room;
+}
+
+/* Rebuilds the DRAM side of the log from the segment chain: entries still
+ * in the index are live, everything else is released. Segments that were
+ * open become sealed. */
+static void slabs_log_recover(ht_intset_t* ht) {
+    log_segment_t *seg;
+    uint32_t n = 0;
+
+    log_nfree = 0;
+    for (seg = (log_segment_t *)root->log_head; seg != NULL && n < log_max_segs; seg = seg->next) {
+        log_seg_t *s = &log_segs[n];
+        item *it;
+
+        if (seg->id != n) {
+            seg->id = n;
+            pmemobj_persist(log_pool_of(seg), &seg->id, sizeof(seg->id));
+        }
+        s->seg = seg;
+        s->live = 0;
+        for (it = slabs_log_next(seg, NULL); it != NULL; it = slabs_log_next(seg, it)) {
+            if ((it->it_flags & ITEM_SLABBED) == 0 && item_is_reachable(ht, (void*)it)) {
+                s->live += it->slabs_index;
+            } else {
+                it->it_flags |= ITEM_SLABBED;
+                it->slabs_clsid = 0;
+            }
+        }
+        if (seg->seq > log_seq)
+            log_seq = seg->seq;
+        if (s->live == 0) {
+            s->state = LOG_FREE;
+            log_free[log_nfree++] = n;
+        } else {
+            s->state = LOG_SEALED;
+        }
+        n++;
+    }
+    log_nsegs = n;
+}
+#endif
+
+void slabs_recover(ht_intset_t* ht) {
     slabclass_t* p;
     size_t i,j,k;
-    size_t num_slabs;
-    slab_descriptor_t* crt;
+    size_t num_chunks;
     char* current_address;
 
-    for (i = 0; i < num_threads; i++) {
-        num_slabs = slab_tables[i]->last_in_use;
-        crt = slab_tables[i]->slabs;
-        for (j = 0; j < num_slabs; j++) {
-            current_address = (char*)crt[j].slab;
-            if (current_address != NULL) {
-                p = &root->slabclass[crt[j].slabs_clsid];            
-                for (k = 0; k < p->perslab; k++) {
-                    item* it = (item*)current_address;
-                    if ((it->it_flags & ITEM_SLABBED) == 0) {
-                        if (!item_is_reachable(ht, (void*)it)) {
-
-                            // remove it from whatever list it is in
-                            if (it->prev) {
-                                it->prev->next = it->next;
-                            }
-                            if (it->next) {
-                                it->next->prev = it->prev;
-                            }
-                            // add item to slots
-                            it->prev = 0;
-                            it->next = (item*)p->slots;
-                            if (it->next) it->next->prev = it;
-                            p->slots = it;
-                            // mark item slabbed
-                            it->it_flags |= ITEM_SLABBED;
-                        }
-                    }
-                    current_address += p->size;
+    if (settings.engine == ENGINE_LOG) {
+        slabs_log_recover(ht);
+        return;
+    }
+
+    // Everything below the high-water mark of a class is visible to the clock
+    for (i = POWER_SMALLEST; i <= root->power_largest; i++) {
+        p = &root->slabclass[i];
+        p->clock_slots = p->slabs * p->perslab - p->end_page_free;
+        p->clock_hand = 0;
+    }
+
+    // Free lists only live in DRAM: rebuild them from every carved chunk.
+    // Any chunk below the high-water mark that the index can't reach is
+    // garbage, whether it was being filled at the crash or its page was
+    // never in an active slab table, so it is freed here as well.
+    for (i = POWER_SMALLEST; i <= root->power_largest; i++) {
+        p = &root->slabclass[i];
+        free_chunks[i].head = free_chunks[i].count = 0;
+        for (j = 0; j < p->slabs; j++) {
+            current_address = (char*)SLAB_LIST_ENTRY(p, j);
+            num_chunks = p->perslab;
+            if (j == p->slabs - 1) {
+                num_chunks -= p->end_page_free;
+            }
+            for (k = 0; k < num_chunks; k++) {
+                item* it = (item*)current_address;
+                if ((it->it_flags & ITEM_SLABBED) == 0 &&
+                    !item_is_reachable(ht, (void*)it)) {
+                    it->it_flags |= ITEM_SLABBED;
+                    it->slabs_clsid = 0;
                 }
+                if (it->it_flags & ITEM_SLABBED) {
+                    chunk_stack_push(&free_chunks[i], it);
+                }
+                current_address += p->size;
             }
         }
     }
@@ -469,11 +1504,11 @@ bool get_stats(const char *stat_type, int nkey, ADD_STAT add_stats, void *c) {
     if (add_stats != NULL) {
         if (!stat_type) {
             /* prepare general statistics for the engine */
-            STATS_LOCK();
-            APPEND_STAT("bytes", "%llu", (unsigned long long)stats.curr_bytes);
-            APPEND_STAT("curr_items", "%u", stats.curr_items);
-            APPEND_STAT("total_items", "%u", stats.total_items);
-            STATS_UNLOCK();
+            uint64_t curr_items, total_items, curr_bytes;
+            item_counts(&curr_items, &total_items, &curr_bytes);
+            APPEND_STAT("bytes", "%llu", (unsigned long long)curr_bytes);
+            APPEND_STAT("curr_items", "%llu", (unsigned long long)curr_items);
+            APPEND_STAT("total_items", "%llu", (unsigned long long)total_items);
             item_stats_totals(add_stats, c);
         } else if (nz_strcmp(nkey, stat_type, "items") == 0) {
             item_stats(add_stats, c);
@@ -514,11 +1549,32 @@ static void do_slabs_stats(ADD_STAT add_stats, void *c) {
             APPEND_NUM_STAT(i, "chunks_per_page", "%u", perslab);
             APPEND_NUM_STAT(i, "total_pages", "%u", slabs);
             APPEND_NUM_STAT(i, "total_chunks", "%u", slabs * perslab);
+#ifdef NVM
+            uint32_t free_cnt = do_slabs_free_chunks(i);
+#else
+            uint32_t free_cnt = p->sl_curr;
+#endif
             APPEND_NUM_STAT(i, "used_chunks", "%u",
-                            slabs*perslab - p->sl_curr);
-            APPEND_NUM_STAT(i, "free_chunks", "%u", p->sl_curr);
-            /* Stat is dead, but displaying zero instead of removing it. */
-            APPEND_NUM_STAT(i, "free_chunks_end", "%u", 0);
+                            slabs*perslab - free_cnt - p->end_page_free);
+            APPEND_NUM_STAT(i, "free_chunks", "%u", free_cnt);
+            APPEND_NUM_STAT(i, "free_chunks_end", "%u", p->end_page_free);
+#ifdef NVM
+            {
+                uint64_t writes = 0;
+                uint32_t wmin = 0, wmax = 0;
+                unsigned int pg;
+                for (pg = 0; pg < slabs; pg++) {
+                    uint32_t *seg = page_writes[i][pg / SLAB_LIST_SEG_SIZE];
+                    uint32_t w = (seg != NULL) ? seg[pg % SLAB_LIST_SEG_SIZE] : 0;
+                    writes += w;
+                    if (pg == 0 || w < wmin) wmin = w;
+                    if (w > wmax) wmax = w;
+                }
+                APPEND_NUM_STAT(i, "chunk_writes", "%llu", (unsigned long long)writes);
+                APPEND_NUM_STAT(i, "page_writes_min", "%u", wmin);
+                APPEND_NUM_STAT(i, "page_writes_max", "%u", wmax);
+            }
+#endif
             APPEND_NUM_STAT(i, "mem_requested", "%llu",
                             (unsigned long long)p->requested);
             APPEND_NUM_STAT(i, "get_hits", "%llu",
@@ -545,50 +1601,121 @@ static void do_slabs_stats(ADD_STAT add_stats, void *c) {
 
     APPEND_STAT("active_slabs", "%d", total);
     APPEND_STAT("total_malloced", "%llu", (unsigned long long)root->mem_malloced);
+#ifdef NVM
+    if (settings.dram_tier_size != 0) {
+        APPEND_STAT("dram_tier_malloced", "%llu", (unsigned long long)dram_malloced);
+        APPEND_STAT("dram_tier_used", "%llu", (unsigned long long)dram_used);
+    }
+    if (settings.engine == ENGINE_LOG) {
+        /* log_lock nests outside slabs_lock, so read without it */
+        uint64_t used = 0, live = 0;
+        unsigned int n = log_nsegs, k;
+        for (k = 0; k < n; k++) {
+            if (log_segs[k].state != LOG_FREE) {
+                used += log_segs[k].seg->used;
+                live += log_segs[k].live;
+            }
+        }
+        APPEND_STAT("log_segment_size", "%u", log_seg_size);
+        APPEND_STAT("log_segments", "%u", n);
+        APPEND_STAT("log_segments_free", "%u", log_nfree);
+        APPEND_STAT("log_bytes_used", "%llu", (unsigned long long)used);
+        APPEND_STAT("log_bytes_live", "%llu", (unsigned long long)live);
+    }
+#endif
+    if (num_pools > 1) {
+        char key_str[STAT_KEY_LEN];
+        char val_str[STAT_VAL_LEN];
+        int klen = 0, vlen = 0;
+        unsigned int k;
+        for (k = 0; k < num_pools; k++) {
+            APPEND_NUM_FMT_STAT("pool_%d:%s", k, "malloced", "%llu",
+                                (unsigned long long)pool_malloced[k]);
+        }
+    }
     add_stats(NULL, 0, NULL, 0, c);
 }
 
+/* Called outside of any transaction, see do_slabs_newslab() */
 static void *memory_allocate(size_t size) {
     void *ret;
 
-    TX_BEGIN(pop) {
-        if (root->mem_base == NULL) {
-            /* We are not using a preallocated large memory chunk */
-            ret = (void*)D_RW(TX_ALLOC(char, size));
-        } else {
-            ret = root->mem_current;
+    if (root->mem_base == NULL) {
+        /* We are not using a preallocated large memory chunk */
+        return slabs_pool_alloc(size);
+    }
 
-            if (size > root->mem_avail) {
-                return NULL;
-            }
+    /* mem_current pointer _must_ be aligned!!! */
+    if (size % CHUNK_ALIGN_BYTES) {
+        size += CHUNK_ALIGN_BYTES - (size % CHUNK_ALIGN_BYTES);
+    }
+    if (size > root->mem_avail) {
+        return NULL;
+    }
 
-            /* mem_current pointer _must_ be aligned!!! */
-            if (size % CHUNK_ALIGN_BYTES) {
-                size += CHUNK_ALIGN_BYTES - (size % CHUNK_ALIGN_BYTES);
-            }
+    ret = root->mem_current;
+    TX_BEGIN(pop) {
+        TX_ADD_DIRECT(&root->mem_current);
+        TX_ADD_DIRECT(&root->mem_avail);
+        root->mem_current = ((char*)root->mem_current) + size;
+        root->mem_avail -= size;
+    } TX_END
+    return ret;
+}
 
-            root->mem_current = ((char*)root->mem_current) + size;
-            if (size < root->mem_avail) {
-                root->mem_avail -= size;
-            } else {
-                root->mem_avail = 0;
-            }
-        }
+/* Hands back a page memory_allocate() returned but nobody linked */
+static void memory_release(void *ptr, size_t size) {
+    int k;
 
-    } TX_END 
-    return ret;
+    if (root->mem_base == NULL) {
+        PMEMoid oid = pmemobj_oid(ptr);
+        if ((k = slabs_pool_of(ptr)) >= 0)
+            pool_malloced[k] -= size;
+        pmemobj_free(&oid);
+        return;
+    }
+
+    /* Only the most recent carve can go back to the preallocated chunk */
+    if (size % CHUNK_ALIGN_BYTES) {
+        size += CHUNK_ALIGN_BYTES - (size % CHUNK_ALIGN_BYTES);
+    }
+    if ((char *)ptr + size != (char *)root->mem_current)
+        return;
+    TX_BEGIN(pop) {
+        TX_ADD_DIRECT(&root->mem_current);
+        TX_ADD_DIRECT(&root->mem_avail);
+        root->mem_current = ptr;
+        root->mem_avail += size;
+    } TX_END
 }
 
 void *slabs_alloc(size_t size, unsigned int id, unsigned int *total_chunks) {
     void *ret;
 
+#ifdef NVM
+    if ((ret = thread_chunks_alloc(size, id, total_chunks)) != NULL)
+        return ret;
+#endif
     pthread_mutex_lock(&slabs_lock);
     ret = do_slabs_alloc(size, id, total_chunks);
     pthread_mutex_unlock(&slabs_lock);
+#ifdef NVM
+    /* Our cache is empty; grab a batch while the shared stack has some */
+    if (ret != NULL && CHUNK_STACK_LEN(&free_chunks[id]) != 0)
+        thread_chunks_refill(id);
+#endif
     return ret;
 }
 
 void slabs_free(void *ptr, size_t size, unsigned int id) {
+#ifdef NVM
+    if (settings.engine == ENGINE_LOG) {
+        slabs_log_free(ptr, id);
+        return;
+    }
+    if (thread_chunks_free(ptr, size, id))
+        return;
+#endif
     pthread_mutex_lock(&slabs_lock);
     do_slabs_free(ptr, size, id);
     pthread_mutex_unlock(&slabs_lock);
@@ -621,7 +1748,11 @@ unsigned int slabs_available_chunks(const unsigned int id, bool *mem_flag,
 
     pthread_mutex_lock(&slabs_lock);
     p = &root->slabclass[id];
-    ret = p->sl_curr;
+#ifdef NVM
+    ret = do_slabs_free_chunks(id) + p->end_page_free;
+#else
+    ret = p->sl_curr + p->end_page_free;
+#endif
     if (mem_flag != NULL)
         *mem_flag = root->mem_limit_reached;
     if (total_chunks != NULL)
@@ -631,22 +1762,26 @@ unsigned int slabs_available_chunks(const unsigned int id, bool *mem_flag,
 }
 
 #ifdef NVM
-static inline int clock_get_bit(TOID(char) bitmap, unsigned int index) {
-    unsigned int byte_index = index >> 3;  // index / 8
+// Byte of the segmented bitmap holding the bit for slot index
+static inline char* clock_byte(slabclass_t* p, unsigned int index) {
+    unsigned int seg = clock_seg(p, index);
+    unsigned int byte_index = (index - clock_seg_start(p, seg)) >> 3;  // index / 8
+    return D_RW(p->bitmap[seg]) + byte_index;
+}
+
+static inline int clock_get_bit(slabclass_t* p, unsigned int index) {
     char mask = 1 << (index & 7);          // index % 8
-    return D_RW(bitmap)[byte_index] & mask;
+    return *clock_byte(p, index) & mask;
 }
 
-static inline void clock_set_bit(TOID(char) bitmap, unsigned int index) {
-    unsigned int byte_index = index >> 3;
+static inline void clock_set_bit(slabclass_t* p, unsigned int index) {
     char mask = 1 << (index & 7);
-    D_RW(bitmap)[byte_index] |= mask;
+    *clock_byte(p, index) |= mask;
 }
 
-static inline void clock_reset_bit(TOID(char) bitmap, unsigned int index) {
-    unsigned int byte_index = index >> 3;
+static inline void clock_reset_bit(slabclass_t* p, unsigned int index) {
     char mask = ~(1 << (index & 7));
-    D_RW(bitmap)[byte_index] &= mask;
+    *clock_byte(p, index) &= mask;
 }
 
 static void* slabs_get_slot_at_index(unsigned int index, unsigned int id) {
@@ -657,7 +1792,8 @@ static void* slabs_get_slot_at_index(unsigned int index, unsigned int id) {
     unsigned int slab_index = index / p->perslab;
     unsigned int slot_index = index % p->perslab;
 
-    char* ret = (char*)D_RW(p->slab_list)[slab_index] + slot_index*p->size;
+    char* ret = (char*)__atomic_load_n(&SLAB_LIST_ENTRY(p, slab_index), __ATOMIC_ACQUIRE) +
+        slot_index*p->size;
 
     return (void*)ret;
 }
@@ -682,6 +1818,9 @@ static short firstzero[256] = {
 };
 
 void clock_update(item* it) {
+    /* log segments are reclaimed by the cleaner, not the clock */
+    if (settings.engine == ENGINE_LOG)
+        return;
     unsigned int id = ITEM_clsid(it);
     assert(id >= POWER_SMALLEST && id <= root->power_largest);
     if (id < POWER_SMALLEST || id > root->power_largest)
@@ -689,16 +1828,28 @@ void clock_update(item* it) {
 
     slabclass_t* p = &root->slabclass[id];
 
-    clock_set_bit(p->bitmap, it->slabs_index);
+    clock_set_bit(p, it->slabs_index);
+}
+
+/* Whether the item was accessed since the clock hand last passed it */
+bool clock_is_referenced(item* it) {
+    unsigned int id = ITEM_clsid(it);
+    if (id < POWER_SMALLEST || id > root->power_largest)
+        return false;
+
+    return clock_get_bit(&root->slabclass[id], it->slabs_index) != 0;
 }
 
 item* clock_get_victim(unsigned int id) {
     slabclass_t* p = &root->slabclass[id];
 
-    pthread_mutex_lock(&slabs_lock);
+    // Only the clock hand needs a lock: bitmap segments below clock_slots
+    // are never moved or freed.
+    pthread_mutex_lock(&clock_locks[id]);
 
+    // Never-carved chunks at the end of the newest page hold no item
     //unsigned 
-    int total_slots = p->slabs * p->perslab;
+    int total_slots = p->clock_slots;
     assert(p->clock_hand < total_slots);
     
 
@@ -714,8 +1865,8 @@ item* clock_get_victim(unsigned int id) {
         if (slots_left < 8) {
             while (slots_left>0) {
 
-                if (clock_get_bit(p->bitmap, p->clock_hand)) {
-                    clock_reset_bit(p->bitmap, p->clock_hand);
+                if (clock_get_bit(p, p->clock_hand)) {
+                    clock_reset_bit(p, p->clock_hand);
                 } else {
                     victim_found = 1;
                     break;
@@ -732,8 +1883,8 @@ item* clock_get_victim(unsigned int id) {
         // Search until the end of current byte (if clock_hand % 8 != 0)
         while ((p->clock_hand & 0x7) != 0) {
 
-            if (clock_get_bit(p->bitmap, p->clock_hand)) {
-                clock_reset_bit(p->bitmap, p->clock_hand);
+            if (clock_get_bit(p, p->clock_hand)) {
+                clock_reset_bit(p, p->clock_hand);
             } else {
                 victim_found = 1;
                 break;
@@ -745,10 +1896,11 @@ item* clock_get_victim(unsigned int id) {
 
 
         int found_in_64 = 0;
-        // Search in 64bit increments until 0 is found
+        // Search in 64bit increments until 0 is found, never reading across
+        // the end of a bitmap segment
         slots_left = total_slots - p->clock_hand;// - 1;
-        while (slots_left >= 64) {
-            uint64_t* val64 = (uint64_t*)(D_RW(p->bitmap) + (p->clock_hand >> 3));
+        while (slots_left >= 64 && clock_seg_left(p, p->clock_hand) >= 64) {
+            uint64_t* val64 = (uint64_t*)clock_byte(p, p->clock_hand);
             if (*val64 == (uint64_t)-1) {
                 *val64 = 0;
                 p->clock_hand += 64;
@@ -767,7 +1919,7 @@ item* clock_get_victim(unsigned int id) {
 
         // Search in byte increments until 0 is found
         while (slots_left >= 8) {
-            uint8_t* val8 = (uint8_t*)(D_RW(p->bitmap) + (p->clock_hand >> 3));
+            uint8_t* val8 = (uint8_t*)clock_byte(p, p->clock_hand);
             if (*val8 == (uint8_t)-1) {
                 *val8 = 0;
                 p->clock_hand += 8;
@@ -791,7 +1943,7 @@ item* clock_get_victim(unsigned int id) {
 
     item* it = (item*)slabs_get_slot_at_index(p->clock_hand, id);
 
-    pthread_mutex_unlock(&slabs_lock);
+    pthread_mutex_unlock(&clock_locks[id]);
 
     return it;
 }
@@ -822,6 +1974,11 @@ static int slab_rebalance_start(void) {
     if (!grow_slab_list(slab_rebal.d_clsid)) {
         no_go = -1;
     }
+#ifdef NVM
+    if (!clock_grow_bitmap(slab_rebal.d_clsid)) {
+        no_go = -1;
+    }
+#endif
 
     if (s_cls->slabs < 2)
         no_go = -3;
@@ -833,12 +1990,34 @@ static int slab_rebalance_start(void) {
 
     s_cls->killing = 1;
 
-    slab_rebal.slab_start = D_RW(s_cls->slab_list)[s_cls->killing - 1];
+    slab_rebal.slab_start = SLAB_LIST_ENTRY(s_cls, s_cls->killing - 1);
     slab_rebal.slab_end   = (char *)slab_rebal.slab_start +
         (s_cls->size * s_cls->perslab);
     slab_rebal.slab_pos   = slab_rebal.slab_start;
     slab_rebal.done       = 0;
 
+#ifdef NVM
+    /* Pull the page's free chunks off the DRAM free lists; chunks freed into
+     * it from now on are dropped by do_slabs_free(). */
+    {
+        chunk_stack_t *fs = &free_chunks[slab_rebal.s_clsid];
+        unsigned int x, kept = 0;
+        do_thread_chunks_drain(slab_rebal.s_clsid);
+        for (x = fs->head; x < fs->count; x++) {
+            item *it = fs->chunks[x];
+            if ((void *)it >= slab_rebal.slab_start &&
+                (void *)it < slab_rebal.slab_end) {
+                it->it_flags = 0;
+                it->slabs_clsid = 255;
+            } else {
+                fs->chunks[kept++] = it;
+            }
+        }
+        fs->head = 0;
+        fs->count = kept;
+    }
+#endif
+
     /* Also tells do_item_get to search for items in this slab */
     slab_rebalance_signal = 2;
 
@@ -897,6 +2076,7 @@ static int slab_rebalance_move(void) {
         if (it->slabs_clsid != 255) {
             /* ITEM_SLABBED can only be added/removed under the slabs_lock */
             if (it->it_flags & ITEM_SLABBED) {
+#ifndef NVM
                 /* remove from slab freelist */
                 if (s_cls->slots == it) {
                     s_cls->slots = it->next;
@@ -904,6 +2084,9 @@ static int slab_rebalance_move(void) {
                 if (it->next) it->next->prev = it->prev;
                 if (it->prev) it->prev->next = it->next;
                 s_cls->sl_curr--;
+#endif
+                /* With NVM the DRAM free lists dropped this page's chunks
+                 * in slab_rebalance_start() */
                 status = MOVE_FROM_SLAB;
             } else if ((it->it_flags & ITEM_LINKED) != 0) {
                 /* If it doesn't have ITEM_SLABBED, the item could be in any
@@ -998,17 +2181,36 @@ static void slab_rebalance_finish(void) {
     s_cls = &root->slabclass[slab_rebal.s_clsid];
     d_cls   = &root->slabclass[slab_rebal.d_clsid];
 
-    /* At this point the stolen slab is completely clear */
-    D_RW(s_cls->slab_list)[s_cls->killing - 1] =
-         D_RW(s_cls->slab_list)[s_cls->slabs - 1];
+    /* At this point the stolen slab is completely clear. The source's newest
+     * page may be the one swapped into its slot, so drain its tail first. */
+    do_slabs_retire_end_page(slab_rebal.s_clsid);
+    SLAB_LIST_PUBLISH(s_cls, s_cls->killing - 1,
+                      SLAB_LIST_ENTRY(s_cls, s_cls->slabs - 1));
+#ifdef NVM
+    if (s_cls->killing != s_cls->slabs)
+        do_slabs_reindex_page(slab_rebal.s_clsid, s_cls->killing - 1);
+    page_writes_move(slab_rebal.s_clsid, s_cls->slabs - 1, s_cls->killing - 1);
+#endif
     s_cls->slabs--;
     s_cls->killing = 0;
+#ifdef NVM
+    pthread_mutex_lock(&clock_locks[slab_rebal.s_clsid]);
+    s_cls->clock_slots = s_cls->slabs * s_cls->perslab;
+    if (s_cls->clock_hand >= s_cls->clock_slots)
+        s_cls->clock_hand = 0;
+    pthread_mutex_unlock(&clock_locks[slab_rebal.s_clsid]);
+#endif
 
-    memset(slab_rebal.slab_start, 0, (size_t)settings.item_size_max);
-
-    D_RW(d_cls->slab_list)[d_cls->slabs++] = slab_rebal.slab_start;
-    split_slab_page_into_freelist((char*)slab_rebal.slab_start,
-        slab_rebal.d_clsid);
+    /* The stolen page becomes the newest page of the destination class and
+     * is carved lazily from there. */
+    do_slabs_retire_end_page(slab_rebal.d_clsid);
+    d_cls->end_page_ptr = slab_rebal.slab_start;
+    d_cls->end_page_free = d_cls->perslab;
+#ifdef NVM
+    page_writes_grow(slab_rebal.d_clsid);
+#endif
+    SLAB_LIST_PUBLISH(d_cls, d_cls->slabs, slab_rebal.slab_start);
+    d_cls->slabs++;
 
     slab_rebal.done       = 0;
     slab_rebal.s_clsid    = 0;
@@ -2,8 +2,10 @@
 #ifndef SLABS_H
 #define SLABS_H
 
-// TODO: in the future, make slabs pool size variable, according to maximum size of cache
+/* Default size of each slab pool, see settings.slabs_pool_size */
 #define SLABS_POOL_SIZE    (2ull * 1024 * 1024 * 1024)
+/* Most pools slab pages can be striped across */
+#define MAX_SLAB_POOLS     16
 
 /** Init the subsystem. 1st argument is the limit on no. of bytes to allocate,
     0 if no limit. 2nd argument is the growth factor; each slab will use a chunk
@@ -27,11 +29,17 @@ void *slabs_alloc(const size_t size, unsigned int id, unsigned int *total_chunks
 /** Free previously allocated object */
 void slabs_free(void *ptr, size_t size, unsigned int id);
 
-void slabs_recover(active_slab_table_t** slab_tables, ht_intset_t* ht, int num_threads);
+void slabs_recover(ht_intset_t* ht);
+
+/** Whether ptr lives in the slab pool of the given NUMA node */
+bool slabs_is_local(const void *ptr, int node);
 
 /** Adjust the stats for memory requested */
 void slabs_adjust_mem_requested(unsigned int id, size_t old, size_t ntotal);
 
+/** Reserve n CAS ids above every id handed out before, return the first */
+uint64_t slabs_cas_lease(uint64_t n);
+
 /** Return a datum for stats in binary protocol */
 bool get_stats(const char *stat_type, int nkey, ADD_STAT add_stats, void *c);
 
@@ -43,7 +51,23 @@ unsigned int slabs_available_chunks(unsigned int id, bool *mem_flag, unsigned in
 
 #ifdef NVM
 void clock_update(item* it);
+bool clock_is_referenced(item* it);
 item* clock_get_victim(unsigned int id);
+
+/* DRAM tier, see settings.dram_tier_size */
+void *slabs_dram_alloc(size_t size, unsigned int id);
+void slabs_dram_free(void *ptr, size_t size, unsigned int id);
+size_t slabs_dram_used(void);
+unsigned int slabs_dram_chunks(unsigned int id);
+item *slabs_dram_chunk(unsigned int id, unsigned int index);
+bool slabs_is_persistent(const void *ptr);
+
+/* Log-structured engine, see settings.engine */
+void *slabs_log_alloc(size_t size, unsigned int id);
+void *slabs_log_claim(unsigned int pct);
+void slabs_log_release(void *seg);
+item *slabs_log_next(void *seg, item *it);
+unsigned int slabs_log_spare_segments(void);
 #endif
 
 int start_slab_maintenance_thread(void);
@@ -210,6 +210,145 @@ char *stats_prefix_dump(int *length) {
 }
 
 
+/*
+ * Latency histograms. Buckets are log-linear like HDR histograms: exact
+ * below 16, then 16 sub-buckets per power of two, so any value is
+ * within about 6% of its bucket. Values are in latency_now() ticks and
+ * are only converted to time for reporting. Every thread that records
+ * gets its own set of histograms, which only it writes; readers sum them
+ * without locking and may miss the latest few records.
+ */
+#define LAT_SUB_BITS 4
+#define LAT_SUB (1 << LAT_SUB_BITS)
+#define LAT_BUCKETS ((64 - LAT_SUB_BITS + 1) * LAT_SUB)
+
+struct lat_thread {
+    uint64_t counts[LAT_OPS][LAT_BUCKETS];
+    struct lat_thread *next;
+};
+
+static const char *lat_names[LAT_OPS] = {
+    "get", "set", "delete", "incr", "touch", "alloc", "evict", "gc", "persist"
+};
+
+static __thread struct lat_thread *lat_mine;
+static struct lat_thread *lat_threads;  /* every thread that recorded */
+static double lat_ns_per_tick = 1.0;
+
+static inline unsigned int lat_bucket(uint64_t v) {
+    unsigned int exp;
+
+    if (v < LAT_SUB)
+        return v;
+    exp = 63 - __builtin_clzll(v);
+    return (exp - LAT_SUB_BITS + 1) * LAT_SUB +
+           ((v >> (exp - LAT_SUB_BITS)) & (LAT_SUB - 1));
+}
+
+/* Middle of the range of values that land in bucket b */
+static uint64_t lat_bucket_value(unsigned int b) {
+    unsigned int shift;
+
+    if (b < LAT_SUB)
+        return b;
+    shift = b / LAT_SUB - 1;
+    return ((uint64_t)(LAT_SUB + b % LAT_SUB) << shift) + ((1ULL << shift) >> 1);
+}
+
+/* Measures the tick rate against the monotonic clock, once at startup. */
+void stats_latency_init(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    struct timespec ts0, ts1;
+    uint64_t t0, t1;
+    struct timespec pause = { 0, 10000000 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts0);
+    t0 = latency_now();
+    nanosleep(&pause, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    t1 = latency_now();
+    if (t1 > t0) {
+        lat_ns_per_tick = ((ts1.tv_sec - ts0.tv_sec) * 1e9 +
+                           (ts1.tv_nsec - ts0.tv_nsec)) / (double)(t1 - t0);
+    }
+#endif
+}
+
+void stats_latency_record(enum latency_op op, uint64_t start) {
+    struct lat_thread *lt = lat_mine;
+    uint64_t *count;
+
+    if (lt == NULL) {
+        lt = (struct lat_thread *)calloc(1, sizeof(*lt));
+        if (lt == NULL)
+            return;
+        lt->next = __atomic_load_n(&lat_threads, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&lat_threads, &lt->next, lt, true,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+        lat_mine = lt;
+    }
+    count = &lt->counts[op][lat_bucket(latency_now() - start)];
+    __atomic_store_n(count, __atomic_load_n(count, __ATOMIC_RELAXED) + 1,
+                     __ATOMIC_RELAXED);
+}
+
+/* Zeroes the histograms; a record racing with this may survive it. */
+void stats_latency_reset(void) {
+    struct lat_thread *lt;
+    int op, b;
+
+    for (lt = __atomic_load_n(&lat_threads, __ATOMIC_ACQUIRE); lt; lt = lt->next) {
+        for (op = 0; op < LAT_OPS; op++) {
+            for (b = 0; b < LAT_BUCKETS; b++)
+                __atomic_store_n(&lt->counts[op][b], 0, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Merges the histograms of all threads and reports count, p50, p99 and
+ * p999 in microseconds for each operation seen so far. */
+void stats_latency(ADD_STAT add_stats, void *c) {
+    static const struct { const char *name; double q; } pcts[] = {
+        { "p50", 0.5 }, { "p99", 0.99 }, { "p999", 0.999 }
+    };
+    uint64_t merged[LAT_BUCKETS];
+    struct lat_thread *lt;
+    char key[64];
+    int op, b;
+    unsigned int i;
+
+    for (op = 0; op < LAT_OPS; op++) {
+        uint64_t total = 0;
+
+        memset(merged, 0, sizeof(merged));
+        for (lt = __atomic_load_n(&lat_threads, __ATOMIC_ACQUIRE); lt; lt = lt->next) {
+            for (b = 0; b < LAT_BUCKETS; b++) {
+                uint64_t n = __atomic_load_n(&lt->counts[op][b], __ATOMIC_RELAXED);
+                merged[b] += n;
+                total += n;
+            }
+        }
+        if (total == 0)
+            continue;
+
+        snprintf(key, sizeof(key), "%s_count", lat_names[op]);
+        APPEND_STAT(key, "%llu", (unsigned long long)total);
+        for (i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++) {
+            uint64_t rank = (uint64_t)(pcts[i].q * total), seen = 0;
+
+            for (b = 0; b < LAT_BUCKETS - 1; b++) {
+                seen += merged[b];
+                if (seen > rank)
+                    break;
+            }
+            snprintf(key, sizeof(key), "%s_%s_us", lat_names[op], pcts[i].name);
+            APPEND_STAT(key, "%.1f",
+                        lat_bucket_value(b) * lat_ns_per_tick / 1000.0);
+        }
+    }
+}
+
 #ifdef UNIT_TEST
 
 /****************************************************************************
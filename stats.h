@@ -6,3 +6,28 @@ void stats_prefix_record_delete(const char *key, const size_t nkey);
 void stats_prefix_record_set(const char *key, const size_t nkey);
 /*@null@*/
 char *stats_prefix_dump(int *length);
+
+/*
+ * Latency histograms, one set per thread, merged by "stats latency".
+ * Time a section with t0 = latency_now() ... stats_latency_record(op, t0).
+ */
+enum latency_op {
+    LAT_GET, LAT_SET, LAT_DELETE, LAT_INCR, LAT_TOUCH,  /* commands, both protocols */
+    LAT_ALLOC, LAT_EVICT, LAT_GC, LAT_PERSIST,
+    LAT_OPS
+};
+
+static inline uint64_t latency_now(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+void stats_latency_init(void);
+void stats_latency_record(enum latency_op op, uint64_t start);
+void stats_latency(ADD_STAT add_stats, void *c);
+void stats_latency_reset(void);
@@ -0,0 +1,73 @@
+#!/usr/bin/perl
+# Pipelined gets with response batching on, while sets evict and deletes
+# free items under them: every hit must carry its own key's value.
+
+use strict;
+use Test::More tests => 22;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-m 3 -o batch_responses=256');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, "settings");
+is($stats->{batch_responses}, 256, "batching is on");
+
+my $nkeys = 4000;
+my $rounds = 20;
+
+sub value_of {
+    my $k = shift;
+    return "key$k:" . ("v" x (500 + $k % 500));
+}
+
+srand(42);
+for my $round (1 .. $rounds) {
+    my @cmds;
+    my $buf = "";
+    for (1 .. 200) {
+        my $k = int(rand($nkeys));
+        my $r = rand();
+        if ($r < 0.3) {
+            my $v = value_of($k);
+            $buf .= "set key$k 0 0 " . length($v) . "\r\n$v\r\n";
+            push @cmds, ['set', $k];
+        } elsif ($r < 0.4) {
+            $buf .= "delete key$k\r\n";
+            push @cmds, ['delete', $k];
+        } else {
+            $buf .= "get key$k\r\n";
+            push @cmds, ['get', $k];
+        }
+    }
+    print $sock $buf;
+
+    # a key deleted earlier in the pipeline stays gone until it is set again
+    my %deleted;
+    my $bad = 0;
+    for my $cmd (@cmds) {
+        my ($op, $k) = @$cmd;
+        my $line = <$sock>;
+        if ($op eq 'set') {
+            $bad++ unless $line eq "STORED\r\n";
+            delete $deleted{$k};
+        } elsif ($op eq 'delete') {
+            $bad++ unless $line eq "DELETED\r\n" || $line eq "NOT_FOUND\r\n";
+            $deleted{$k} = 1;
+        } elsif ($line eq "END\r\n") {
+            # evicted or never set
+        } elsif ($line =~ /^VALUE key(\d+) 0 (\d+)\r\n$/) {
+            my $got;
+            read($sock, $got, $2 + 2);
+            my $end = <$sock>;
+            $bad++ unless $1 == $k && $got eq value_of($k) . "\r\n" &&
+                $end eq "END\r\n" && !$deleted{$k};
+        } else {
+            $bad++;
+        }
+    }
+    is($bad, 0, "round $round: every response matches its command");
+}
+
+mem_get_is($sock, "nosuchkey", undef);
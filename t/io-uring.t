@@ -0,0 +1,88 @@
+#!/usr/bin/perl
+# TCP connections served through the workers' io_uring: values spanning
+# several receive buffers, pipelines longer than a connection's share of
+# buffers, and connections closed with requests still in flight.
+
+use strict;
+use Test::More tests => 10;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-o io_uring');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, "settings");
+is($stats->{io_uring}, "yes", "io_uring is on");
+
+print $sock "set foo 0 0 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored foo");
+mem_get_is($sock, "foo", "fooval");
+
+# several 4KB receive buffers for one value
+my $big = "b" x 100000;
+print $sock "set big 0 0 " . length($big) . "\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored big");
+mem_get_is($sock, "big", $big);
+
+# a pipeline well past the buffers one connection may queue
+my $n = 200;
+my $buf = "";
+for my $k (1 .. $n) {
+    my $v = "p$k:" . ("x" x 2000);
+    $buf .= "set pipe$k 0 0 " . length($v) . "\r\n$v\r\n";
+}
+print $sock $buf;
+my $stored = 0;
+for (1 .. $n) {
+    $stored++ if scalar <$sock> eq "STORED\r\n";
+}
+is($stored, $n, "every pipelined set stored");
+
+$buf = "";
+for my $k (1 .. $n) {
+    $buf .= "get pipe$k\r\n";
+}
+print $sock $buf;
+my $bad = 0;
+for my $k (1 .. $n) {
+    my $v = "p$k:" . ("x" x 2000);
+    my $line = <$sock>;
+    if ($line ne "VALUE pipe$k 0 " . length($v) . "\r\n") {
+        $bad++;
+        next;
+    }
+    my $got;
+    read($sock, $got, length($v) + 2);
+    $bad++ unless $got eq "$v\r\n" && scalar <$sock> eq "END\r\n";
+}
+is($bad, 0, "pipelined gets return their values in order");
+
+# close while responses are still being sent
+for (1 .. 10) {
+    my $s = $server->new_sock;
+    print $s "get big\r\n" x 20;
+    close($s);
+}
+mem_get_is($sock, "big", $big);
+
+# with zerocopy_min as well, ring sends must not wait on zero-copy
+# completions, or retired chunks are never reclaimed and stores fail
+my $zc = new_memcached('-m 8 -o io_uring,zerocopy_min=4096');
+my $zsock = $zc->sock;
+my $zbad = 0;
+for my $ver (1 .. 300) {
+    my $v = "v$ver:" . ("z" x 100000);
+    my $key = "zc" . ($ver % 50);
+    print $zsock "set $key 0 0 " . length($v) . "\r\n$v\r\nget $key\r\n";
+    $zbad++ unless scalar <$zsock> eq "STORED\r\n";
+    my $got = "";
+    if (scalar <$zsock> eq "VALUE $key 0 " . length($v) . "\r\n") {
+        read($zsock, $got, length($v) + 2);
+        $zbad++ unless scalar <$zsock> eq "END\r\n";
+    }
+    $zbad++ unless $got eq "$v\r\n";
+}
+is($zbad, 0, "stores keep succeeding with io_uring and zerocopy_min");
+$stats = mem_stats($zsock);
+is($stats->{zerocopy_sends}, 0, "ring connections send without MSG_ZEROCOPY");
@@ -0,0 +1,65 @@
+#!/usr/bin/perl
+# Stores that build a new item from an old one: replace, append, prepend,
+# incr and decr swap a new item in for the old one, which must not leak or
+# be left behind, even when every allocation has to evict.
+
+use strict;
+use Test::More tests => 17;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-m 3');
+my $sock = $server->sock;
+
+print $sock "append nokey 0 0 3\r\nabc\r\n";
+is(scalar <$sock>, "NOT_STORED\r\n", "append to a missing key");
+print $sock "replace nokey 0 0 3\r\nabc\r\n";
+is(scalar <$sock>, "NOT_STORED\r\n", "replace of a missing key");
+
+print $sock "set k 5 0 3\r\nmid\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored k");
+print $sock "append k 0 0 4\r\n-end\r\n";
+is(scalar <$sock>, "STORED\r\n", "appended");
+print $sock "prepend k 0 0 6\r\nstart-\r\n";
+is(scalar <$sock>, "STORED\r\n", "prepended");
+mem_get_is({ sock => $sock, flags => 5 }, "k", "start-mid-end");
+
+print $sock "replace k 7 0 3\r\nnew\r\n";
+is(scalar <$sock>, "STORED\r\n", "replaced");
+mem_get_is({ sock => $sock, flags => 7 }, "k", "new");
+
+print $sock "set n 0 0 2\r\n10\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored n");
+my ($cas) = mem_gets($sock, "n");
+print $sock "incr n 5\r\n";
+is(scalar <$sock>, "15\r\n", "10 + 5");
+print $sock "decr n 20\r\n";
+is(scalar <$sock>, "0\r\n", "15 - 20 stops at 0");
+my ($cas2) = mem_gets($sock, "n");
+isnt($cas2, $cas, "incr gives the item a new CAS");
+print $sock "incr k 1\r\n";
+is(scalar <$sock>, "CLIENT_ERROR cannot increment or decrement non-numeric value\r\n",
+   "incr of a non-numeric value");
+
+# Far more new items than fit: old versions have to be reclaimed
+my $bad = 0;
+for my $i (1 .. 2000) {
+    my $key = "c" . ($i % 20);
+    my $v = "x" x 1000;
+    print $sock "set $key 0 0 " . length($v) . "\r\n$v\r\n";
+    $bad++ unless scalar <$sock> eq "STORED\r\n";
+    print $sock "append $key 0 0 1\r\ny\r\n";
+    $bad++ unless scalar <$sock> eq "STORED\r\n";
+    print $sock "prepend $key 0 0 1\r\nz\r\n";
+    $bad++ unless scalar <$sock> eq "STORED\r\n";
+}
+is($bad, 0, "every set, append and prepend stored");
+mem_get_is($sock, "c0", "z" . ("x" x 1000) . "y");
+
+for my $i (1 .. 2000) {
+    print $sock "incr n 1\r\n";
+    $bad++ unless scalar <$sock> eq "$i\r\n";
+}
+is($bad, 0, "2000 increments in a row");
+mem_get_is($sock, "n", 2000);
@@ -0,0 +1,84 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 21;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+# Counters that workers bump after a "stats reset" are reported as the
+# growth since the reset, summed over every worker thread.
+
+my $server = new_memcached('-t 4');
+my $sock = $server->sock;
+
+# Connections are handed to workers round robin, so traffic from several
+# of them lands on more than one thread.
+my @socks = map { $server->new_sock } (1 .. 4);
+
+sub traffic {
+    my ($tag) = @_;
+    for my $i (0 .. $#socks) {
+        my $s = $socks[$i];
+        my $key = "$tag$i";
+        print $s "set $key 0 0 1\r\nx\r\n";
+        die "set $key failed" unless scalar(<$s>) eq "STORED\r\n";
+        print $s "get $key\r\n";
+        die "get $key failed"
+            unless scalar(<$s>) eq "VALUE $key 0 1\r\n"
+                && scalar(<$s>) eq "x\r\n" && scalar(<$s>) eq "END\r\n";
+        print $s "get missing$tag\r\n";
+        die "miss failed" unless scalar(<$s>) eq "END\r\n";
+        print $s "delete $key\r\n";
+        die "delete $key failed" unless scalar(<$s>) eq "DELETED\r\n";
+    }
+}
+
+sub slab_get_hits {
+    my $slabs = mem_stats($sock, 'slabs');
+    my $sum = 0;
+    for my $k (keys %$slabs) {
+        $sum += $slabs->{$k} if $k =~ /^\d+:get_hits$/;
+    }
+    return $sum;
+}
+
+# Some traffic before the reset, which must not show up afterwards.
+traffic("a");
+
+print $sock "stats reset\r\n";
+is(scalar <$sock>, "RESET\r\n", "stats reset");
+
+my $stats = mem_stats($sock);
+is($stats->{cmd_get}, 0, "cmd_get is zero after reset");
+is($stats->{cmd_set}, 0, "cmd_set is zero after reset");
+is($stats->{get_hits}, 0, "get_hits is zero after reset");
+is($stats->{get_misses}, 0, "get_misses is zero after reset");
+is($stats->{delete_hits}, 0, "delete_hits is zero after reset");
+is(slab_get_hits(), 0, "per-class get_hits are zero after reset");
+
+traffic("b");
+
+$stats = mem_stats($sock);
+my $n = scalar @socks;
+is($stats->{cmd_get}, 2 * $n, "cmd_get counts only gets since the reset");
+is($stats->{cmd_set}, $n, "cmd_set counts only sets since the reset");
+is($stats->{get_hits}, $n, "get_hits counts only hits since the reset");
+is($stats->{get_misses}, $n, "get_misses counts only misses since the reset");
+is($stats->{delete_hits}, $n, "delete_hits counts only deletes since the reset");
+is(slab_get_hits(), $n, "per-class get_hits count only hits since the reset");
+
+# A second reset moves the baseline again.
+print $sock "stats reset\r\n";
+is(scalar <$sock>, "RESET\r\n", "second stats reset");
+
+print $sock "set c 0 0 1\r\ny\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored c");
+mem_get_is($sock, "c", "y");
+
+$stats = mem_stats($sock);
+is($stats->{cmd_get}, 1, "cmd_get after second reset");
+is($stats->{cmd_set}, 1, "cmd_set after second reset");
+is($stats->{get_hits}, 1, "get_hits after second reset");
+is($stats->{get_misses}, 0, "get_misses after second reset");
+is(slab_get_hits(), 1, "per-class get_hits after second reset");
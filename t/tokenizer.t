@@ -0,0 +1,65 @@
+#!/usr/bin/perl
+
+use strict;
+use Test::More tests => 14;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+
+# Runs of spaces between tokens are skipped.
+print $sock "set   foo  0    0 6\r\nfooval\r\n";
+is(scalar <$sock>, "STORED\r\n", "set with runs of spaces");
+mem_get_is($sock, "foo", "fooval");
+
+# A trailing space does not add an empty key.
+print $sock "get foo \r\n";
+is(scalar <$sock>, "VALUE foo 0 6\r\n", "get with trailing space");
+is(scalar <$sock>, "fooval\r\n", "value with trailing space");
+is(scalar <$sock>, "END\r\n", "end with trailing space");
+
+# Neither do leading spaces and spaces before the terminator.
+print $sock "   incr   foo 1   \r\n";
+is(scalar <$sock>, "CLIENT_ERROR cannot increment or decrement non-numeric value\r\n",
+   "incr with leading and trailing spaces reaches the command");
+
+print $sock "set  num 0 0 1 \r\n5\r\n";
+is(scalar <$sock>, "STORED\r\n", "set with trailing space");
+print $sock "incr  num   3\r\n";
+is(scalar <$sock>, "8\r\n", "incr with runs of spaces");
+
+# More keys than fit in one tokenizer pass: every value comes back, in
+# order, with a single END.
+my @keys = map { "key$_" } (1 .. 40);
+for my $k (@keys) {
+    print $sock "set $k 0 0 " . length("v$k") . "\r\nv$k\r\n";
+    die "set $k failed" unless scalar(<$sock>) eq "STORED\r\n";
+}
+
+sub check_many {
+    my ($cmd, $withcas, $msg) = @_;
+    print $sock "$cmd " . join("  ", @keys) . " \r\n";
+    my $ok = 1;
+    for my $k (@keys) {
+        my $len = length("v$k");
+        my $hdr = scalar <$sock>;
+        my $re = $withcas ? qr/^VALUE $k 0 $len \d+\r\n$/ : qr/^VALUE $k 0 $len\r\n$/;
+        $ok = 0 unless $hdr =~ $re;
+        $ok = 0 unless scalar(<$sock>) eq "v$k\r\n";
+    }
+    ok($ok, "$msg: all values");
+    is(scalar <$sock>, "END\r\n", "$msg: one END");
+}
+
+check_many("get", 0, "get of 40 keys");
+check_many("gets", 1, "gets of 40 keys");
+
+# Delete with extra spaces, then a miss.
+print $sock "delete   foo  \r\n";
+is(scalar <$sock>, "DELETED\r\n", "delete with runs of spaces");
+
+# A command that shares a prefix with a fast-path one is still unknown.
+print $sock "sets foo 0 0 1\r\n";
+is(scalar <$sock>, "ERROR\r\n", "sets is not set");
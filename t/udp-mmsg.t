@@ -0,0 +1,74 @@
+#!/usr/bin/perl
+# A burst of UDP requests sent before reading any reply, more than one
+# recvmmsg/sendmmsg ring holds: every request gets its own complete
+# response, including responses that span several datagrams.
+
+use strict;
+use Test::More tests => 5;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached();
+my $sock = $server->sock;
+
+my $nreq = 40;
+
+sub value_of {
+    my $k = shift;
+    # every fifth value needs several datagrams
+    return $k % 5 ? "val$k" : "big$k:" . ("u" x 4000);
+}
+
+my $stored = 0;
+for my $k (1 .. $nreq) {
+    my $v = value_of($k);
+    print $sock "set key$k 0 0 " . length($v) . "\r\n$v\r\n";
+    $stored++ if scalar <$sock> eq "STORED\r\n";
+}
+is($stored, $nreq, "stored every key");
+
+my $usock = $server->new_udp_sock
+    or die "Can't bind : $@\n";
+
+for my $k (1 .. $nreq) {
+    my $pkt = pack("nnnn", 1000 + $k, 0, 1, 0) . "get key$k\r\n";
+    send($usock, $pkt, 0) or die "send: $!\n";
+}
+
+# request id => { seq => payload }
+my %resp;
+my %numpkts;
+my $bad_header = 0;
+while (1) {
+    my $rin = '';
+    vec($rin, fileno($usock), 1) = 1;
+    last unless select(my $rout = $rin, undef, undef, 1.5);
+
+    my $res;
+    $usock->recv($res, 1500, 0);
+    my ($resid, $seq, $this_numpkts, $resv) = unpack("nnnn", substr($res, 0, 8));
+    $bad_header++ if $resv != 0;
+    $bad_header++ if defined $numpkts{$resid} && $numpkts{$resid} != $this_numpkts;
+    $numpkts{$resid} = $this_numpkts;
+    $resp{$resid}{$seq} = substr($res, 8);
+}
+
+is($bad_header, 0, "datagram headers are consistent");
+is(scalar(keys %resp), $nreq, "one response per request");
+is(scalar(grep { $_ < 1001 || $_ > 1000 + $nreq } keys %resp), 0,
+   "every response carries a request id we sent");
+
+my $bad = 0;
+for my $k (1 .. $nreq) {
+    my $id = 1000 + $k;
+    my $parts = $resp{$id};
+    if (!$parts || keys %$parts != $numpkts{$id}) {
+        $bad++;
+        next;
+    }
+    my $msg = join("", map { $parts->{$_} } 0 .. $numpkts{$id} - 1);
+    my $v = value_of($k);
+    $bad++ unless $msg eq "VALUE key$k 0 " . length($v) . "\r\n$v\r\nEND\r\n";
+}
+is($bad, 0, "every response is complete and matches its request");
@@ -0,0 +1,51 @@
+#!/usr/bin/perl
+# Large values sent with MSG_ZEROCOPY: payloads stay intact while the
+# items are overwritten, and closing with sends outstanding is safe.
+
+use strict;
+use Test::More tests => 7;
+use FindBin qw($Bin);
+use lib "$Bin/lib";
+use MemcachedTest;
+
+my $server = new_memcached('-o zerocopy_min=4096');
+my $sock = $server->sock;
+
+my $stats = mem_stats($sock, "settings");
+is($stats->{zerocopy_min}, 4096, "zerocopy_min is set");
+
+my $big = "z" x 100000;
+print $sock "set big 0 0 " . length($big) . "\r\n$big\r\n";
+is(scalar <$sock>, "STORED\r\n", "stored big");
+mem_get_is($sock, "big", $big);
+
+# pipelined gets of a key that keeps being replaced
+my $bad = 0;
+for my $ver (1 .. 20) {
+    my $v = "v$ver:" . ("z" x 50000);
+    print $sock "set ver 0 0 " . length($v) . "\r\n$v\r\n";
+    $bad++ unless scalar <$sock> eq "STORED\r\n";
+    print $sock "get ver\r\n" x 5;
+    for (1 .. 5) {
+        my $line = <$sock>;
+        my $got = "";
+        if ($line eq "VALUE ver 0 " . length($v) . "\r\n") {
+            read($sock, $got, length($v) + 2);
+            $line = <$sock>;
+        }
+        $bad++ unless $got eq "$v\r\n" && $line eq "END\r\n";
+    }
+}
+is($bad, 0, "every get returns the value current when it ran");
+
+# close with sends outstanding
+for (1 .. 10) {
+    my $s = $server->new_sock;
+    print $s "get big\r\n" x 20;
+    close($s);
+}
+mem_get_is($sock, "big", $big);
+
+$stats = mem_stats($sock);
+ok(defined $stats->{zerocopy_sends}, "zerocopy_sends reported");
+cmp_ok($stats->{curr_connections}, '<', 10, "closed connections are gone");
@@ -10,6 +10,9 @@
 #include <errno.h>
 #include <string.h>
 #include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
 
 #ifdef __sun
 #include <atomic.h>
@@ -17,9 +20,16 @@
 
 #define ITEMS_PER_ALLOC 64
 
+/* What a connection queue item asks the worker to do */
+enum cq_item_type {
+    CQ_NEW_CONN,        /* set up the connection described by the item */
+    CQ_PAUSE            /* pause and report in, see pause_threads() */
+};
+
 /* An item in the connection queue. */
 typedef struct conn_queue_item CQ_ITEM;
 struct conn_queue_item {
+    enum cq_item_type type;
     int               sfd;
     enum conn_states  init_state;
     int               event_flags;
@@ -28,12 +38,14 @@ struct conn_queue_item {
     CQ_ITEM          *next;
 };
 
-/* A connection queue. */
+/* A connection queue, see cq_init(). */
 typedef struct conn_queue CQ;
 struct conn_queue {
-    CQ_ITEM *head;
-    CQ_ITEM *tail;
-    pthread_mutex_t lock;
+    CQ_ITEM *head;      /* last item pushed, shared by producers */
+    CQ_ITEM *tail;      /* next item to pop, owned by the worker */
+    CQ_ITEM stub;
+    int notified;       /* a wakeup is pending on the worker's eventfd */
+    CQ_ITEM pause;      /* the one pause message a worker can have queued */
 };
 
 /* Locks for cache LRU operations */
@@ -52,9 +64,13 @@ static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
 /* Lock to cause worker threads to hang up after being woken */
 static pthread_mutex_t worker_hang_lock;
 
-/* Free list of CQ_ITEM structs */
+/* Free list of CQ_ITEM structs, pushed to by workers */
 static CQ_ITEM *cqi_freelist;
-static pthread_mutex_t cqi_freelist_lock;
+/* Items the dispatcher took off the free list */
+static CQ_ITEM *cqi_cache;
+
+/* NUMA node the calling worker is pinned to, -1 if it isn't */
+static __thread int my_numa_node = -1;
 
 static pthread_mutex_t *item_locks;
 /* size of the item lock hash table */
@@ -80,6 +96,7 @@ static pthread_cond_t init_cond;
 
 
 static void thread_libevent_process(int fd, short which, void *arg);
+static void cq_push_notify(LIBEVENT_THREAD *thread, CQ_ITEM *item);
 
 unsigned short refcount_incr(unsigned short *refcount) {
 #ifdef HAVE_GCC_ATOMICS
@@ -178,6 +195,10 @@ void pause_threads(enum pause_thread_types type) {
             slabs_rebalancer_pause();
             lru_crawler_pause();
             lru_maintainer_pause();
+#ifdef NVM
+            tier_migrator_pause();
+            log_cleaner_pause();
+#endif
         case PAUSE_WORKER_THREADS:
             buf[0] = 'p';
             pthread_mutex_lock(&worker_hang_lock);
@@ -186,6 +207,10 @@ void pause_threads(enum pause_thread_types type) {
             slabs_rebalancer_resume();
             lru_crawler_resume();
             lru_maintainer_resume();
+#ifdef NVM
+            tier_migrator_resume();
+            log_cleaner_resume();
+#endif
         case RESUME_WORKER_THREADS:
             pthread_mutex_unlock(&worker_hang_lock);
             break;
@@ -203,70 +228,106 @@ void pause_threads(enum pause_thread_types type) {
     pthread_mutex_lock(&init_lock);
     init_count = 0;
     for (i = 0; i < settings.num_threads; i++) {
-        if (write(threads[i].notify_send_fd, buf, 1) != 1) {
-            perror("Failed writing to notify pipe");
-            /* TODO: This is a fatal problem. Can it ever happen temporarily? */
-        }
+        /* init_lock keeps the previous pause message from still being
+         * queued when we reuse it */
+        CQ_ITEM *item = &threads[i].new_conn_queue->pause;
+        item->type = CQ_PAUSE;
+        cq_push_notify(&threads[i], item);
     }
     wait_for_thread_registration(settings.num_threads);
     pthread_mutex_unlock(&init_lock);
 }
 
 /*
- * Initializes a connection queue.
+ * Initializes a connection queue. The queue is intrusive and lock-free for
+ * any number of producers and a single consumer, the owning worker: it
+ * starts out holding only the stub item, head is where producers append
+ * and tail is where the worker takes from.
  */
 static void cq_init(CQ *cq) {
-    pthread_mutex_init(&cq->lock, NULL);
-    cq->head = NULL;
-    cq->tail = NULL;
+    cq->stub.next = NULL;
+    cq->head = &cq->stub;
+    cq->tail = &cq->stub;
+    cq->notified = 0;
+}
+
+/*
+ * Adds an item to a connection queue.
+ */
+static void cq_push(CQ *cq, CQ_ITEM *item) {
+    CQ_ITEM *prev;
+
+    item->next = NULL;
+    prev = __atomic_exchange_n(&cq->head, item, __ATOMIC_ACQ_REL);
+    /* Until this store the item is in the queue but can't be reached yet;
+     * cq_pop() treats that as empty and the wakeup that follows brings the
+     * worker back. */
+    __atomic_store_n(&prev->next, item, __ATOMIC_RELEASE);
 }
 
 /*
  * Looks for an item on a connection queue, but doesn't block if there isn't
- * one.
+ * one. Only the worker owning the queue may call this.
  * Returns the item, or NULL if no item is available
  */
 static CQ_ITEM *cq_pop(CQ *cq) {
-    CQ_ITEM *item;
+    CQ_ITEM *tail = cq->tail;
+    CQ_ITEM *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
 
-    pthread_mutex_lock(&cq->lock);
-    item = cq->head;
-    if (NULL != item) {
-        cq->head = item->next;
-        if (NULL == cq->head)
-            cq->tail = NULL;
+    if (tail == &cq->stub) {
+        if (NULL == next)
+            return NULL;
+        cq->tail = next;
+        tail = next;
+        next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
     }
-    pthread_mutex_unlock(&cq->lock);
-
-    return item;
+    if (NULL != next) {
+        cq->tail = next;
+        return tail;
+    }
+    if (tail != __atomic_load_n(&cq->head, __ATOMIC_ACQUIRE))
+        return NULL;    /* a push is half done */
+
+    /* tail is the last item; put the stub behind it so it can be taken */
+    cq_push(cq, &cq->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+    if (NULL != next) {
+        cq->tail = next;
+        return tail;
+    }
+    return NULL;
 }
 
 /*
- * Adds an item to a connection queue.
+ * Queues an item for a worker and wakes it up, unless a wakeup is already
+ * on its way that the worker hasn't acted on yet.
  */
-static void cq_push(CQ *cq, CQ_ITEM *item) {
-    item->next = NULL;
+static void cq_push_notify(LIBEVENT_THREAD *thread, CQ_ITEM *item) {
+    uint64_t one = 1;
 
-    pthread_mutex_lock(&cq->lock);
-    if (NULL == cq->tail)
-        cq->head = item;
-    else
-        cq->tail->next = item;
-    cq->tail = item;
-    pthread_mutex_unlock(&cq->lock);
+    cq_push(thread->new_conn_queue, item);
+    if (__atomic_exchange_n(&thread->new_conn_queue->notified, 1,
+                            __ATOMIC_ACQ_REL) == 0) {
+        if (write(thread->notify_fd, &one, sizeof(one)) != sizeof(one)) {
+            perror("Writing to thread notify eventfd");
+        }
+    }
 }
 
 /*
- * Returns a fresh connection queue item.
+ * Returns a fresh connection queue item. Only the dispatcher takes items, so
+ * it grabs everything workers gave back at once into a private list.
  */
 static CQ_ITEM *cqi_new(void) {
     CQ_ITEM *item = NULL;
-    pthread_mutex_lock(&cqi_freelist_lock);
-    if (cqi_freelist) {
-        item = cqi_freelist;
-        cqi_freelist = item->next;
+
+    if (NULL == cqi_cache)
+        cqi_cache = __atomic_exchange_n(&cqi_freelist, (CQ_ITEM *)NULL,
+                                        __ATOMIC_ACQUIRE);
+    if (cqi_cache) {
+        item = cqi_cache;
+        cqi_cache = item->next;
     }
-    pthread_mutex_unlock(&cqi_freelist_lock);
 
     if (NULL == item) {
         int i;
@@ -288,12 +349,11 @@ static CQ_ITEM *cqi_new(void) {
         for (i = 2; i < ITEMS_PER_ALLOC; i++)
             item[i - 1].next = &item[i];
 
-        pthread_mutex_lock(&cqi_freelist_lock);
-        item[ITEMS_PER_ALLOC - 1].next = cqi_freelist;
-        cqi_freelist = &item[1];
-        pthread_mutex_unlock(&cqi_freelist_lock);
+        item[ITEMS_PER_ALLOC - 1].next = cqi_cache;
+        cqi_cache = &item[1];
     }
 
+    item->type = CQ_NEW_CONN;
     return item;
 }
 
@@ -302,10 +362,12 @@ static CQ_ITEM *cqi_new(void) {
  * Frees a connection queue item (adds it to the freelist.)
  */
 static void cqi_free(CQ_ITEM *item) {
-    pthread_mutex_lock(&cqi_freelist_lock);
-    item->next = cqi_freelist;
-    cqi_freelist = item;
-    pthread_mutex_unlock(&cqi_freelist_lock);
+    CQ_ITEM *top = __atomic_load_n(&cqi_freelist, __ATOMIC_RELAXED);
+
+    do {
+        item->next = top;
+    } while (!__atomic_compare_exchange_n(&cqi_freelist, &top, item, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 }
 
 
@@ -336,6 +398,111 @@ void accept_new_conns(const bool do_accept) {
 }
 /****************************** LIBEVENT THREADS *****************************/
 
+#define MAX_NUMA_NODES 1024
+
+/* Online NUMA node ids in ascending order, filled by numa_online_nodes() */
+static int numa_nodes_online[MAX_NUMA_NODES];
+static int numa_nodes_count = 0;
+
+/*
+ * Reads a sysfs list like "0-7,16-23" into ids, in the order given.
+ * Returns how many ids were stored, -1 if the file can't be read.
+ */
+static int read_sysfs_list(const char *path, int *ids, int max) {
+    char list[1024];
+    char *p, *b;
+    FILE *f;
+    int n = 0;
+
+    if ((f = fopen(path, "r")) == NULL)
+        return -1;
+    if (fgets(list, sizeof(list), f) == NULL) {
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+
+    for (p = strtok_r(list, ",\n", &b); p != NULL; p = strtok_r(NULL, ",\n", &b)) {
+        int lo, hi;
+        if (sscanf(p, "%d-%d", &lo, &hi) != 2) {
+            if (sscanf(p, "%d", &lo) != 1)
+                continue;
+            hi = lo;
+        }
+        for (; lo <= hi && n < max; lo++)
+            ids[n++] = lo;
+    }
+    return n;
+}
+
+/*
+ * Looks up the NUMA nodes the kernel has online. Their ids need not be
+ * contiguous. Without the list, node 0 is assumed to be the only one.
+ * Returns how many there are.
+ */
+static int numa_online_nodes(void) {
+    numa_nodes_count = read_sysfs_list("/sys/devices/system/node/online",
+                                       numa_nodes_online, MAX_NUMA_NODES);
+    if (numa_nodes_count <= 0) {
+        numa_nodes_online[0] = 0;
+        numa_nodes_count = 1;
+    }
+    return numa_nodes_count;
+}
+
+/*
+ * Position of a node among the online ones, which is what pool_dirs entries
+ * are matched by. A node missing from the list is taken as is.
+ */
+int numa_node_index(int node) {
+    int i;
+    for (i = 0; i < numa_nodes_count; i++) {
+        if (numa_nodes_online[i] == node)
+            return i;
+    }
+    return node;
+}
+
+/*
+ * Pins the calling thread to the CPUs of a NUMA node.
+ */
+static int numa_pin_to_node(int node) {
+    int cpus[CPU_SETSIZE];
+    char path[64];
+    cpu_set_t set;
+    int ncpus, i;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    ncpus = read_sysfs_list(path, cpus, CPU_SETSIZE);
+    if (ncpus <= 0)
+        return -1;
+
+    CPU_ZERO(&set);
+    for (i = 0; i < ncpus; i++) {
+        if (cpus[i] < CPU_SETSIZE)
+            CPU_SET(cpus[i], &set);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/*
+ * Pins the calling thread to a single CPU.
+ */
+static int cpu_pin(int cpu) {
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/*
+ * Returns the NUMA node the calling worker is pinned to, -1 if it isn't.
+ */
+int thread_numa_node(void) {
+    return my_numa_node;
+}
+
 /*
  * Set up a thread's information.
  */
@@ -347,12 +514,12 @@ static void setup_thread(LIBEVENT_THREAD *me) {
     }
 
     /* Listen for notifications from other threads */
-    event_set(&me->notify_event, me->notify_receive_fd,
+    event_set(&me->notify_event, me->notify_fd,
               EV_READ | EV_PERSIST, thread_libevent_process, me);
     event_base_set(me->base, &me->notify_event);
 
     if (event_add(&me->notify_event, 0) == -1) {
-        fprintf(stderr, "Can't monitor libevent notify pipe\n");
+        fprintf(stderr, "Can't monitor libevent notify eventfd\n");
         exit(1);
     }
 
@@ -363,11 +530,6 @@ static void setup_thread(LIBEVENT_THREAD *me) {
     }
     cq_init(me->new_conn_queue);
 
-    if (pthread_mutex_init(&me->stats.mutex, NULL) != 0) {
-        perror("Failed to initialize mutex");
-        exit(EXIT_FAILURE);
-    }
-
     me->suffix_cache = _cache_create("suffix", SUFFIX_SIZE, sizeof(char*),
                                     NULL, NULL);
     if (me->suffix_cache == NULL) {
@@ -385,10 +547,28 @@ static void *worker_libevent(void *arg) {
     /* Any per-thread setup can happen here; memcached_thread_init() will block until
      * all threads have finished initializing.
      */
+    if (me->numa_node >= 0) {
+        /* Pin first, so everything the thread sets up below (epoch, slab
+         * table, chunk cache) is first touched on its own node. */
+        if (numa_pin_to_node(me->numa_node) == 0) {
+            my_numa_node = me->numa_node;
+        } else if (settings.verbose > 0) {
+            fprintf(stderr, "Can't pin worker to NUMA node %d\n", me->numa_node);
+        }
+    } else if (me->cpu >= 0 && cpu_pin(me->cpu) != 0) {
+        if (settings.verbose > 0)
+            fprintf(stderr, "Can't pin worker to CPU %d\n", me->cpu);
+        me->cpu = -1;
+    }
 #ifdef NVM
     assoc_thread_init(me->thread_index);
     item_gc_thread_init(me->thread_index);
 #endif
+#ifdef USE_IO_URING
+    if (settings.io_uring && uring_thread_init(me) != 0) {
+        fprintf(stderr, "Can't set up io_uring, worker stays on libevent\n");
+    }
+#endif
 
     register_thread_initialized();
 
@@ -398,47 +578,35 @@ static void *worker_libevent(void *arg) {
 
 
 /*
- * Processes an incoming "handle a new connection" item. This is called when
- * input arrives on the libevent wakeup pipe.
+ * Processes the items queued for this worker. This is called when its
+ * notify eventfd is signalled.
  */
 static void thread_libevent_process(int fd, short which, void *arg) {
     LIBEVENT_THREAD *me = (LIBEVENT_THREAD*)arg;
     CQ_ITEM *item;
-    char buf[1];
+    uint64_t count;
 
-    if (read(fd, buf, 1) != 1)
+    if (read(fd, &count, sizeof(count)) != sizeof(count) && errno != EAGAIN)
         if (settings.verbose > 0)
-            fprintf(stderr, "Can't read from libevent pipe\n");
-
-    switch (buf[0]) {
-    case 'c':
-    item = cq_pop(me->new_conn_queue);
-
-    if (NULL != item) {
-        conn *c = conn_new(item->sfd, item->init_state, item->event_flags,
-                           item->read_buffer_size, item->transport, me->base);
-        if (c == NULL) {
-            if (IS_UDP(item->transport)) {
-                fprintf(stderr, "Can't listen for events on UDP socket\n");
-                exit(1);
-            } else {
-                if (settings.verbose > 0) {
-                    fprintf(stderr, "Can't listen for events on fd %d\n",
-                        item->sfd);
-                }
-                close(item->sfd);
-            }
-        } else {
-            c->thread = me;
+            fprintf(stderr, "Can't read from libevent notify eventfd\n");
+
+    /* Anything pushed from here on signals again */
+    __atomic_store_n(&me->new_conn_queue->notified, 0, __ATOMIC_SEQ_CST);
+
+    while ((item = cq_pop(me->new_conn_queue)) != NULL) {
+        switch (item->type) {
+        case CQ_NEW_CONN:
+            dispatch_conn_local(me, item->sfd, item->init_state,
+                                item->event_flags, item->read_buffer_size,
+                                item->transport);
+            cqi_free(item);
+            break;
+        /* we were told to pause and report in */
+        case CQ_PAUSE:
+            FlushThread();
+            register_thread_initialized();
+            break;
         }
-        cqi_free(item);
-    }
-        break;
-    /* we were told to pause and report in */
-    case 'p':
-        FlushThread();
-        register_thread_initialized();
-        break;
     }
 }
 
@@ -452,8 +620,21 @@ static int last_thread = -1;
  */
 void dispatch_conn_new(int sfd, enum conn_states init_state, int event_flags,
                        int read_buffer_size, enum network_transport transport) {
+    int tid = (last_thread + 1) % settings.num_threads;
+
+    last_thread = tid;
+
+    dispatch_conn_thread(tid, sfd, init_state, event_flags, read_buffer_size,
+                         transport);
+}
+
+/*
+ * Dispatches a new connection to worker thread tid, outside the round robin.
+ */
+void dispatch_conn_thread(int tid, int sfd, enum conn_states init_state,
+                          int event_flags, int read_buffer_size,
+                          enum network_transport transport) {
     CQ_ITEM *item = cqi_new();
-    char buf[1];
     if (item == NULL) {
         close(sfd);
         /* given that malloc failed this may also fail, but let's try */
@@ -461,24 +642,51 @@ void dispatch_conn_new(int sfd, enum conn_states init_state, int event_flags,
         return ;
     }
 
-    int tid = (last_thread + 1) % settings.num_threads;
-
     LIBEVENT_THREAD *thread = threads + tid;
 
-    last_thread = tid;
-
     item->sfd = sfd;
     item->init_state = init_state;
     item->event_flags = event_flags;
     item->read_buffer_size = read_buffer_size;
     item->transport = transport;
 
-    cq_push(thread->new_conn_queue, item);
-
     MEMCACHED_CONN_DISPATCH(sfd, thread->thread_id);
-    buf[0] = 'c';
-    if (write(thread->notify_send_fd, buf, 1) != 1) {
-        perror("Writing to thread notify pipe");
+    cq_push_notify(thread, item);
+}
+
+/*
+ * Sets up a connection on the calling worker itself. Used for what the
+ * dispatcher hands over and for what a worker accepts on its own listener.
+ */
+void dispatch_conn_local(LIBEVENT_THREAD *me, int sfd, enum conn_states init_state,
+                         int event_flags, int read_buffer_size,
+                         enum network_transport transport) {
+#ifdef SO_INCOMING_CPU
+    /* Steer connections whose packets arrive on our CPU to our listener */
+    if (init_state == conn_listening && me->cpu >= 0 &&
+        setsockopt(sfd, SOL_SOCKET, SO_INCOMING_CPU, &me->cpu, sizeof(me->cpu)) != 0) {
+        perror("setsockopt(SO_INCOMING_CPU)");
+    }
+#endif
+
+    conn *c = conn_new(sfd, init_state, event_flags, read_buffer_size,
+                       transport, me->base);
+    if (c == NULL) {
+        if (IS_UDP(transport)) {
+            fprintf(stderr, "Can't listen for events on UDP socket\n");
+            exit(1);
+        } else {
+            if (settings.verbose > 0) {
+                fprintf(stderr, "Can't listen for events on fd %d\n", sfd);
+            }
+            close(sfd);
+        }
+    } else {
+        c->thread = me;
+#ifdef USE_IO_URING
+        if (me->uring != NULL)
+            conn_uring_attach(c);
+#endif
     }
 }
 
@@ -496,8 +704,11 @@ int is_listen_thread() {
  */
 item *item_alloc(char *key, size_t nkey, int flags, rel_time_t exptime, int nbytes) {
     item *it;
+    uint32_t hv = hash(key, nkey);
+    uint64_t t0 = latency_now();
     /* do_item_alloc handles its own locks */
-    it = do_item_alloc(key, nkey, flags, exptime, nbytes, 0);
+    it = do_item_alloc(key, nkey, flags, exptime, nbytes, hv);
+    stats_latency_record(LAT_ALLOC, t0);
     return it;
 }
 
@@ -618,7 +829,11 @@ enum store_item_type store_item(item *item, int comm, conn* c) {
     enum store_item_type ret;
     uint32_t hv;
 
+#ifdef NVM
+    hv = item->hv;  /* hashed once by item_alloc() */
+#else
     hv = hash(ITEM_key(item), item->nkey);
+#endif
     item_lock(hv);
     ret = do_store_item(item, comm, c, hv);
     item_unlock(hv);
@@ -635,87 +850,109 @@ void STATS_UNLOCK() {
     pthread_mutex_unlock(&stats_lock);
 }
 
+/*
+ * Workers never take a lock for their stats, so a reset can't clear them
+ * under their feet. It records where each counter stood instead, and
+ * threadlocal_stats_aggregate() reports the growth since then.
+ */
+static pthread_mutex_t stats_base_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Copies the live stats of a thread with one relaxed load per counter. */
+static void thread_stats_snapshot(LIBEVENT_THREAD *t, struct thread_stats *out) {
+    int sid;
+
+    out->get_cmds = THR_STATS_READ(t->stats.get_cmds);
+    out->get_misses = THR_STATS_READ(t->stats.get_misses);
+    out->touch_cmds = THR_STATS_READ(t->stats.touch_cmds);
+    out->touch_misses = THR_STATS_READ(t->stats.touch_misses);
+    out->delete_misses = THR_STATS_READ(t->stats.delete_misses);
+    out->incr_misses = THR_STATS_READ(t->stats.incr_misses);
+    out->decr_misses = THR_STATS_READ(t->stats.decr_misses);
+    out->cas_misses = THR_STATS_READ(t->stats.cas_misses);
+    out->bytes_read = THR_STATS_READ(t->stats.bytes_read);
+    out->bytes_written = THR_STATS_READ(t->stats.bytes_written);
+    out->flush_cmds = THR_STATS_READ(t->stats.flush_cmds);
+    out->conn_yields = THR_STATS_READ(t->stats.conn_yields);
+    out->auth_cmds = THR_STATS_READ(t->stats.auth_cmds);
+    out->auth_errors = THR_STATS_READ(t->stats.auth_errors);
+    out->numa_local_accesses = THR_STATS_READ(t->stats.numa_local_accesses);
+    out->numa_remote_accesses = THR_STATS_READ(t->stats.numa_remote_accesses);
+    out->zerocopy_sends = THR_STATS_READ(t->stats.zerocopy_sends);
+    out->zerocopy_copied = THR_STATS_READ(t->stats.zerocopy_copied);
+
+    for (sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
+        out->slab_stats[sid].set_cmds = THR_STATS_READ(t->stats.slab_stats[sid].set_cmds);
+        out->slab_stats[sid].get_hits = THR_STATS_READ(t->stats.slab_stats[sid].get_hits);
+        out->slab_stats[sid].touch_hits = THR_STATS_READ(t->stats.slab_stats[sid].touch_hits);
+        out->slab_stats[sid].delete_hits = THR_STATS_READ(t->stats.slab_stats[sid].delete_hits);
+        out->slab_stats[sid].incr_hits = THR_STATS_READ(t->stats.slab_stats[sid].incr_hits);
+        out->slab_stats[sid].decr_hits = THR_STATS_READ(t->stats.slab_stats[sid].decr_hits);
+        out->slab_stats[sid].cas_hits = THR_STATS_READ(t->stats.slab_stats[sid].cas_hits);
+        out->slab_stats[sid].cas_badval = THR_STATS_READ(t->stats.slab_stats[sid].cas_badval);
+    }
+}
+
 void threadlocal_stats_reset(void) {
-    int ii, sid;
-    for (ii = 0; ii < settings.num_threads; ++ii) {
-        pthread_mutex_lock(&threads[ii].stats.mutex);
-
-        threads[ii].stats.get_cmds = 0;
-        threads[ii].stats.get_misses = 0;
-        threads[ii].stats.touch_cmds = 0;
-        threads[ii].stats.touch_misses = 0;
-        threads[ii].stats.delete_misses = 0;
-        threads[ii].stats.incr_misses = 0;
-        threads[ii].stats.decr_misses = 0;
-        threads[ii].stats.cas_misses = 0;
-        threads[ii].stats.bytes_read = 0;
-        threads[ii].stats.bytes_written = 0;
-        threads[ii].stats.flush_cmds = 0;
-        threads[ii].stats.conn_yields = 0;
-        threads[ii].stats.auth_cmds = 0;
-        threads[ii].stats.auth_errors = 0;
-
-        for(sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
-            threads[ii].stats.slab_stats[sid].set_cmds = 0;
-            threads[ii].stats.slab_stats[sid].get_hits = 0;
-            threads[ii].stats.slab_stats[sid].touch_hits = 0;
-            threads[ii].stats.slab_stats[sid].delete_hits = 0;
-            threads[ii].stats.slab_stats[sid].incr_hits = 0;
-            threads[ii].stats.slab_stats[sid].decr_hits = 0;
-            threads[ii].stats.slab_stats[sid].cas_hits = 0;
-            threads[ii].stats.slab_stats[sid].cas_badval = 0;
-        }
+    int ii;
 
-        pthread_mutex_unlock(&threads[ii].stats.mutex);
+    pthread_mutex_lock(&stats_base_lock);
+    for (ii = 0; ii < settings.num_threads; ++ii) {
+        thread_stats_snapshot(&threads[ii], &threads[ii].stats_base);
     }
+    pthread_mutex_unlock(&stats_base_lock);
 }
 
 void threadlocal_stats_aggregate(struct thread_stats *stats) {
+    struct thread_stats now;
     int ii, sid;
 
-    /* The struct has a mutex, but we can safely set the whole thing
-     * to zero since it is unused when aggregating. */
     memset(stats, 0, sizeof(*stats));
 
+    pthread_mutex_lock(&stats_base_lock);
     for (ii = 0; ii < settings.num_threads; ++ii) {
-        pthread_mutex_lock(&threads[ii].stats.mutex);
-
-        stats->get_cmds += threads[ii].stats.get_cmds;
-        stats->get_misses += threads[ii].stats.get_misses;
-        stats->touch_cmds += threads[ii].stats.touch_cmds;
-        stats->touch_misses += threads[ii].stats.touch_misses;
-        stats->delete_misses += threads[ii].stats.delete_misses;
-        stats->decr_misses += threads[ii].stats.decr_misses;
-        stats->incr_misses += threads[ii].stats.incr_misses;
-        stats->cas_misses += threads[ii].stats.cas_misses;
-        stats->bytes_read += threads[ii].stats.bytes_read;
-        stats->bytes_written += threads[ii].stats.bytes_written;
-        stats->flush_cmds += threads[ii].stats.flush_cmds;
-        stats->conn_yields += threads[ii].stats.conn_yields;
-        stats->auth_cmds += threads[ii].stats.auth_cmds;
-        stats->auth_errors += threads[ii].stats.auth_errors;
+        struct thread_stats *base = &threads[ii].stats_base;
+
+        thread_stats_snapshot(&threads[ii], &now);
+
+        stats->get_cmds += now.get_cmds - base->get_cmds;
+        stats->get_misses += now.get_misses - base->get_misses;
+        stats->touch_cmds += now.touch_cmds - base->touch_cmds;
+        stats->touch_misses += now.touch_misses - base->touch_misses;
+        stats->delete_misses += now.delete_misses - base->delete_misses;
+        stats->incr_misses += now.incr_misses - base->incr_misses;
+        stats->decr_misses += now.decr_misses - base->decr_misses;
+        stats->cas_misses += now.cas_misses - base->cas_misses;
+        stats->bytes_read += now.bytes_read - base->bytes_read;
+        stats->bytes_written += now.bytes_written - base->bytes_written;
+        stats->flush_cmds += now.flush_cmds - base->flush_cmds;
+        stats->conn_yields += now.conn_yields - base->conn_yields;
+        stats->auth_cmds += now.auth_cmds - base->auth_cmds;
+        stats->auth_errors += now.auth_errors - base->auth_errors;
+        stats->numa_local_accesses += now.numa_local_accesses - base->numa_local_accesses;
+        stats->numa_remote_accesses += now.numa_remote_accesses - base->numa_remote_accesses;
+        stats->zerocopy_sends += now.zerocopy_sends - base->zerocopy_sends;
+        stats->zerocopy_copied += now.zerocopy_copied - base->zerocopy_copied;
 
         for (sid = 0; sid < MAX_NUMBER_OF_SLAB_CLASSES; sid++) {
             stats->slab_stats[sid].set_cmds +=
-                threads[ii].stats.slab_stats[sid].set_cmds;
+                now.slab_stats[sid].set_cmds - base->slab_stats[sid].set_cmds;
             stats->slab_stats[sid].get_hits +=
-                threads[ii].stats.slab_stats[sid].get_hits;
+                now.slab_stats[sid].get_hits - base->slab_stats[sid].get_hits;
             stats->slab_stats[sid].touch_hits +=
-                threads[ii].stats.slab_stats[sid].touch_hits;
+                now.slab_stats[sid].touch_hits - base->slab_stats[sid].touch_hits;
             stats->slab_stats[sid].delete_hits +=
-                threads[ii].stats.slab_stats[sid].delete_hits;
-            stats->slab_stats[sid].decr_hits +=
-                threads[ii].stats.slab_stats[sid].decr_hits;
+                now.slab_stats[sid].delete_hits - base->slab_stats[sid].delete_hits;
             stats->slab_stats[sid].incr_hits +=
-                threads[ii].stats.slab_stats[sid].incr_hits;
+                now.slab_stats[sid].incr_hits - base->slab_stats[sid].incr_hits;
+            stats->slab_stats[sid].decr_hits +=
+                now.slab_stats[sid].decr_hits - base->slab_stats[sid].decr_hits;
             stats->slab_stats[sid].cas_hits +=
-                threads[ii].stats.slab_stats[sid].cas_hits;
+                now.slab_stats[sid].cas_hits - base->slab_stats[sid].cas_hits;
             stats->slab_stats[sid].cas_badval +=
-                threads[ii].stats.slab_stats[sid].cas_badval;
+                now.slab_stats[sid].cas_badval - base->slab_stats[sid].cas_badval;
         }
-
-        pthread_mutex_unlock(&threads[ii].stats.mutex);
     }
+    pthread_mutex_unlock(&stats_base_lock);
 }
 
 void slab_stats_aggregate(struct thread_stats *stats, struct slab_stats *out) {
@@ -760,8 +997,8 @@ void memcached_thread_init(int nthreads, struct event_base *main_base) {
     pthread_mutex_init(&init_lock, NULL);
     pthread_cond_init(&init_cond, NULL);
 
-    pthread_mutex_init(&cqi_freelist_lock, NULL);
     cqi_freelist = NULL;
+    cqi_cache = NULL;
 
     /* Want a wide lock table, but don't waste memory */
     if (nthreads < 3) {
@@ -794,32 +1031,44 @@ void memcached_thread_init(int nthreads, struct event_base *main_base) {
         pthread_mutex_init(&item_locks[i], NULL);
     }
 
-    threads = (LIBEVENT_THREAD*)calloc(nthreads, sizeof(LIBEVENT_THREAD));
-    if (! threads) {
+    /* cache line aligned, so no two threads share a line of stats */
+    if (posix_memalign((void **)&threads, 64,
+                       nthreads * sizeof(LIBEVENT_THREAD)) != 0) {
         perror("Can't allocate thread descriptors");
         exit(1);
     }
+    memset(threads, 0, nthreads * sizeof(LIBEVENT_THREAD));
 
     dispatcher_thread.base = main_base;
     dispatcher_thread.thread_id = pthread_self();
 
+    int numa_nodes = settings.numa ? numa_online_nodes() : 0;
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus < 1)
+        ncpus = 1;
+
     for (i = 0; i < nthreads; i++) {
-        int fds[2];
-        if (pipe(fds)) {
-            perror("Can't create notify pipe");
+        int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (efd == -1) {
+            perror("Can't create notify eventfd");
             exit(1);
         }
 
 #ifdef NVM
         threads[i].thread_index = i;
 #endif
+        /* Workers are spread over the nodes round-robin */
+        threads[i].numa_node = settings.numa ?
+            numa_nodes_online[i % numa_nodes] : -1;
+        /* Worker i serves the RX queue whose interrupts go to CPU i */
+        threads[i].cpu = settings.listen_mode == LISTEN_REUSEPORT_CPU ?
+            i % ncpus : -1;
 
-        threads[i].notify_receive_fd = fds[0];
-        threads[i].notify_send_fd = fds[1];
+        threads[i].notify_fd = efd;
 
         setup_thread(&threads[i]);
-        /* Reserve three fds for the libevent base, and two for the pipe */
-        stats.reserved_fds += 5;
+        /* Reserve three fds for the libevent base, and one for the eventfd */
+        stats.reserved_fds += 4;
     }
 
     /* Create threads after we've done all the libevent setup. */